@@ -2,6 +2,8 @@
 
 #include "swap_chain.hpp"
 #include "buffer.hpp"
+#include "geometry_arena.hpp"
+#include "upload_manager.hpp"
 #include "systems/point_light_system.hpp"
 #include "systems/main_system.hpp"
 #include "bindings.hpp"
@@ -41,12 +43,17 @@ void FestiApp::run() {
 	// Set maximum instance buffer size on game objects based on
 	FestiModel::setInstanceBufferSizesOnGameObjects(gameObjects);
 
-	// Create global pool
+	// Create GPU images for the textures decoded in the background while the scene was set up
+	festiMaterials.finaliseTextures();
+
+	// Create global pool, update after bind so textures can be added to the bindless array at runtime
+	const uint32_t maxTextures = festiDevice.maxBindlessTextures();
 	auto globalPool = FestiDescriptorPool::Builder(festiDevice)
-		.setMaxSets(5)
+		.setMaxSets(3 * FS_MAX_FRAMES_IN_FLIGHT)
+		.setPoolFlags(VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT_EXT)
 		.addPoolSize(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, FS_MAX_FRAMES_IN_FLIGHT * 2)
-		.addPoolSize(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1)
-		.addPoolSize(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, FS_MAXIMUM_IMAGE_DESCRIPTORS + FS_MAX_FRAMES_IN_FLIGHT)
+		.addPoolSize(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, FS_MAX_FRAMES_IN_FLIGHT)
+		.addPoolSize(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, (maxTextures + FS_MAX_TEXTURE_ARRAYS + 1) * FS_MAX_FRAMES_IN_FLIGHT)
 		.build();
 
 	// Config global descriptor set layout
@@ -57,7 +64,11 @@ void FestiApp::run() {
 	// Config materials descriptor set layout
 	auto materialsSetLayout = FestiDescriptorSetLayout::Builder(festiDevice)
 		.addBinding(0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_FRAGMENT_BIT) // Mssbo
-		.addBinding(1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT, FS_MAXIMUM_IMAGE_DESCRIPTORS) // ImageViews
+		.addBinding(FS_TEXTURE_ARRAYS_BINDING, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT, 
+			FS_MAX_TEXTURE_ARRAYS, VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT_EXT) // Packed small textures
+		.addBinding(FS_TEXTURES_BINDING, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT, maxTextures,
+			VK_DESCRIPTOR_BINDING_VARIABLE_DESCRIPTOR_COUNT_BIT_EXT | VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT_EXT |
+			VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT_EXT | VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT_EXT) // ImageViews
 		.build();
 	
 	// Config shadow descriptor set layout
@@ -68,7 +79,8 @@ void FestiApp::run() {
 	// Get handles to descriptor sets
 	std::vector<VkDescriptorSet> perFrameDescriptorSets(FS_MAX_FRAMES_IN_FLIGHT);
 	std::vector<VkDescriptorSet> shadowMapDescriptorSets(FS_MAX_FRAMES_IN_FLIGHT);
-	VkDescriptorSet materialDescriptorSet;
+	// One materials set per frame in flight so streamed textures can swap views in a set no pending frame reads
+	std::vector<VkDescriptorSet> materialDescriptorSets(FS_MAX_FRAMES_IN_FLIGHT);
 
 	// Create Mssbo for modification at runtime
 	auto& Mssbo = festiMaterials.getMssbo();
@@ -80,16 +92,22 @@ void FestiApp::run() {
 		sizeof(MaterialsSSBO),
 		1,
 		VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
-		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+		FS_MemoryCategory::MSSBO);
 	MssboBuffer->writeToBuffer(&Mssbo);
 
 	// Build materials descriptor set with pointers to GPU side Mssbo and imageview array
 	auto MssboBufferDescriptorInfo = MssboBuffer->descriptorInfo();
 	auto imageViewsDescriptorInfo = festiMaterials.getImageViewsDescriptorInfo();
-	FestiDescriptorWriter(materialsSetLayout, *globalPool)
-		.writeBuffer(0, &MssboBufferDescriptorInfo)
-		.writeImageViews(1, imageViewsDescriptorInfo)
-		.build(materialDescriptorSet);
+	auto textureArraysDescriptorInfo = festiMaterials.getTextureArraysDescriptorInfo();
+	for (auto& materialDescriptorSet : materialDescriptorSets) {
+		FestiDescriptorWriter(materialsSetLayout, *globalPool)
+			.writeBuffer(0, &MssboBufferDescriptorInfo)
+			.writeImageViews(FS_TEXTURE_ARRAYS_BINDING, textureArraysDescriptorInfo)
+			.writeImageViews(FS_TEXTURES_BINDING, imageViewsDescriptorInfo)
+			.setVariableDescriptorCount(maxTextures)
+			.build(materialDescriptorSet);
+	}
 
 	// Initalise vectors of global buffers on the CPU
 	std::vector<std::unique_ptr<FestiBuffer>> GuboBuffers(FS_MAX_FRAMES_IN_FLIGHT);;
@@ -101,7 +119,8 @@ void FestiApp::run() {
 			sizeof(GlobalUBO),
 			1,
 			VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
-			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+			FS_MemoryCategory::UNIFORM);
 
 		// Build global descriptor set with pointer to Gubo
 		auto globalBufferDescriptorInfo = GuboBuffers[i]->descriptorInfo();
@@ -132,6 +151,9 @@ void FestiApp::run() {
 	FestiCamera mainLight{festiWindow};
 	FestiCamera camera{festiWindow};
 
+	// Press M for this again at runtime
+	festiDevice.printMemoryReport();
+
 	auto lastFrameTime = std::chrono::high_resolution_clock::now();
 	std::chrono::duration<float> frameDuration{1.0f / FS_MAX_FPS};
 
@@ -161,6 +183,11 @@ void FestiApp::run() {
 
 			// Set scene to current keyframe
 			setSceneToCurrentKeyFrame(Mssbo.offsets, MssboBuffer, worldObj);
+
+			// Bring in models whose background loads have finished, reusing geometry no frame in flight still draws
+			festiDevice.getGeometryArena().nextFrame();
+			FestiModel::updatePendingLoads(festiMaterials, gameObjects, *MssboBuffer);
+
 			
 			// Set light direction and clipping distance
 			glm::vec3 lightDir = glm::vec3(worldObj->world.mainLightDirection, 0.f);
@@ -185,12 +212,24 @@ void FestiApp::run() {
 				camera,
 				mainLight,
 				perFrameDescriptorSets[frameBufferIndex],
-				materialDescriptorSet,
+				materialDescriptorSets[frameBufferIndex],
 				shadowMapDescriptorSets[frameBufferIndex],
 				gameObjects,
 				pointLights
 				};
 
+			// Stream texture mips for this view, then publish any views that changed into this frame's set
+			festiMaterials.updateTextureStreaming(frameInfo, (float)festiWindow.getExtent().height);
+			festiMaterials.writePendingDescriptors(materialsSetLayout, *globalPool, frameInfo.materialSet, frameBufferIndex);
+
+			// Submit this frame's uploads together, ahead of the draws that read them
+			festiDevice.getUploadManager().flush();
+
+			// Pick each model's level of detail for this view, then cull its meshlets
+			FestiModel::selectLods(gameObjects, camera.transform.translation,
+				.5f * (float)festiWindow.getExtent().height * camera.getProjection()[1][1]);
+			FestiModel::cullMeshlets(gameObjects, camera.getProjection() * camera.getView(), camera.transform.translation);
+
 			// Update Gubo based on frame details
 			GlobalUBO Gubo{};
 			Gubo.directionalColour = worldObj->world.mainLightColour;
@@ -221,6 +260,7 @@ void FestiApp::run() {
 		}
 	} // ENGINE MAIN LOOP END
 	vkDeviceWaitIdle(festiDevice.device());
+	FestiModel::cancelPendingLoads();
 }
 
 void FestiApp::setScene(std::shared_ptr<FestiWorld> scene) {
@@ -364,6 +404,7 @@ void FestiApp::checkInputsForSceneUpdates() {
 		sceneClockFrequency = glm::clamp(sceneClockFrequency, (uint32_t)1, FS_MAX_FPS);
 	});
     runOnceIfKeyPressed(festiWindow, GLFW_KEY_SPACE, [this]() {isRunning = !isRunning;});
+    runOnceIfKeyPressed(festiWindow, GLFW_KEY_M, [this]() {festiDevice.printMemoryReport();});
 }
 
 void FestiApp::setSceneToCurrentKeyFrame(
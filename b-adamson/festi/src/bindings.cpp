@@ -101,6 +101,13 @@ void FestiBindings::init(py::module_& m) {
             },
             py::return_value_policy::reference,
             py::arg("filepath"), py::arg("mtlDir"), py::arg("imgDir"))
+        .def_static("createModelFromFileAsync",
+            [this](const std::string& filepath, const std::string& mtlDir, const std::string& imgDir) {
+                return FestiModel::createModelFromFileAsync(*festiDevice, *gameObjects, filepath, mtlDir, imgDir);
+            },
+            py::return_value_policy::reference,
+            py::arg("filepath"), py::arg("mtlDir"), py::arg("imgDir"))
+        .def("isResident", &FestiModel::isResident)
         .def("insertKeyframe", &FestiModel::insertKeyframe,
              py::arg("idx"), py::arg("flags"), py::arg("faceIDs") = std::vector<uint32_t>{0})
         .def_readwrite("transform", &FestiModel::transform)
@@ -1,6 +1,9 @@
 #include "buffer.hpp"
 
+#include "upload_batch.hpp"
+
 // std
+#include <algorithm>
 #include <cassert>
 #include <cstring>
 #include <iostream>
@@ -21,6 +24,7 @@ FestiBuffer::FestiBuffer(
     uint32_t instanceCount,
     VkBufferUsageFlags useFlags,
     VkMemoryPropertyFlags memPropFlags,
+    FS_MemoryCategory category,
     VkDeviceSize minOffsetAlignment
     ):  festiDevice{device},
 		instanceSize{instanceSize},
@@ -29,26 +33,27 @@ FestiBuffer::FestiBuffer(
 		memoryPropertyFlags{memPropFlags} {
 	alignmentSize = getAlignment(instanceSize, minOffsetAlignment);
 	bufferSize = alignmentSize * instanceCount;
-	device.createBuffer(bufferSize, useFlags, memPropFlags, buffer, memory);
+	device.createBuffer(bufferSize, useFlags, memPropFlags, buffer, memory, category);
 	if (memPropFlags != VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) map(); 
 }
 
 FestiBuffer::~FestiBuffer() {
 	unmap();
 	vkDestroyBuffer(festiDevice.device(), buffer, nullptr);
-	vkFreeMemory(festiDevice.device(), memory, nullptr);
+	festiDevice.freeMemory(memory);
 }
 
+// Host visible blocks stay mapped, so mapping only points into the block
 VkResult FestiBuffer::map(VkDeviceSize size, VkDeviceSize offset) {
-	assert(buffer && memory && "Called map on buffer before create");
-	return vkMapMemory(festiDevice.device(), memory, offset, size, 0, &mapped);
+	(void)size;
+	assert(buffer && memory.memory && "Called map on buffer before create");
+	if (memory.mapped == nullptr) {return VK_ERROR_MEMORY_MAP_FAILED;}
+	mapped = static_cast<char*>(memory.mapped) + offset;
+	return VK_SUCCESS;
 }
 
 void FestiBuffer::unmap() {
-	if (mapped) {
-		vkUnmapMemory(festiDevice.device(), memory);
-		mapped = nullptr;
-	}
+	mapped = nullptr;
 }
 
 void FestiBuffer::writeToBuffer(void* data, VkDeviceSize size, VkDeviceSize offset) {
@@ -63,21 +68,26 @@ void FestiBuffer::writeToBuffer(void* data, VkDeviceSize size, VkDeviceSize offs
 	}
 }
 
-VkResult FestiBuffer::flush(VkDeviceSize size, VkDeviceSize offset) {
+// The range is widened to whole non-coherent atoms, which the allocator keeps inside this buffer's allocation
+VkMappedMemoryRange FestiBuffer::getMappedRange(VkDeviceSize size, VkDeviceSize offset) {
+	const VkDeviceSize atomSize = std::max<VkDeviceSize>(festiDevice.properties.limits.nonCoherentAtomSize, 1);
+	const VkDeviceSize end = size == VK_WHOLE_SIZE ? memory.size : std::min(offset + size, memory.size);
 	VkMappedMemoryRange mappedRange = {};
 	mappedRange.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
-	mappedRange.memory = memory;
-	mappedRange.offset = offset;
-	mappedRange.size = size;
+	mappedRange.memory = memory.memory;
+	mappedRange.offset = (memory.offset + offset) / atomSize * atomSize;
+	mappedRange.size = std::min(
+		(memory.offset + end + atomSize - 1) / atomSize * atomSize, memory.offset + memory.size) - mappedRange.offset;
+	return mappedRange;
+}
+
+VkResult FestiBuffer::flush(VkDeviceSize size, VkDeviceSize offset) {
+	VkMappedMemoryRange mappedRange = getMappedRange(size, offset);
 	return vkFlushMappedMemoryRanges(festiDevice.device(), 1, &mappedRange);
 }
 
 VkResult FestiBuffer::invalidate(VkDeviceSize size, VkDeviceSize offset) {
-	VkMappedMemoryRange mappedRange = {};
-	mappedRange.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
-	mappedRange.memory = memory;
-	mappedRange.offset = offset;
-	mappedRange.size = size;
+	VkMappedMemoryRange mappedRange = getMappedRange(size, offset);
 	return vkInvalidateMappedMemoryRanges(festiDevice.device(), 1, &mappedRange);
 }
 
@@ -94,26 +104,21 @@ std::unique_ptr<FestiBuffer> FestiBuffer::writeToLocalGPU(
 	FestiDevice& device, 
 	VkDeviceSize instanceSize, 
 	uint32_t instanceCount, 
-	VkBufferUsageFlagBits flags) {
-
-	VkDeviceSize bufferSize = instanceSize * instanceCount;
-
-	FestiBuffer stagingBuffer {
-		device,
-		instanceSize,
-		instanceCount,
-		VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT};
-	stagingBuffer.writeToBuffer(data);
+	VkBufferUsageFlagBits flags,
+	FS_MemoryCategory category) {
 
 	auto localBuffer = std::make_unique<FestiBuffer>(
 		device,
 		instanceSize,
 		instanceCount,
 		flags | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
-		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+		category);
 
-  	device.copyBuffer(stagingBuffer.getBuffer(), localBuffer->getBuffer(), bufferSize);
+	// Staged through the upload ring, the copy reaches the queue ahead of anything that reads the buffer
+	FestiUploadBatch uploads{device};
+	uploads.addBuffer(localBuffer->getBuffer(), data, localBuffer->getBufferSize());
+	uploads.submitAsync();
 
 	return localBuffer;
 }
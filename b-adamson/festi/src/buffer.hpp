@@ -14,6 +14,7 @@ public:
 		uint32_t instanceCount,
 		VkBufferUsageFlags usageFlags,
 		VkMemoryPropertyFlags memoryPropertyFlags,
+		FS_MemoryCategory category,
 		VkDeviceSize minOffsetAlignment = 1
 		);
 	~FestiBuffer();
@@ -48,15 +49,17 @@ public:
 		FestiDevice& device,
 		VkDeviceSize instanceSize, 
 		uint32_t instanceCount, 
-		VkBufferUsageFlagBits flags);
+		VkBufferUsageFlagBits flags,
+		FS_MemoryCategory category);
 	
 private:
 	static VkDeviceSize getAlignment(VkDeviceSize instanceSize, VkDeviceSize minOffsetAlignment);
+	VkMappedMemoryRange getMappedRange(VkDeviceSize size, VkDeviceSize offset);
 
 	FestiDevice& festiDevice;
 	void* mapped = nullptr;
 	VkBuffer buffer = VK_NULL_HANDLE;
-	VkDeviceMemory memory = VK_NULL_HANDLE;
+	FestiAllocation memory{};
 
 	VkDeviceSize bufferSize;
 	VkDeviceSize instanceSize;
@@ -13,7 +13,8 @@ FestiDescriptorSetLayout::Builder &FestiDescriptorSetLayout::Builder::addBinding
     uint32_t binding,
     VkDescriptorType descriptorType,
     VkShaderStageFlags stageFlags,
-    uint32_t count) {
+    uint32_t count,
+    VkDescriptorBindingFlagsEXT flags) {
 	assert(bindings.count(binding) == 0 && "Binding already in use");
 	VkDescriptorSetLayoutBinding layoutBinding{};
 	layoutBinding.binding = binding;
@@ -21,21 +22,28 @@ FestiDescriptorSetLayout::Builder &FestiDescriptorSetLayout::Builder::addBinding
 	layoutBinding.descriptorCount = count;
 	layoutBinding.stageFlags = stageFlags;
 	bindings[binding] = layoutBinding;
+	bindingFlags[binding] = flags;
 	return *this;
 }
 
 FestiDescriptorSetLayout FestiDescriptorSetLayout::Builder::build() const {
- 	 return FestiDescriptorSetLayout(festiDevice, bindings);
+ 	 return FestiDescriptorSetLayout(festiDevice, bindings, bindingFlags);
 }
 
 // *************** Descriptor Set Layout *********************
 
 FestiDescriptorSetLayout::FestiDescriptorSetLayout(
-    FestiDevice &festiDevice, std::unordered_map<uint32_t, VkDescriptorSetLayoutBinding> bindings)
+    FestiDevice &festiDevice, 
+	std::unordered_map<uint32_t, VkDescriptorSetLayoutBinding> bindings,
+	std::unordered_map<uint32_t, VkDescriptorBindingFlagsEXT> bindingFlags)
     : festiDevice{festiDevice}, bindings{bindings} {
 	std::vector<VkDescriptorSetLayoutBinding> setLayoutBindings{};
+	std::vector<VkDescriptorBindingFlagsEXT> setLayoutBindingFlags{};
+	VkDescriptorBindingFlagsEXT allFlags = 0;
 	for (auto kv : bindings) {
 		setLayoutBindings.push_back(kv.second);
+		setLayoutBindingFlags.push_back(bindingFlags.count(kv.first) ? bindingFlags[kv.first] : 0);
+		allFlags |= setLayoutBindingFlags.back();
 	}
 
 	VkDescriptorSetLayoutCreateInfo descriptorSetLayoutInfo{};
@@ -43,6 +51,18 @@ FestiDescriptorSetLayout::FestiDescriptorSetLayout(
 	descriptorSetLayoutInfo.bindingCount = static_cast<uint32_t>(setLayoutBindings.size());
 	descriptorSetLayoutInfo.pBindings = setLayoutBindings.data();
 
+	// Binding flags are parallel to pBindings, so only chained when some binding uses them
+	VkDescriptorSetLayoutBindingFlagsCreateInfoEXT bindingFlagsInfo{};
+	if (allFlags != 0) {
+		bindingFlagsInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO_EXT;
+		bindingFlagsInfo.bindingCount = static_cast<uint32_t>(setLayoutBindingFlags.size());
+		bindingFlagsInfo.pBindingFlags = setLayoutBindingFlags.data();
+		descriptorSetLayoutInfo.pNext = &bindingFlagsInfo;
+	}
+	if (allFlags & VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT_EXT) {
+		descriptorSetLayoutInfo.flags |= VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT_EXT;
+	}
+
 	if (vkCreateDescriptorSetLayout(
 		festiDevice.device(),
 		&descriptorSetLayoutInfo,
@@ -104,12 +124,22 @@ FestiDescriptorPool::~FestiDescriptorPool() {
 }
 
 bool FestiDescriptorPool::allocateDescriptorSet(
-    const VkDescriptorSetLayout descriptorSetLayout, VkDescriptorSet &descriptorSet) const {
+    const VkDescriptorSetLayout descriptorSetLayout, 
+	VkDescriptorSet &descriptorSet, 
+	uint32_t variableDescriptorCount) const {
 	VkDescriptorSetAllocateInfo allocInfo{};
 	allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
 	allocInfo.descriptorPool = descriptorPool;
 	allocInfo.pSetLayouts = &descriptorSetLayout;
 	allocInfo.descriptorSetCount = 1;
+
+	VkDescriptorSetVariableDescriptorCountAllocateInfoEXT variableCountInfo{};
+	if (variableDescriptorCount > 0) {
+		variableCountInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_VARIABLE_DESCRIPTOR_COUNT_ALLOCATE_INFO_EXT;
+		variableCountInfo.descriptorSetCount = 1;
+		variableCountInfo.pDescriptorCounts = &variableDescriptorCount;
+		allocInfo.pNext = &variableCountInfo;
+	}
 	if (vkAllocateDescriptorSets(festiDevice.device(), &allocInfo, &descriptorSet) != VK_SUCCESS) {
 		return false;
 	}
@@ -155,7 +185,7 @@ FestiDescriptorWriter& FestiDescriptorWriter::writeBuffer(
 }
 
 FestiDescriptorWriter& FestiDescriptorWriter::writeImageViews(
-    uint32_t binding, std::vector<VkDescriptorImageInfo>& imageInfo) {
+    uint32_t binding, std::vector<VkDescriptorImageInfo>& imageInfo, uint32_t firstArrayElement) {
   	assert(setLayout.bindings.count(binding) == 1 && "Layout does not contain specified binding");
 
 	auto& bindingDescription = setLayout.bindings[binding];
@@ -166,7 +196,7 @@ FestiDescriptorWriter& FestiDescriptorWriter::writeImageViews(
 		write.dstBinding = binding;
 		write.pImageInfo = imageInfo.data();
 		write.descriptorCount = (uint32_t)imageInfo.size();
-		write.dstArrayElement = 0;
+		write.dstArrayElement = firstArrayElement;
 
 		writes.push_back(write);
 	}
@@ -191,8 +221,13 @@ FestiDescriptorWriter& FestiDescriptorWriter::writeSampler(
 	return *this;
 }
 
+FestiDescriptorWriter& FestiDescriptorWriter::setVariableDescriptorCount(uint32_t count) {
+	variableDescriptorCount = count;
+	return *this;
+}
+
 bool FestiDescriptorWriter::build(VkDescriptorSet &set) {
-	bool success = pool.allocateDescriptorSet(setLayout.getDescriptorSetLayout(), set);
+	bool success = pool.allocateDescriptorSet(setLayout.getDescriptorSetLayout(), set, variableDescriptorCount);
 	if (!success) {
 		return false;
 	}
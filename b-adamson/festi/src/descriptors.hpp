@@ -20,16 +20,20 @@ public:
 			uint32_t binding,
 			VkDescriptorType descriptorType,
 			VkShaderStageFlags stageFlags,
-			uint32_t count = 1);
+			uint32_t count = 1,
+			VkDescriptorBindingFlagsEXT bindingFlags = 0);
 		FestiDescriptorSetLayout build() const;
 
 	private:
 		FestiDevice &festiDevice;
 		std::unordered_map<uint32_t, VkDescriptorSetLayoutBinding> bindings{};
+		std::unordered_map<uint32_t, VkDescriptorBindingFlagsEXT> bindingFlags{};
 	};
 
 	FestiDescriptorSetLayout(
-		FestiDevice &festiDevice, std::unordered_map<uint32_t, VkDescriptorSetLayoutBinding> bindings);
+		FestiDevice &festiDevice, 
+		std::unordered_map<uint32_t, VkDescriptorSetLayoutBinding> bindings,
+		std::unordered_map<uint32_t, VkDescriptorBindingFlagsEXT> bindingFlags = {});
 	~FestiDescriptorSetLayout();
 	FestiDescriptorSetLayout(const FestiDescriptorSetLayout &) = delete;
 	FestiDescriptorSetLayout &operator=(const FestiDescriptorSetLayout &) = delete;
@@ -71,8 +75,11 @@ public:
 	FestiDescriptorPool(const FestiDescriptorPool &) = delete;
 	FestiDescriptorPool &operator=(const FestiDescriptorPool &) = delete;
 
+	// variableDescriptorCount sizes the layout's variable count binding, if it has one
 	bool allocateDescriptorSet(
-		const VkDescriptorSetLayout descriptorSetLayout, VkDescriptorSet &descriptorSet) const;
+		const VkDescriptorSetLayout descriptorSetLayout, 
+		VkDescriptorSet &descriptorSet, 
+		uint32_t variableDescriptorCount = 0) const;
 
 	void freeDescriptors(std::vector<VkDescriptorSet> &descriptors) const;
 
@@ -92,10 +99,12 @@ public:
 	FestiDescriptorWriter &writeBuffer(
 		uint32_t binding, VkDescriptorBufferInfo* bufferInfo);
 	FestiDescriptorWriter &writeImageViews(
-		uint32_t binding, std::vector<VkDescriptorImageInfo>& imageInfo);
+		uint32_t binding, std::vector<VkDescriptorImageInfo>& imageInfo, uint32_t firstArrayElement = 0);
 	FestiDescriptorWriter& writeSampler(
     	uint32_t binding, VkDescriptorImageInfo& samplerInfo);
 
+	FestiDescriptorWriter& setVariableDescriptorCount(uint32_t count);
+
 	bool build(VkDescriptorSet &set);
 	void overwrite(VkDescriptorSet &set);
 
@@ -103,6 +112,7 @@ private:
 	FestiDescriptorSetLayout &setLayout;
 	FestiDescriptorPool &pool;
 	std::vector<VkWriteDescriptorSet> writes;
+	uint32_t variableDescriptorCount = 0;
 };
 
 }  // namespace festi
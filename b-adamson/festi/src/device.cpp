@@ -1,8 +1,11 @@
 #include "device.hpp"
 
+#include "geometry_arena.hpp"
+#include "upload_manager.hpp"
 #include "utils.hpp"
 
 // std
+#include <algorithm>
 #include <cstring>
 #include <iostream>
 #include <set>
@@ -58,11 +61,19 @@ FestiDevice::FestiDevice(FestiWindow &window) : window{window} {
 	createSurface();
 	pickPhysicalDevice();
 	createLogicalDevice();
+	memoryAllocator = std::make_unique<FestiMemoryAllocator>(physicalDevice, device_, memoryBudget);
 	createCommandPool();
+	uploadManager = std::make_unique<FestiUploadManager>(*this);
+	geometryArena = std::make_unique<FestiGeometryArena>(*this);
 }
 
 FestiDevice::~FestiDevice() {
+	// The upload manager submits what's still recorded, which may copy between arena buffers
+	uploadManager.reset();
+	geometryArena.reset();
 	vkDestroyCommandPool(device_, commandPool, nullptr);
+	if (transferCommandPool != VK_NULL_HANDLE) {vkDestroyCommandPool(device_, transferCommandPool, nullptr);}
+	memoryAllocator.reset();
 	vkDestroyDevice(device_, nullptr);
 
 	if (enableValidationLayers) {
@@ -84,7 +95,7 @@ void FestiDevice::createInstance() {
 	appInfo.applicationVersion = VK_MAKE_VERSION(1, 0, 0);
 	appInfo.pEngineName = "No Engine";
 	appInfo.engineVersion = VK_MAKE_VERSION(1, 0, 0);
-	appInfo.apiVersion = VK_API_VERSION_1_0;
+	appInfo.apiVersion = VK_API_VERSION_1_1;
 
 	VkInstanceCreateInfo createInfo = {};
 	createInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
@@ -131,7 +142,17 @@ void FestiDevice::pickPhysicalDevice() {
 	}
 
 	if (physicalDevice == VK_NULL_HANDLE) {
-		throw std::runtime_error("failed to find a suitable GPU!");
+		// Textures are only drawn through the bindless array, so name what a GPU lacks for it
+		std::string missing;
+		for (const auto &device : devices) {
+			const std::vector<const char*> features = missingBindlessFeatures(device);
+			if (features.empty()) {continue;}
+			VkPhysicalDeviceProperties deviceProperties;
+			vkGetPhysicalDeviceProperties(device, &deviceProperties);
+			missing += std::string("\n") + deviceProperties.deviceName + " lacks descriptor indexing features:";
+			for (const char* feature : features) {missing += std::string(" ") + feature;}
+		}
+		throw std::runtime_error("failed to find a suitable GPU!" + missing);
 	}
 
 	vkGetPhysicalDeviceProperties(physicalDevice, &properties);
@@ -143,6 +164,7 @@ void FestiDevice::createLogicalDevice() {
 
 	std::vector<VkDeviceQueueCreateInfo> queueCreateInfos;
 	std::set<uint32_t> uniqueQueueFamilies = {indices.graphicsFamily, indices.presentFamily};
+	if (indices.transferFamilyHasValue) {uniqueQueueFamilies.insert(indices.transferFamily);}
 
 	float queuePriority = 1.0f;
 	for (uint32_t queueFamily : uniqueQueueFamilies) {
@@ -154,22 +176,70 @@ void FestiDevice::createLogicalDevice() {
 		queueCreateInfos.push_back(queueCreateInfo);
 	}
 
+	// BC formats are optional, textures fall back to uncompressed RGBA8 without them
+	VkPhysicalDeviceFeatures supportedFeatures;
+	vkGetPhysicalDeviceFeatures(physicalDevice, &supportedFeatures);
+	textureCompressionBC = supportedFeatures.textureCompressionBC == VK_TRUE;
+
 	VkPhysicalDeviceFeatures deviceFeatures = {};
 	deviceFeatures.samplerAnisotropy = VK_TRUE;
+	deviceFeatures.textureCompressionBC = textureCompressionBC ? VK_TRUE : VK_FALSE;
 	deviceFeatures.geometryShader = VK_TRUE;
 	deviceFeatures.shaderSampledImageArrayDynamicIndexing = VK_TRUE;
 	deviceFeatures.shaderUniformBufferArrayDynamicIndexing = VK_TRUE;
 	deviceFeatures.shaderStorageBufferArrayDynamicIndexing = VK_TRUE;
 
+	// Bindless textures: a runtime sized, partially bound sampler array that can be written after binding
+	VkPhysicalDeviceDescriptorIndexingFeaturesEXT indexingFeatures = {};
+	indexingFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT;
+	indexingFeatures.shaderSampledImageArrayNonUniformIndexing = VK_TRUE;
+	indexingFeatures.runtimeDescriptorArray = VK_TRUE;
+	indexingFeatures.descriptorBindingVariableDescriptorCount = VK_TRUE;
+	indexingFeatures.descriptorBindingPartiallyBound = VK_TRUE;
+	indexingFeatures.descriptorBindingSampledImageUpdateAfterBind = VK_TRUE;
+	indexingFeatures.descriptorBindingUpdateUnusedWhilePending = VK_TRUE;
+
+	VkPhysicalDeviceDescriptorIndexingPropertiesEXT indexingProperties = {};
+	indexingProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_PROPERTIES_EXT;
+	VkPhysicalDeviceProperties2 properties2 = {};
+	properties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+	properties2.pNext = &indexingProperties;
+	vkGetPhysicalDeviceProperties2(physicalDevice, &properties2);
+	// The limits count every sampler the fragment stage and materials set can see, the bindless array shares
+	// them with the texture arrays and the shadow map
+	const uint32_t deviceLimit = std::min({
+		indexingProperties.maxPerStageDescriptorUpdateAfterBindSampledImages,
+		indexingProperties.maxPerStageDescriptorUpdateAfterBindSamplers,
+		indexingProperties.maxPerStageUpdateAfterBindResources,
+		indexingProperties.maxDescriptorSetUpdateAfterBindSampledImages,
+		indexingProperties.maxDescriptorSetUpdateAfterBindSamplers});
+	if (deviceLimit <= FS_RESERVED_SAMPLER_DESCRIPTORS) {
+		throw std::runtime_error("failed to fit the bindless texture array, device allows only " + 
+			std::to_string(deviceLimit) + " update after bind sampled images");
+	}
+	maxBindlessTextures_ = std::min(FS_MAXIMUM_IMAGE_DESCRIPTORS, deviceLimit - FS_RESERVED_SAMPLER_DESCRIPTORS);
+
 	VkDeviceCreateInfo createInfo = {};
 	createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+	createInfo.pNext = &indexingFeatures;
 
 	createInfo.queueCreateInfoCount = static_cast<uint32_t>(queueCreateInfos.size());
 	createInfo.pQueueCreateInfos = queueCreateInfos.data();
 
 	createInfo.pEnabledFeatures = &deviceFeatures;
-	createInfo.enabledExtensionCount = static_cast<uint32_t>(deviceExtensions.size());
-	createInfo.ppEnabledExtensionNames = deviceExtensions.data();
+	// Memory budget is optional, heap budgets are estimated without it
+	std::vector<const char*> enabledExtensions = deviceExtensions;
+	uint32_t extensionCount;
+	vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &extensionCount, nullptr);
+	std::vector<VkExtensionProperties> availableExtensions(extensionCount);
+	vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &extensionCount, availableExtensions.data());
+	memoryBudget = std::any_of(availableExtensions.begin(), availableExtensions.end(), [](const auto& extension) {
+		return std::strcmp(extension.extensionName, VK_EXT_MEMORY_BUDGET_EXTENSION_NAME) == 0;
+	});
+	if (memoryBudget) {enabledExtensions.push_back(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);}
+
+	createInfo.enabledExtensionCount = static_cast<uint32_t>(enabledExtensions.size());
+	createInfo.ppEnabledExtensionNames = enabledExtensions.data();
 
 	// might not really be necessary anymore because device specific validation layers
 	// have been deprecated
@@ -186,6 +256,12 @@ void FestiDevice::createLogicalDevice() {
 
 	vkGetDeviceQueue(device_, indices.graphicsFamily, 0, &graphicsQueue_);
 	vkGetDeviceQueue(device_, indices.presentFamily, 0, &presentQueue_);
+
+	// Software drivers and some integrated GPUs have no separate transfer family, uploads then share the graphics queue
+	graphicsFamily_ = indices.graphicsFamily;
+	transferFamily_ = indices.transferFamilyHasValue ? indices.transferFamily : indices.graphicsFamily;
+	vkGetDeviceQueue(device_, transferFamily_, 0, &transferQueue_);
+	std::cout << "transfer queue family: " << transferFamily_ << (hasTransferQueue() ? "" : " (graphics)") << std::endl;
 }
 
 void FestiDevice::createCommandPool() {
@@ -199,6 +275,12 @@ void FestiDevice::createCommandPool() {
 
 	if (vkCreateCommandPool(device_, &poolInfo, nullptr, &commandPool) != VK_SUCCESS) {
 		throw std::runtime_error("failed to create command pool!");}
+
+	if (hasTransferQueue()) {
+		poolInfo.queueFamilyIndex = transferFamily_;
+		if (vkCreateCommandPool(device_, &poolInfo, nullptr, &transferCommandPool) != VK_SUCCESS) {
+			throw std::runtime_error("failed to create transfer command pool!");}
+	}
 }
 
 void FestiDevice::createSurface() { window.createWindowSurface(instance, &surface_); }
@@ -218,7 +300,29 @@ bool FestiDevice::isDeviceSuitable(VkPhysicalDevice device) {
 	vkGetPhysicalDeviceFeatures(device, &supportedFeatures);
 
 	return indices.isComplete() && extensionsSupported && swapChainAdequate &&
-		supportedFeatures.samplerAnisotropy;
+		supportedFeatures.samplerAnisotropy && missingBindlessFeatures(device).empty();
+}
+
+std::vector<const char*> FestiDevice::missingBindlessFeatures(VkPhysicalDevice device) {
+	VkPhysicalDeviceDescriptorIndexingFeaturesEXT indexingFeatures = {};
+	indexingFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT;
+	VkPhysicalDeviceFeatures2 supportedFeatures = {};
+	supportedFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+	supportedFeatures.pNext = &indexingFeatures;
+	vkGetPhysicalDeviceFeatures2(device, &supportedFeatures);
+
+	std::vector<const char*> missing;
+	if (!indexingFeatures.shaderSampledImageArrayNonUniformIndexing) {
+		missing.push_back("shaderSampledImageArrayNonUniformIndexing");}
+	if (!indexingFeatures.runtimeDescriptorArray) {missing.push_back("runtimeDescriptorArray");}
+	if (!indexingFeatures.descriptorBindingVariableDescriptorCount) {
+		missing.push_back("descriptorBindingVariableDescriptorCount");}
+	if (!indexingFeatures.descriptorBindingPartiallyBound) {missing.push_back("descriptorBindingPartiallyBound");}
+	if (!indexingFeatures.descriptorBindingSampledImageUpdateAfterBind) {
+		missing.push_back("descriptorBindingSampledImageUpdateAfterBind");}
+	if (!indexingFeatures.descriptorBindingUpdateUnusedWhilePending) {
+		missing.push_back("descriptorBindingUpdateUnusedWhilePending");}
+	return missing;
 }
 
 void FestiDevice::populateDebugMessengerCreateInfo(VkDebugUtilsMessengerCreateInfoEXT &createInfo) {
@@ -349,6 +453,22 @@ QueueFamilyIndices FestiDevice::findQueueFamilies(VkPhysicalDevice device) {
 		}
 		i++;
 	}
+
+	// Prefer a transfer only family, the dedicated copy engine, over one shared with compute
+	for (uint32_t family = 0; family < queueFamilyCount; family++) {
+		const VkQueueFlags flags = queueFamilies[family].queueFlags;
+		// Coarser copy granularity would reject the small mip levels
+		const VkExtent3D granularity = queueFamilies[family].minImageTransferGranularity;
+		if (queueFamilies[family].queueCount == 0 || !(flags & VK_QUEUE_TRANSFER_BIT) || (flags & VK_QUEUE_GRAPHICS_BIT) ||
+			granularity.width != 1 || granularity.height != 1 || granularity.depth != 1) {
+			continue;
+		}
+		if (!indices.transferFamilyHasValue || !(flags & VK_QUEUE_COMPUTE_BIT)) {
+			indices.transferFamily = family;
+			indices.transferFamilyHasValue = true;
+		}
+		if (!(flags & VK_QUEUE_COMPUTE_BIT)) {break;}
+	}
 	return indices;
 }
 
@@ -411,7 +531,8 @@ void FestiDevice::createBuffer(
     VkBufferUsageFlags usage,
     VkMemoryPropertyFlags properties,
     VkBuffer &buffer,
-    VkDeviceMemory &bufferMemory) {
+    FestiAllocation &bufferMemory,
+    FS_MemoryCategory category) {
 	VkBufferCreateInfo bufferInfo{};
 	bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
 	bufferInfo.size = size;
@@ -425,23 +546,24 @@ void FestiDevice::createBuffer(
 	VkMemoryRequirements memRequirements;
 	vkGetBufferMemoryRequirements(device_, buffer, &memRequirements);
 
-	VkMemoryAllocateInfo allocInfo{};
-	allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-	allocInfo.allocationSize = memRequirements.size;
-	allocInfo.memoryTypeIndex = findMemoryType(memRequirements.memoryTypeBits, properties);
+	bufferMemory = memoryAllocator->allocate(memRequirements, properties, true, category);
+	vkBindBufferMemory(device_, buffer, bufferMemory.memory, bufferMemory.offset);
+}
 
-	if (vkAllocateMemory(device_, &allocInfo, nullptr, &bufferMemory) != VK_SUCCESS) {
-		throw std::runtime_error("failed to allocate vertex buffer memory!");
-	}
+VkCommandBuffer FestiDevice::beginSingleTimeCommands() {
+	return beginCommands(commandPool);
+}
 
-	vkBindBufferMemory(device_, buffer, bufferMemory, 0);
+VkCommandBuffer FestiDevice::beginTransferCommands() {
+	assert(hasTransferQueue() && "Transfer commands without a transfer queue");
+	return beginCommands(transferCommandPool);
 }
 
-VkCommandBuffer FestiDevice::beginSingleTimeCommands() {
+VkCommandBuffer FestiDevice::beginCommands(VkCommandPool pool) {
 	VkCommandBufferAllocateInfo allocInfo{};
 	allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
 	allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-	allocInfo.commandPool = commandPool;
+	allocInfo.commandPool = pool;
 	allocInfo.commandBufferCount = 1;
 
 	VkCommandBuffer commandBuffer;
@@ -456,19 +578,71 @@ VkCommandBuffer FestiDevice::beginSingleTimeCommands() {
 }
 
 void FestiDevice::endSingleTimeCommands(VkCommandBuffer commandBuffer) {
+	// Wait on this submission only rather than draining the whole queue
+	VkFence fence = submitSingleTimeCommands(commandBuffer);
+	vkWaitForFences(device_, 1, &fence, VK_TRUE, UINT64_MAX);
+	releaseSingleTimeCommands(commandBuffer, fence);
+}
+
+VkFence FestiDevice::submitSingleTimeCommands(VkCommandBuffer commandBuffer, VkSemaphore waitSemaphore) {
 	vkEndCommandBuffer(commandBuffer);
 
 	VkSubmitInfo submitInfo{};
 	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
 	submitInfo.commandBufferCount = 1;
 	submitInfo.pCommandBuffers = &commandBuffer;
+	const VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+	if (waitSemaphore != VK_NULL_HANDLE) {
+		submitInfo.waitSemaphoreCount = 1;
+		submitInfo.pWaitSemaphores = &waitSemaphore;
+		submitInfo.pWaitDstStageMask = &waitStage;
+	}
 
-	vkQueueSubmit(graphicsQueue_, 1, &submitInfo, VK_NULL_HANDLE);
-	vkQueueWaitIdle(graphicsQueue_);
+	VkFenceCreateInfo fenceInfo{};
+	fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+	VkFence fence;
+	if (vkCreateFence(device_, &fenceInfo, nullptr, &fence) != VK_SUCCESS) {
+		throw std::runtime_error("failed to create single time command fence!");
+	}
 
+	if (vkQueueSubmit(graphicsQueue_, 1, &submitInfo, fence) != VK_SUCCESS) {
+		throw std::runtime_error("failed to submit single time commands!");
+	}
+	return fence;
+}
+
+void FestiDevice::releaseSingleTimeCommands(VkCommandBuffer commandBuffer, VkFence fence) {
+	vkDestroyFence(device_, fence, nullptr);
 	vkFreeCommandBuffers(device_, commandPool, 1, &commandBuffer);
 }
 
+VkSemaphore FestiDevice::submitTransferCommands(VkCommandBuffer commandBuffer) {
+	vkEndCommandBuffer(commandBuffer);
+
+	VkSemaphoreCreateInfo semaphoreInfo{};
+	semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+	VkSemaphore semaphore;
+	if (vkCreateSemaphore(device_, &semaphoreInfo, nullptr, &semaphore) != VK_SUCCESS) {
+		throw std::runtime_error("failed to create transfer semaphore!");
+	}
+
+	VkSubmitInfo submitInfo{};
+	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submitInfo.commandBufferCount = 1;
+	submitInfo.pCommandBuffers = &commandBuffer;
+	submitInfo.signalSemaphoreCount = 1;
+	submitInfo.pSignalSemaphores = &semaphore;
+	if (vkQueueSubmit(transferQueue_, 1, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS) {
+		throw std::runtime_error("failed to submit transfer commands!");
+	}
+	return semaphore;
+}
+
+void FestiDevice::releaseTransferCommands(VkCommandBuffer commandBuffer, VkSemaphore semaphore) {
+	vkDestroySemaphore(device_, semaphore, nullptr);
+	vkFreeCommandBuffers(device_, transferCommandPool, 1, &commandBuffer);
+}
+
 void FestiDevice::copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size) {
 	VkCommandBuffer commandBuffer = beginSingleTimeCommands();
 
@@ -482,7 +656,7 @@ void FestiDevice::copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSiz
 }
 
 void FestiDevice::copyBufferToImage(
-    VkBuffer buffer, VkImage image, uint32_t width, uint32_t height, uint32_t layerCount) {
+    VkBuffer buffer, VkImage image, uint32_t width, uint32_t height, uint32_t layerCount, uint32_t mipLevels) {
     VkCommandBuffer commandBuffer = beginSingleTimeCommands();
     
     VkImageMemoryBarrier barrier = {};
@@ -496,7 +670,7 @@ void FestiDevice::copyBufferToImage(
     barrier.image = image;
     barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
     barrier.subresourceRange.baseMipLevel = 0;
-    barrier.subresourceRange.levelCount = 1;
+    barrier.subresourceRange.levelCount = mipLevels;
     barrier.subresourceRange.baseArrayLayer = 0;
     barrier.subresourceRange.layerCount = layerCount;
 
@@ -506,24 +680,34 @@ void FestiDevice::copyBufferToImage(
         0, 0, nullptr, 0, nullptr, 1, &barrier
     );
 
-    VkBufferImageCopy region{};
-    region.bufferOffset = 0;
-    region.bufferRowLength = 0;
-    region.bufferImageHeight = 0;
-    region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-    region.imageSubresource.mipLevel = 0;
-    region.imageSubresource.baseArrayLayer = 0;
-    region.imageSubresource.layerCount = layerCount;
-    region.imageOffset = {0, 0, 0};
-    region.imageExtent = {width, height, 1};
+    // Mip levels are expected tightly packed one after another in the buffer (RGBA8)
+    std::vector<VkBufferImageCopy> regions(mipLevels);
+    VkDeviceSize bufferOffset = 0;
+    for (uint32_t level = 0; level < mipLevels; level++) {
+        uint32_t levelWidth = std::max(width >> level, 1u);
+        uint32_t levelHeight = std::max(height >> level, 1u);
+
+        VkBufferImageCopy& region = regions[level];
+        region.bufferOffset = bufferOffset;
+        region.bufferRowLength = 0;
+        region.bufferImageHeight = 0;
+        region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        region.imageSubresource.mipLevel = level;
+        region.imageSubresource.baseArrayLayer = 0;
+        region.imageSubresource.layerCount = layerCount;
+        region.imageOffset = {0, 0, 0};
+        region.imageExtent = {levelWidth, levelHeight, 1};
+
+        bufferOffset += (VkDeviceSize)levelWidth * levelHeight * 4 * layerCount;
+    }
 
     vkCmdCopyBufferToImage(
         commandBuffer,
         buffer,
         image,
         VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-        1,
-        &region
+        (uint32_t)regions.size(),
+        regions.data()
     );
 
     barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
@@ -540,11 +724,116 @@ void FestiDevice::copyBufferToImage(
     endSingleTimeCommands(commandBuffer);
 }
 
+bool FestiDevice::supportsLinearBlit(VkFormat format) {
+	VkFormatProperties props;
+	vkGetPhysicalDeviceFormatProperties(physicalDevice, format, &props);
+	const VkFormatFeatureFlags required = VK_FORMAT_FEATURE_BLIT_SRC_BIT | VK_FORMAT_FEATURE_BLIT_DST_BIT |
+		VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+	return (props.optimalTilingFeatures & required) == required;
+}
+
+void FestiDevice::recordMipmapBlits(
+	VkCommandBuffer commandBuffer, 
+	VkImage image, 
+	uint32_t width, 
+	uint32_t height, 
+	uint32_t baseLevel, 
+	uint32_t mipLevels, 
+	uint32_t layerCount) {
+	// Expects every level in TRANSFER_DST_OPTIMAL with levels up to baseLevel written, fills the rest
+	// by blitting down from baseLevel and leaves all levels in SHADER_READ_ONLY_OPTIMAL
+	VkImageMemoryBarrier barrier{};
+	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.image = image;
+	barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	barrier.subresourceRange.baseArrayLayer = 0;
+	barrier.subresourceRange.layerCount = layerCount;
+
+	// levels below baseLevel are final
+	if (baseLevel > 0) {
+		barrier.subresourceRange.baseMipLevel = 0;
+		barrier.subresourceRange.levelCount = baseLevel;
+		barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+		barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+		vkCmdPipelineBarrier(
+			commandBuffer,
+			VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+			0, 0, nullptr, 0, nullptr, 1, &barrier);
+	}
+
+	barrier.subresourceRange.levelCount = 1;
+	int32_t mipWidth = std::max((int32_t)(width >> baseLevel), 1);
+	int32_t mipHeight = std::max((int32_t)(height >> baseLevel), 1);
+	for (uint32_t level = baseLevel + 1; level < mipLevels; level++) {
+		// previous level becomes the blit source
+		barrier.subresourceRange.baseMipLevel = level - 1;
+		barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+		barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+		vkCmdPipelineBarrier(
+			commandBuffer,
+			VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+			0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+		const int32_t nextWidth = std::max(mipWidth / 2, 1);
+		const int32_t nextHeight = std::max(mipHeight / 2, 1);
+
+		VkImageBlit blit{};
+		blit.srcOffsets[0] = {0, 0, 0};
+		blit.srcOffsets[1] = {mipWidth, mipHeight, 1};
+		blit.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		blit.srcSubresource.mipLevel = level - 1;
+		blit.srcSubresource.baseArrayLayer = 0;
+		blit.srcSubresource.layerCount = layerCount;
+		blit.dstOffsets[0] = {0, 0, 0};
+		blit.dstOffsets[1] = {nextWidth, nextHeight, 1};
+		blit.dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		blit.dstSubresource.mipLevel = level;
+		blit.dstSubresource.baseArrayLayer = 0;
+		blit.dstSubresource.layerCount = layerCount;
+
+		vkCmdBlitImage(
+			commandBuffer,
+			image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+			image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+			1, &blit,
+			VK_FILTER_LINEAR);
+
+		barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+		barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+		barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+		vkCmdPipelineBarrier(
+			commandBuffer,
+			VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+			0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+		mipWidth = nextWidth;
+		mipHeight = nextHeight;
+	}
+
+	barrier.subresourceRange.baseMipLevel = mipLevels - 1;
+	barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+	barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+	vkCmdPipelineBarrier(
+		commandBuffer,
+		VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+		0, 0, nullptr, 0, nullptr, 1, &barrier);
+}
+
 void FestiDevice::createImageWithInfo(
     const VkImageCreateInfo &imageInfo,
     VkMemoryPropertyFlags properties,
     VkImage &image,
-    VkDeviceMemory &imageMemory) {
+    FestiAllocation &imageMemory,
+    FS_MemoryCategory category) {
 	if (vkCreateImage(device_, &imageInfo, nullptr, &image) != VK_SUCCESS) {
 		throw std::runtime_error("failed to create image!");
   	}
@@ -552,16 +841,9 @@ void FestiDevice::createImageWithInfo(
 	VkMemoryRequirements memRequirements;
 	vkGetImageMemoryRequirements(device_, image, &memRequirements);
 
-	VkMemoryAllocateInfo allocInfo{};
-	allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-	allocInfo.allocationSize = memRequirements.size;
-	allocInfo.memoryTypeIndex = findMemoryType(memRequirements.memoryTypeBits, properties);
-
-	if (vkAllocateMemory(device_, &allocInfo, nullptr, &imageMemory) != VK_SUCCESS) {
-		throw std::runtime_error("failed to allocate image memory!");
-	}
-
-	if (vkBindImageMemory(device_, image, imageMemory, 0) != VK_SUCCESS) {
+	imageMemory = memoryAllocator->allocate(
+		memRequirements, properties, imageInfo.tiling == VK_IMAGE_TILING_LINEAR, category);
+	if (vkBindImageMemory(device_, image, imageMemory.memory, imageMemory.offset) != VK_SUCCESS) {
 		throw std::runtime_error("failed to bind image memory!");
 	}
 }
@@ -1,5 +1,6 @@
 #pragma once
 
+#include "memory_allocator.hpp"
 #include "window.hpp"
 
 // lib
@@ -12,8 +13,17 @@
 
 namespace festi {
 
+class FestiGeometryArena;
+class FestiUploadManager;
+
 constexpr uint32_t FS_UNSPECIFIED = UINT32_MAX;
-constexpr uint32_t FS_MAXIMUM_IMAGE_DESCRIPTORS = 500;
+// Bindless texture array size. Devices with descriptor indexing must allow at least 500000 update after bind
+// sampled images per stage and per set, so 4096 fits anywhere the engine runs and keeps the descriptor pool
+// small. It's still clamped to the device's limits in createLogicalDevice
+constexpr uint32_t FS_MAXIMUM_IMAGE_DESCRIPTORS = 4096;
+constexpr uint32_t FS_MAX_TEXTURE_ARRAYS = 64;
+// Fragment samplers beside the bindless array: one per texture array and the shadow map
+constexpr uint32_t FS_RESERVED_SAMPLER_DESCRIPTORS = FS_MAX_TEXTURE_ARRAYS + 1;
 constexpr uint32_t FS_MAX_LIGHTS = 30;
 constexpr uint32_t FS_MAX_FRAMES_IN_FLIGHT = 2;
 constexpr uint32_t FS_MAX_FPS = 120;
@@ -31,8 +41,10 @@ struct SwapChainSupportDetails {
 struct QueueFamilyIndices {
     uint32_t graphicsFamily;
     uint32_t presentFamily;
+    uint32_t transferFamily; // a family without graphics, only set when the device has one
     bool graphicsFamilyHasValue = false;
     bool presentFamilyHasValue = false;
+    bool transferFamilyHasValue = false;
     bool isComplete() { return graphicsFamilyHasValue && presentFamilyHasValue; }
 };
 
@@ -76,10 +88,17 @@ public:
 	FestiDevice &operator=(FestiDevice &&) = delete;
 
 	VkCommandPool getCommandPool() { return commandPool; }
+	FestiUploadManager& getUploadManager() { return *uploadManager; }
+	FestiGeometryArena& getGeometryArena() { return *geometryArena; }
 	VkDevice device() { return device_; }
 	VkSurfaceKHR surface() { return surface_; }
 	VkQueue graphicsQueue() { return graphicsQueue_; }
 	VkQueue presentQueue() { return presentQueue_; }
+	// Falls back to the graphics queue, in which case no ownership transfers are needed
+	VkQueue transferQueue() { return transferQueue_; }
+	bool hasTransferQueue() { return transferFamily_ != graphicsFamily_; }
+	uint32_t graphicsQueueFamily() { return graphicsFamily_; }
+	uint32_t transferQueueFamily() { return transferFamily_; }
 
 	SwapChainSupportDetails getSwapChainSupport() { return querySwapChainSupport(physicalDevice); }
 	uint32_t findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties);
@@ -93,20 +112,46 @@ public:
 		VkBufferUsageFlags usage,
 		VkMemoryPropertyFlags properties,
 		VkBuffer &buffer,
-		VkDeviceMemory &bufferMemory);
+		FestiAllocation &bufferMemory,
+		FS_MemoryCategory category);
 
 	void createCommandBuffers(std::vector<VkCommandBuffer>& commandBuffers);
 	VkCommandBuffer beginSingleTimeCommands();
 	void endSingleTimeCommands(VkCommandBuffer commandBuffer);
+	// Submits without waiting, the returned fence signals once the commands have run. Both are handed
+	// back to releaseSingleTimeCommands after that. The commands start once waitSemaphore is signalled, if given
+	VkFence submitSingleTimeCommands(VkCommandBuffer commandBuffer, VkSemaphore waitSemaphore = VK_NULL_HANDLE);
+	void releaseSingleTimeCommands(VkCommandBuffer commandBuffer, VkFence fence);
+	// As above on the transfer queue, signalling the returned semaphore for a graphics submission to wait on.
+	// Released once that submission's fence has signalled
+	VkCommandBuffer beginTransferCommands();
+	VkSemaphore submitTransferCommands(VkCommandBuffer commandBuffer);
+	void releaseTransferCommands(VkCommandBuffer commandBuffer, VkSemaphore semaphore);
 	void copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size);
 	void copyBufferToImage(
-		VkBuffer buffer, VkImage image, uint32_t width, uint32_t height, uint32_t layerCount);
+		VkBuffer buffer, VkImage image, uint32_t width, uint32_t height, uint32_t layerCount, uint32_t mipLevels = 1);
+	void recordMipmapBlits(
+		VkCommandBuffer commandBuffer, 
+		VkImage image, 
+		uint32_t width, 
+		uint32_t height, 
+		uint32_t baseLevel, 
+		uint32_t mipLevels, 
+		uint32_t layerCount = 1);
+	bool supportsLinearBlit(VkFormat format);
+	bool supportsTextureCompressionBC() { return textureCompressionBC; }
+	uint32_t maxBindlessTextures() { return maxBindlessTextures_; }
 
 	void createImageWithInfo(
 		const VkImageCreateInfo &imageInfo,
 		VkMemoryPropertyFlags properties,
 		VkImage &image,
-		VkDeviceMemory &imageMemory);
+		FestiAllocation &imageMemory,
+		FS_MemoryCategory category);
+	// Returns a buffer or image's memory to its block, after the resource itself is destroyed
+	void freeMemory(FestiAllocation &allocation) { memoryAllocator->free(allocation); }
+	FestiMemoryStats memoryStats() { return memoryAllocator->getStats(); }
+	void printMemoryReport() { memoryAllocator->printReport(); }
 
 	void createGraphicsPipeline(
 		const std::string& vertFilepath,
@@ -142,9 +187,12 @@ private:
 	void pickPhysicalDevice();
 	void createLogicalDevice();
 	void createCommandPool();
+	VkCommandBuffer beginCommands(VkCommandPool pool);
 
 	// helper functions
 	bool isDeviceSuitable(VkPhysicalDevice device);
+	// Descriptor indexing features the bindless texture array needs that device doesn't support
+	std::vector<const char*> missingBindlessFeatures(VkPhysicalDevice device);
 	std::vector<const char *> getRequiredExtensions();
 	bool checkValidationLayerSupport();
 	QueueFamilyIndices findQueueFamilies(VkPhysicalDevice device);
@@ -158,16 +206,26 @@ private:
 	VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
 	FestiWindow &window;
 	VkCommandPool commandPool;
+	VkCommandPool transferCommandPool = VK_NULL_HANDLE;
+	std::unique_ptr<FestiMemoryAllocator> memoryAllocator;
+	std::unique_ptr<FestiUploadManager> uploadManager;
+	std::unique_ptr<FestiGeometryArena> geometryArena;
 
 	VkDevice device_;
 	VkSurfaceKHR surface_;
 	VkQueue graphicsQueue_;
 	VkQueue presentQueue_;
+	VkQueue transferQueue_;
+	uint32_t graphicsFamily_;
+	uint32_t transferFamily_;
+	bool textureCompressionBC = false;
+	bool memoryBudget = false;
+	uint32_t maxBindlessTextures_ = 0;
 
 	const std::vector<const char*> validationLayers = {"VK_LAYER_KHRONOS_validation"};
 	const std::vector<const char*> deviceExtensions = {
-		VK_KHR_SWAPCHAIN_EXTENSION_NAME
-		// VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME
+		VK_KHR_SWAPCHAIN_EXTENSION_NAME,
+		VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME
 		};
 };
 
@@ -0,0 +1,185 @@
+#include "geometry_arena.hpp"
+
+#include "buffer.hpp"
+#include "model.hpp"
+#include "upload_batch.hpp"
+#include "upload_manager.hpp"
+
+// std
+#include <algorithm>
+#include <cassert>
+#include <iterator>
+
+namespace festi {
+
+FestiGeometryArena::FestiGeometryArena(FestiDevice& device) : festiDevice{device} {
+	vertexPool.strides = {sizeof(glm::vec3), sizeof(PackedVertexAttributes)}; // positions, attributes
+	vertexPool.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
+	vertexPool.category = FS_MemoryCategory::VERTEX;
+	vertexPool.minCapacity = FS_GEOMETRY_MIN_VERTICES;
+	for (size_t i = 0; i < indexPools.size(); i++) {
+		indexPools[i].strides = {i == 0 ? sizeof(uint16_t) : sizeof(uint32_t)};
+		indexPools[i].usage = VK_BUFFER_USAGE_INDEX_BUFFER_BIT;
+		indexPools[i].category = FS_MemoryCategory::INDEX;
+		indexPools[i].minCapacity = FS_GEOMETRY_MIN_INDICES;
+	}
+}
+
+FestiGeometryArena::~FestiGeometryArena() {}
+
+FestiMeshGeometry FestiGeometryArena::allocate(uint32_t vertexCount, uint32_t indexCount, VkIndexType indexType) {
+	FestiMeshGeometry geometry;
+	geometry.indexType = indexType;
+	geometry.vertices = allocateRange(vertexPool, vertexCount);
+	geometry.indices = allocateRange(indexPool(indexType), indexCount);
+	return geometry;
+}
+
+void FestiGeometryArena::free(const FestiMeshGeometry& geometry) {
+	retired.emplace_back(frame + FS_MAX_FRAMES_IN_FLIGHT, geometry);
+}
+
+void FestiGeometryArena::nextFrame() {
+	frame++;
+	for (auto& entry : retired) {
+		if (entry.first > frame) {continue;}
+		freeRange(vertexPool, entry.second.vertices);
+		freeRange(indexPool(entry.second.indexType), entry.second.indices);
+	}
+	retired.erase(std::remove_if(retired.begin(), retired.end(),
+		[this](const auto& entry) {return entry.first <= frame;}), retired.end());
+	retiredBuffers.erase(std::remove_if(retiredBuffers.begin(), retiredBuffers.end(),
+		[this](const auto& buffer) {return buffer.first <= frame;}), retiredBuffers.end());
+}
+
+void FestiGeometryArena::addUpload(
+	FestiUploadBatch& uploads, const FestiMeshGeometry& geometry, FS_GeometryStream stream, const void* data) {
+	const bool indices = stream == FS_GeometryStream::INDEX;
+	Pool& pool = indices ? indexPool(geometry.indexType) : vertexPool;
+	const FestiGeometryRange& range = indices ? geometry.indices : geometry.vertices;
+	if (range.count == 0) {return;}
+	const size_t buffer = stream == FS_GeometryStream::ATTRIBUTE ? 1 : 0;
+	const VkDeviceSize stride = pool.strides[buffer];
+	uploads.addBuffer(pool.buffers[buffer]->getBuffer(), data, range.count * stride, range.first * stride);
+}
+
+bool FestiGeometryArena::bindVertices(VkCommandBuffer commandBuffer, bool positionsOnly) {
+	if (vertexPool.buffers.empty()) {return false;}
+	const VkDeviceSize offset = 0;
+	VkBuffer positions = vertexPool.buffers[0]->getBuffer();
+	vkCmdBindVertexBuffers(commandBuffer, 0, 1, &positions, &offset);
+	if (!positionsOnly) {
+		VkBuffer attributes = vertexPool.buffers[1]->getBuffer();
+		vkCmdBindVertexBuffers(commandBuffer, 2, 1, &attributes, &offset);
+	}
+	return true;
+}
+
+bool FestiGeometryArena::bindIndices(VkCommandBuffer commandBuffer, VkIndexType indexType) {
+	Pool& pool = indexPool(indexType);
+	if (pool.buffers.empty()) {return false;}
+	vkCmdBindIndexBuffer(commandBuffer, pool.buffers[0]->getBuffer(), 0, indexType);
+	return true;
+}
+
+FestiGeometryRange FestiGeometryArena::allocateRange(Pool& pool, uint32_t count) {
+	if (count == 0) {return {};}
+	while (true) {
+		// Best fit leaves the large ranges whole for large meshes
+		auto best = pool.freeRanges.end();
+		for (auto it = pool.freeRanges.begin(); it != pool.freeRanges.end(); ++it) {
+			if (it->second < count) {continue;}
+			if (best == pool.freeRanges.end() || it->second < best->second) {best = it;}
+		}
+		if (best == pool.freeRanges.end()) {
+			grow(pool, std::max({pool.minCapacity, 2 * pool.capacity, pool.capacity + count}));
+			continue;
+		}
+
+		const FestiGeometryRange range{best->first, count};
+		const uint32_t remaining = best->second - count;
+		pool.freeRanges.erase(best);
+		if (remaining > 0) {pool.freeRanges[range.first + count] = remaining;}
+		return range;
+	}
+}
+
+void FestiGeometryArena::freeRange(Pool& pool, const FestiGeometryRange& range) {
+	if (range.count == 0) {return;}
+	uint32_t first = range.first;
+	uint32_t count = range.count;
+	auto next = pool.freeRanges.lower_bound(first);
+	if (next != pool.freeRanges.end() && first + count == next->first) {
+		count += next->second;
+		next = pool.freeRanges.erase(next);
+	}
+	if (next != pool.freeRanges.begin()) {
+		auto previous = std::prev(next);
+		if (previous->first + previous->second == first) {
+			previous->second += count;
+			return;
+		}
+	}
+	pool.freeRanges.emplace_hint(next, first, count);
+}
+
+void FestiGeometryArena::grow(Pool& pool, uint32_t capacity) {
+	assert(capacity > pool.capacity && "Geometry pools only grow");
+	std::vector<std::unique_ptr<FestiBuffer>> buffers;
+	for (VkDeviceSize stride : pool.strides) {
+		buffers.push_back(std::make_unique<FestiBuffer>(
+			festiDevice,
+			stride,
+			capacity,
+			pool.usage | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+			pool.category));
+	}
+
+	if (pool.capacity > 0) {
+		// Only the runs in use are copied, so new ranges in the old free space can be written from the transfer
+		// queue in the same submission without the copy landing on top of them
+		std::vector<FestiGeometryRange> used;
+		uint32_t next = 0;
+		for (const auto& gap : pool.freeRanges) {
+			if (gap.first > next) {used.push_back({next, gap.first - next});}
+			next = gap.first + gap.second;
+		}
+		if (next < pool.capacity) {used.push_back({next, pool.capacity - next});}
+
+		// After every earlier write to the old buffers, including those handed over from the transfer queue
+		VkCommandBuffer commandBuffer = festiDevice.getUploadManager().graphicsCommands();
+		VkMemoryBarrier barrier{};
+		barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+		barrier.srcAccessMask = VK_ACCESS_MEMORY_WRITE_BIT;
+		barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+		vkCmdPipelineBarrier(
+			commandBuffer,
+			VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+			0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+		for (size_t i = 0; i < pool.strides.size(); i++) {
+			const VkDeviceSize stride = pool.strides[i];
+			std::vector<VkBufferCopy> regions;
+			for (const auto& range : used) {
+				regions.push_back({range.first * stride, range.first * stride, range.count * stride});
+			}
+			if (!regions.empty()) {
+				vkCmdCopyBuffer(
+					commandBuffer,
+					pool.buffers[i]->getBuffer(),
+					buffers[i]->getBuffer(),
+					(uint32_t)regions.size(),
+					regions.data());
+			}
+			retiredBuffers.emplace_back(frame + FS_MAX_FRAMES_IN_FLIGHT, std::move(pool.buffers[i]));
+		}
+	}
+
+	// The new space joins the free range at the old end, if there is one
+	freeRange(pool, {pool.capacity, capacity - pool.capacity});
+	pool.capacity = capacity;
+	pool.buffers = std::move(buffers);
+}
+
+} // namespace festi
@@ -0,0 +1,90 @@
+#pragma once
+
+#include "device.hpp"
+
+// std
+#include <array>
+#include <map>
+#include <memory>
+#include <utility>
+#include <vector>
+
+namespace festi {
+
+class FestiBuffer;
+class FestiUploadBatch;
+
+constexpr uint32_t FS_GEOMETRY_MIN_VERTICES = 1u << 20; // first capacity of the vertex streams
+constexpr uint32_t FS_GEOMETRY_MIN_INDICES = 1u << 22; // first capacity of each index buffer
+
+enum class FS_GeometryStream {
+	POSITION, // glm::vec3, binding 0
+	ATTRIBUTE, // PackedVertexAttributes, binding 2
+	INDEX // of the mesh's index type
+};
+
+// A run of elements in one of the arena's pools
+struct FestiGeometryRange {
+	uint32_t first = 0;
+	uint32_t count = 0;
+};
+
+// Where a mesh lives in the arena. Its indices stay relative to its own vertices, draws pass vertices.first as
+// the vertex offset and add indices.first to the first index
+struct FestiMeshGeometry {
+	FestiGeometryRange vertices;
+	FestiGeometryRange indices;
+	VkIndexType indexType = VK_INDEX_TYPE_UINT32;
+};
+
+// Every mesh's geometry sub-allocated from a few device local buffers shared by the scene: a position stream,
+// a packed attribute stream and one index buffer per index type. A pass binds them once and only switches
+// instance buffers between models. Full pools move to larger buffers, the ranges in use copied across in the
+// upload manager's current submission. Freed ranges are reused once no frame in flight can still draw them
+class FestiGeometryArena {
+public:
+	FestiGeometryArena(FestiDevice& device);
+	~FestiGeometryArena();
+
+	FestiGeometryArena(const FestiGeometryArena&) = delete;
+	FestiGeometryArena& operator=(const FestiGeometryArena&) = delete;
+
+	FestiMeshGeometry allocate(uint32_t vertexCount, uint32_t indexCount, VkIndexType indexType);
+	void free(const FestiMeshGeometry& geometry);
+	// Call once per frame, after its fence has been waited on
+	void nextFrame();
+
+	// data holds the stream's elements for the whole range and must stay alive until the batch is submitted
+	void addUpload(FestiUploadBatch& uploads, const FestiMeshGeometry& geometry, FS_GeometryStream stream, const void* data);
+
+	// Binds positions to binding 0 and, unless positionsOnly, attributes to binding 2. False while nothing is allocated
+	bool bindVertices(VkCommandBuffer commandBuffer, bool positionsOnly = false);
+	// False while no mesh uses indexType
+	bool bindIndices(VkCommandBuffer commandBuffer, VkIndexType indexType);
+
+private:
+	struct Pool {
+		std::vector<VkDeviceSize> strides; // one buffer per stream
+		VkBufferUsageFlags usage;
+		FS_MemoryCategory category;
+		uint32_t minCapacity;
+		uint32_t capacity = 0;
+		std::map<uint32_t, uint32_t> freeRanges; // first to count, neighbours are always merged
+		std::vector<std::unique_ptr<FestiBuffer>> buffers;
+	};
+
+	Pool& indexPool(VkIndexType indexType) {return indexPools[indexType == VK_INDEX_TYPE_UINT16 ? 0 : 1];}
+	FestiGeometryRange allocateRange(Pool& pool, uint32_t count);
+	void freeRange(Pool& pool, const FestiGeometryRange& range);
+	void grow(Pool& pool, uint32_t capacity);
+
+	FestiDevice& festiDevice;
+	Pool vertexPool;
+	std::array<Pool, 2> indexPools; // UINT16, UINT32
+	// With the frame they're freed on. Buffers replaced by growth wait too, as frames in flight still read them
+	std::vector<std::pair<uint64_t, FestiMeshGeometry>> retired;
+	std::vector<std::pair<uint64_t, std::unique_ptr<FestiBuffer>>> retiredBuffers;
+	uint64_t frame = 0;
+};
+
+} // namespace festi
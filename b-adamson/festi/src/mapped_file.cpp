@@ -0,0 +1,61 @@
+#include "mapped_file.hpp"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace festi {
+
+#ifdef _WIN32
+
+FestiMappedFile::FestiMappedFile(const std::string& filePath) {
+	HANDLE file = CreateFileA(
+		filePath.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE) {return;}
+
+	LARGE_INTEGER fileSize;
+	if (GetFileSizeEx(file, &fileSize) && fileSize.QuadPart > 0) {
+		// The view keeps the mapping alive, so both handles can be closed straight away
+		HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (mapping) {
+			data_ = static_cast<const uint8_t*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+			if (data_) {size_ = static_cast<size_t>(fileSize.QuadPart);}
+			CloseHandle(mapping);
+		}
+	}
+	CloseHandle(file);
+}
+
+FestiMappedFile::~FestiMappedFile() {
+	if (data_) {UnmapViewOfFile(data_);}
+}
+
+#else
+
+FestiMappedFile::FestiMappedFile(const std::string& filePath) {
+	int fd = open(filePath.c_str(), O_RDONLY);
+	if (fd < 0) {return;}
+
+	struct stat fileStat;
+	if (fstat(fd, &fileStat) == 0 && fileStat.st_size > 0) {
+		void* mapped = mmap(nullptr, static_cast<size_t>(fileStat.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+		if (mapped != MAP_FAILED) {
+			data_ = static_cast<const uint8_t*>(mapped);
+			size_ = static_cast<size_t>(fileStat.st_size);
+		}
+	}
+	close(fd);
+}
+
+FestiMappedFile::~FestiMappedFile() {
+	if (data_) {munmap(const_cast<uint8_t*>(data_), size_);}
+}
+
+#endif
+
+} // namespace festi
@@ -0,0 +1,30 @@
+#pragma once
+
+// std
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace festi {
+
+// Read only view of a whole file, backed by MapViewOfFile on Windows and mmap elsewhere.
+// A file that can't be opened or is empty leaves the mapping invalid rather than throwing,
+// since callers use it to probe caches
+class FestiMappedFile {
+public:
+	FestiMappedFile(const std::string& filePath);
+	~FestiMappedFile();
+
+	FestiMappedFile(const FestiMappedFile&) = delete;
+	FestiMappedFile& operator=(const FestiMappedFile&) = delete;
+
+	bool valid() const {return data_ != nullptr;}
+	const uint8_t* data() const {return data_;}
+	size_t size() const {return size_;}
+
+private:
+	const uint8_t* data_ = nullptr;
+	size_t size_ = 0;
+};
+
+} // namespace festi
@@ -1,14 +1,51 @@
 #include "materials.hpp"
 
 #include "utils.hpp"
+#include "thread_pool.hpp"
+#include "upload_batch.hpp"
+#include "texture_cooker.hpp"
+#include "descriptors.hpp"
+#include "texture_streamer.hpp"
 
 // lib
 #include <stdexcept>
 #include <iostream>
 #include <unordered_map>
+#include <chrono>
+#include <cassert>
+#include <algorithm>
 
 namespace festi {
 
+uint32_t FestiMaterials::reserveTextureIndex(const std::string& name) {
+	const uint32_t idx = nextTextureSlot;
+	if (idx >= festiDevice.maxBindlessTextures()) {
+		throw std::runtime_error("failed to add texture " + name + ", bindless texture array is full");
+	}
+	nextTextureSlot++;
+	imageViews[name] = std::pair(idx, VK_NULL_HANDLE);
+	return idx;
+}
+
+uint32_t FestiMaterials::reserveTextureArrayLayer(const std::string& name, VkFormat format, uint32_t width, uint32_t height) {
+	// Arrays already on the GPU are full, later textures start a new one
+	uint32_t array = 0;
+	while (array < textureArrays.size()) {
+		const auto& candidate = textureArrays[array];
+		if (candidate.image == VK_NULL_HANDLE && candidate.format == format && candidate.width == width && 
+			candidate.height == height && candidate.layerCount < FS_MAX_TEXTURE_ARRAY_LAYERS) {
+			break;
+		}
+		array++;
+	}
+	if (array == FS_MAX_TEXTURE_ARRAYS) {return reserveTextureIndex(name);}
+	if (array == textureArrays.size()) {textureArrays.push_back({format, width, height});}
+
+	const uint32_t idx = encodeArrayTexture(array, textureArrays[array].layerCount++);
+	imageViews[name] = std::pair(idx, VK_NULL_HANDLE);
+	return idx;
+}
+
 uint32_t FestiMaterials::appendTextureMap(tinyobj::material_t& matData, const std::string& imgDirPath,const FS_ImageMapFlags flag) {
 	std::string name;
 	VkFormat format;
@@ -33,9 +70,27 @@ uint32_t FestiMaterials::appendTextureMap(tinyobj::material_t& matData, const st
 	uint32_t idx;
 	if (!name.empty()) {
 		if (imageViews.find(name) == imageViews.end()) {
-			idx = (uint32_t)imageViews.size();
 			std::string path = imgDirPath + "/" + name + ".png";
-			imageViews[name] = std::pair(idx, createImageViewFromFile(path, format));
+
+			// Streaming uploads levels individually from the CPU, so the whole chain is built on decode
+			TextureSource source{path, "", format, flag, false};
+			if (festiDevice.supportsTextureCompressionBC()) {
+				source.cachePath = getTextureCachePath(imgDirPath, name, flag);
+			}
+
+			// Reserve the index now so indices follow request order, the image is created by finaliseTextures
+			// once the decode has landed. Small textures are packed into arrays rather than streamed
+			uint32_t width, height;
+			const VkFormat uploadFormat = source.cachePath.empty() ? format : getCookedFormat(flag);
+			if (!texturesFinalised && getImageExtent(path, width, height) && std::max(width, height) <= FS_TEXTURE_ARRAY_MAX_SIZE) {
+				idx = reserveTextureArrayLayer(name, uploadFormat, width, height);
+			} else {
+				idx = reserveTextureIndex(name);
+			}
+			if (textureRequests.empty()) {texturesRequestedAt = std::chrono::high_resolution_clock::now();}
+			pendingTextureSlots.insert(idx);
+			textureRequests.push_back({name, FestiThreadPool::shared().submit(
+				[source]() { return decodeImage(source); })});
 		} else {
 			idx = imageViews[name].first;
 		}
@@ -46,35 +101,126 @@ uint32_t FestiMaterials::appendTextureMap(tinyobj::material_t& matData, const st
 
 FestiMaterials::FestiMaterials(FestiDevice& device) : festiDevice{device} {
     createDiffuseSampler();
+    textureStreamer = std::make_unique<FestiTextureStreamer>(festiDevice);
 }
 
-void FestiMaterials::writeImageDataToGPU(FestiDevice& device, VkImage image, const std::vector<uint8_t>& imageData, uint32_t width, uint32_t height) {
-    VkDeviceSize bufferSize = imageData.size();
+void FestiMaterials::finaliseTextures() {
+    texturesFinalised = true;
+    if (textureRequests.empty()) {return;}
+
+    // The streamer reads levels back from the cache files as it needs them, only the smallest mips are uploaded now.
+    // Packed layers are gathered per array and uploaded whole
+    FestiUploadBatch uploads{festiDevice};
+    std::vector<std::vector<DecodedImage>> arrayLayers(textureArrays.size());
+    size_t cachedCount = 0;
+    for (auto& request : textureRequests) {
+        DecodedImage decoded = request.decoded.get();
+        cachedCount += decoded.fromCache;
+        const uint32_t idx = imageViews[request.name].first;
+        if (isArrayTexture(idx)) {
+            auto& layers = arrayLayers[idx & 0xFFFF];
+            layers.resize(textureArrays[idx & 0xFFFF].layerCount);
+            layers[(idx >> 16) - 1] = std::move(decoded);
+        } else {
+            textureStreamer->addTexture(idx, std::move(decoded), uploads);
+        }
+    }
+    std::vector<std::vector<uint8_t>> packedArrays(textureArrays.size());
+    for (size_t array = 0; array < textureArrays.size(); array++) {
+        if (textureArrays[array].image != VK_NULL_HANDLE) {continue;}
+        createTextureArray(textureArrays[array], arrayLayers[array], packedArrays[array], uploads);
+    }
+    uploads.submit();
+    // Initial descriptors are written from getImageViewsDescriptorInfo
+    textureStreamer->clearChangedSlots();
+
+    // Cold when everything had to be decoded, warm when everything came from the cache
+    std::chrono::duration<float, std::milli> elapsed = std::chrono::high_resolution_clock::now() - texturesRequestedAt;
+    const char* startKind = cachedCount == textureRequests.size() ? "warm" : cachedCount == 0 ? "cold" : "partially cached";
+    std::cout << "Created " << textureRequests.size() << " textures (" << cachedCount << " from cache, " 
+        << textureArrays.size() << " texture arrays, " 
+        << FestiThreadPool::shared().size() << " decode threads), " << startKind << " start took " << elapsed.count() << " ms\n";
+    textureRequests.clear();
+    pendingTextureSlots.clear();
+}
+
+// Runs on the thread pool, so must not touch Vulkan or any shared state
+DecodedImage FestiMaterials::decodeImage(const TextureSource& source) {
+    DecodedImage image;
+
+    FestiMappedFile sourceFile{source.filePath};
+    if (!sourceFile.valid()) {
+        throw std::runtime_error("Failed to open image file: " + source.filePath);
+    }
+    // Caches are matched to what the file holds rather than when it changed
+    const uint64_t sourceHash = hashBytes(sourceFile.data(), sourceFile.size());
+
+    // A cooked texture of the same source skips the PNG decode entirely
+    const bool cook = !source.cachePath.empty();
+    if (cook) {
+        if (readKTX2(source.cachePath, image, sourceHash) && image.format == getCookedFormat(source.flag) &&
+            image.mipLevels == getMipLevels(image.width, image.height)) {
+            image.fromCache = true;
+            image.cacheFile = source.cachePath;
+            return image;
+        }
+        image = DecodedImage{};
+    }
 
-    festi::FestiBuffer stagingBuffer(
-        device,
-        bufferSize,
-        1,
-        VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+    // Uncompressed textures are cached decoded
+    std::string decodedCachePath;
+    if (!cook) {
+        decodedCachePath = getDecodedCachePath(sourceHash, source.format);
+        if (readDecodedCache(decodedCachePath, image) && image.format == source.format &&
+            (source.blitMipmaps || image.mipLevels == getMipLevels(image.width, image.height))) {
+            image.fromCache = true;
+            image.cacheFile = decodedCachePath;
+            return image;
+        }
+        image = DecodedImage{};
+    }
+
+    image.format = source.format;
+    if (!loadImageFromMemory(sourceFile.data(), sourceFile.size(), image.width, image.height, image.data)) {
+        throw std::runtime_error("Failed to load image from file: " + source.filePath);
+    }
 
-    stagingBuffer.writeToBuffer((void*)imageData.data(), bufferSize);
-    device.copyBufferToImage(stagingBuffer.getBuffer(), image, width, height, 1);
+    // Formats without linear blit support get their mip chain built here instead, block compressed
+    // formats can't be blitted so are always cooked with every level
+    if (cook || !source.blitMipmaps) {
+        image.mipLevels = getMipLevels(image.width, image.height);
+        generateMipChain(image.data, image.width, image.height, image.mipLevels, source.format == VK_FORMAT_R8G8B8A8_SRGB);
+    }
+
+    const std::string& cachePath = cook ? source.cachePath : decodedCachePath;
+    if (cook) {image = cookTexture(image, source.flag);}
+    if (cook ? writeKTX2(cachePath, image, sourceHash) : writeDecodedCache(cachePath, image)) {
+        image.cacheFile = cachePath;
+    } else {
+        std::cerr << "Failed to write texture cache: " << cachePath << "\n";
+    }
+    return image;
 }
 
-// Function to create image views from a list of file paths
 VkImageView FestiMaterials::createImageViewFromFile(
     const std::string& filePath, VkFormat format) {
+    TextureSource source{filePath, "", format, FS_ImageMapFlags::DIFFUSE, festiDevice.supportsLinearBlit(format)};
+    DecodedImage decoded = decodeImage(source);
 
-    uint32_t width, height;
-    std::vector<uint8_t> imageData;
+    FestiUploadBatch uploads{festiDevice};
+    VkImageView imageView = createTextureImage(decoded, uploads);
+    uploads.submit();
+    return imageView;
+}
 
-    // Load image data from file
-    if (!loadImageFromFile(filePath, width, height, imageData)) {
-        throw std::runtime_error("Failed to load image from file: " + filePath);
-    }
+VkImageView FestiMaterials::createTextureImage(const DecodedImage& decoded, FestiUploadBatch& uploads) {
+    const uint32_t width = decoded.width;
+    const uint32_t height = decoded.height;
+    const uint32_t mipLevels = getMipLevels(width, height);
+    const VkFormat format = decoded.format;
+    const bool blitMipmaps = decoded.mipLevels < mipLevels;
 
-    VkDeviceMemory imageMemory;
+    FestiAllocation imageMemory;
 
     // Create Image
     VkImageCreateInfo imageCreateInfo{};
@@ -82,15 +228,23 @@ VkImageView FestiMaterials::createImageViewFromFile(
     imageCreateInfo.format = format;
     imageCreateInfo.extent.width = width;
     imageCreateInfo.extent.height = height;
+    imageCreateInfo.mipLevels = mipLevels;
+    if (blitMipmaps) {imageCreateInfo.usage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;}
     VkImage image;
-    festiDevice.createImageWithInfo(imageCreateInfo, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, image, imageMemory);
+    festiDevice.createImageWithInfo(
+        imageCreateInfo, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, image, imageMemory, FS_MemoryCategory::TEXTURE);
+
+    // Queue the upload, levels the decode didn't produce are blitted on the GPU
+    assert((!blitMipmaps || festiDevice.supportsLinearBlit(format)) && "Missing mip levels for format without blit support");
+    uploads.addImage(image, format, decoded.bytes(), decoded.byteSize(), width, height, decoded.mipLevels, mipLevels);
 
     // Create Image View
-    writeImageDataToGPU(festiDevice, image, imageData, width, height);
     VkImageViewCreateInfo viewCreateInfo{};
     festiDevice.defaultImageViewCreateInfo(viewCreateInfo);
     viewCreateInfo.image = image;
     viewCreateInfo.format = format;
+    viewCreateInfo.subresourceRange.levelCount = mipLevels;
+    viewCreateInfo.components = getTextureComponentMapping(format);
     VkImageView imageView;
     if (vkCreateImageView(festiDevice.device(), &viewCreateInfo, nullptr, &imageView) != VK_SUCCESS) {
         throw std::runtime_error("Failed to create image view!");
@@ -111,19 +265,86 @@ void FestiMaterials::createDiffuseSampler() {
     samplerInfo.compareOp = VK_COMPARE_OP_ALWAYS;
     samplerInfo.mipLodBias = 0.0f;
     samplerInfo.minLod = 0.0f;
-    samplerInfo.maxLod = 0.0f;
+    samplerInfo.maxLod = VK_LOD_CLAMP_NONE;
     samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
     
     vkCreateSampler(festiDevice.device(), &samplerInfo, nullptr, &diffuseSampler);
 }
 
+void FestiMaterials::createTextureArray(
+    TextureArray& textureArray, std::vector<DecodedImage>& layers, std::vector<uint8_t>& packedData, FestiUploadBatch& uploads) {
+    const uint32_t mipLevels = getMipLevels(textureArray.width, textureArray.height);
+    for (const auto& layer : layers) {
+        if (layer.width != textureArray.width || layer.height != textureArray.height || 
+            layer.format != textureArray.format || layer.mipLevels != mipLevels) {
+            throw std::runtime_error("failed to pack texture array, a layer does not match its header");
+        }
+    }
+
+    // Copies expect each level to hold every layer in turn
+    VkDeviceSize levelOffset = 0;
+    for (uint32_t level = 0; level < mipLevels; level++) {
+        const VkDeviceSize levelSize = getMipLevelSize(textureArray.format, textureArray.width >> level, textureArray.height >> level);
+        for (const auto& layer : layers) {
+            packedData.insert(packedData.end(), layer.bytes() + levelOffset, layer.bytes() + levelOffset + levelSize);
+        }
+        levelOffset += levelSize;
+    }
+
+    VkImageCreateInfo imageCreateInfo{};
+    festiDevice.defaultImageCreateInfo(imageCreateInfo);
+    imageCreateInfo.format = textureArray.format;
+    imageCreateInfo.extent.width = textureArray.width;
+    imageCreateInfo.extent.height = textureArray.height;
+    imageCreateInfo.mipLevels = mipLevels;
+    imageCreateInfo.arrayLayers = textureArray.layerCount;
+    festiDevice.createImageWithInfo(
+        imageCreateInfo,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+        textureArray.image,
+        textureArray.memory,
+        FS_MemoryCategory::TEXTURE);
+    uploads.addImage(
+        textureArray.image, 
+        textureArray.format, 
+        packedData.data(), 
+        packedData.size(), 
+        textureArray.width, 
+        textureArray.height, 
+        mipLevels, 
+        mipLevels, 
+        textureArray.layerCount);
+
+    VkImageViewCreateInfo viewCreateInfo{};
+    festiDevice.defaultImageViewCreateInfo(viewCreateInfo);
+    viewCreateInfo.image = textureArray.image;
+    viewCreateInfo.viewType = VK_IMAGE_VIEW_TYPE_2D_ARRAY;
+    viewCreateInfo.format = textureArray.format;
+    viewCreateInfo.subresourceRange.levelCount = mipLevels;
+    viewCreateInfo.subresourceRange.layerCount = textureArray.layerCount;
+    viewCreateInfo.components = getTextureComponentMapping(textureArray.format);
+    if (vkCreateImageView(festiDevice.device(), &viewCreateInfo, nullptr, &textureArray.view) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create texture array image view!");
+    }
+}
+
+std::vector<VkDescriptorImageInfo> FestiMaterials::getTextureArraysDescriptorInfo() {
+    std::vector<VkDescriptorImageInfo> descriptorImageInfos;
+    for (const auto& textureArray : textureArrays) {
+        descriptorImageInfos.push_back({diffuseSampler, textureArray.view, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL});
+    }
+    return descriptorImageInfos;
+}
+
 std::vector<VkDescriptorImageInfo> FestiMaterials::getImageViewsDescriptorInfo() {
     std::vector<VkDescriptorImageInfo> descriptorImageInfos;
-	descriptorImageInfos.resize(imageViews.size());
+	descriptorImageInfos.resize(nextTextureSlot);
 	// Remember diffuseImageViews type is string : std::pair(uint32_t, VkImageView)
     for (auto& imageView : imageViews) {
+        const uint32_t slot = imageView.second.first;
+        if (isArrayTexture(slot)) {continue;}
         VkDescriptorImageInfo imageInfo;
-        imageInfo.imageView = imageView.second.second;
+        imageInfo.imageView = textureStreamer->isStreamed(slot) ? textureStreamer->getImageView(slot) : imageView.second.second;
         imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
         imageInfo.sampler = diffuseSampler;
 
@@ -132,28 +353,132 @@ std::vector<VkDescriptorImageInfo> FestiMaterials::getImageViewsDescriptorInfo()
     return descriptorImageInfos;
 }
 
+void FestiMaterials::finaliseLateTextures() {
+    if (!texturesFinalised || textureRequests.empty()) {return;}
+
+    // Recorded rather than waited on, the flush puts the copies ahead of this frame's draws
+    FestiUploadBatch uploads{festiDevice};
+    for (auto it = textureRequests.begin(); it != textureRequests.end();) {
+        if (it->decoded.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+            it++;
+            continue;
+        }
+        const uint32_t slot = imageViews[it->name].first;
+        textureStreamer->addTexture(slot, it->decoded.get(), uploads);
+        pendingTextureSlots.erase(slot);
+        it = textureRequests.erase(it);
+    }
+    uploads.submitAsync();
+}
+
+bool FestiMaterials::texturesReady(uint32_t materialID) const {
+    if (materialID == FS_UNSPECIFIED) {return true;}
+    const Material& material = Mssbo.materials[materialID];
+    for (uint32_t slot : {material.diffuseTextureIndex, material.normalTextureIndex, material.specularTextureIndex}) {
+        if (pendingTextureSlots.count(slot) > 0) {return false;}
+    }
+    return true;
+}
+
+void FestiMaterials::updateTextureStreaming(FrameInfo& frameInfo, float viewportHeight) {
+    const glm::vec3 cameraPosition = frameInfo.camera.transform.translation;
+    // Pixels covered by one world unit at distance one
+    const float pixelsPerUnit = .5f * viewportHeight * frameInfo.camera.getProjection()[1][1];
+
+    // Objects are treated as sitting at their origin, instances inherit their parent's demand
+    for (auto& kv : frameInfo.gameObjects) {
+        auto& obj = kv.second;
+        if (!obj->hasVertexBuffer || !obj->visibility) {continue;}
+
+        const glm::vec3 scale = obj->transform.scale;
+        const float maxScale = std::max({std::abs(scale.x), std::abs(scale.y), std::abs(scale.z), 1e-4f});
+        const float distance = std::max(glm::length(obj->transform.translation - cameraPosition), .01f);
+        for (const auto& range : obj->getMaterialRanges()) {
+            if (range.texelDensity <= 0.f || range.materialID == FS_UNSPECIFIED) {continue;}
+            const Material& material = Mssbo.materials[range.materialID];
+            for (uint32_t slot : {material.diffuseTextureIndex, material.normalTextureIndex, material.specularTextureIndex}) {
+                if (slot == FS_UNSPECIFIED || isArrayTexture(slot) || !textureStreamer->isStreamed(slot)) {continue;}
+                const float texelsPerUnit = textureStreamer->getFullResolution(slot) * range.texelDensity / maxScale;
+                textureStreamer->requestMipLevel(slot, std::log2(std::max(texelsPerUnit * distance / pixelsPerUnit, 1.f)));
+            }
+        }
+    }
+    textureStreamer->update();
+}
+
+void FestiMaterials::writePendingDescriptors(
+    FestiDescriptorSetLayout& setLayout, FestiDescriptorPool& pool, VkDescriptorSet set, uint32_t frameIndex) {
+    std::vector<uint32_t> changedSlots = textureStreamer->takeChangedSlots(frameIndex);
+    if (changedSlots.empty()) {return;}
+
+    // This frame's fence has been waited on, so nothing in flight reads its set
+    std::vector<std::vector<VkDescriptorImageInfo>> imageInfos;
+    imageInfos.reserve(changedSlots.size());
+    FestiDescriptorWriter writer{setLayout, pool};
+    for (uint32_t slot : changedSlots) {
+        imageInfos.push_back({{diffuseSampler, textureStreamer->getImageView(slot), VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL}});
+        writer.writeImageViews(FS_TEXTURES_BINDING, imageInfos.back(), slot);
+    }
+    writer.overwrite(set);
+}
+
+void FestiMaterials::setTextureBudget(VkDeviceSize bytes) {
+    textureStreamer->setBudget(bytes);
+}
+
 std::vector<uint32_t> FestiMaterials::getSpecialisationConstants() {
     return std::vector<uint32_t>{
         1000, 1000, 1000};
 }
 
 FestiMaterials::~FestiMaterials() {
+    textureStreamer.reset();
+    for (auto& it : textureArrays) {
+        vkDestroyImageView(festiDevice.device(), it.view, nullptr);
+        vkDestroyImage(festiDevice.device(), it.image, nullptr);
+        festiDevice.freeMemory(it.memory);
+    }
     for (auto& it : imageViews) {vkDestroyImageView(festiDevice.device(), it.second.second, nullptr);}
-    for (auto& it : imageMemories) {vkFreeMemory(festiDevice.device(), it, nullptr);}
     for (auto& it : images) {vkDestroyImage(festiDevice.device(), it, nullptr);}
+    for (auto& it : imageMemories) {festiDevice.freeMemory(it);}
     vkDestroySampler(festiDevice.device(), diffuseSampler, nullptr);
 }
 
 void MaterialsSSBO::appendMaterialFaceIDs(FS_ModelMap& gameObjects) {
 	std::fill(objFaceData, objFaceData + 65536, ObjFaceData{});
 	size_t offset = 0;
+	offsets.resize(gameObjects.size());
     for (uint32_t i = 0; i < gameObjects.size(); i++) {
-		offsets.push_back(offset);
-		if (!gameObjects[i]->hasVertexBuffer) {continue;}
-		auto IDs =  gameObjects[i]->faceData;
-		std::copy(IDs.begin(), IDs.end(), objFaceData + offset);
-		offset += IDs.size();
+		offsets[i] = offset;
+		auto& obj = gameObjects[i];
+		if (!obj->hasVertexBuffer) {continue;}
+		obj->resolveFaceOverrides();
+		const auto& faceSlots = obj->getFaceSlots();
+		for (size_t face = 0; face < obj->faceData.size(); face++) {
+			objFaceData[offset + faceSlots[face]] = obj->faceData[face];
+		}
+		offset += obj->faceData.size();
     }
+	faceDataEnd = (uint32_t)offset;
 }	
 
+void MaterialsSSBO::appendFaceData(FestiModel& obj, FestiBuffer& MssboBuffer) {
+	// Models are never removed, so later ones just take the free tail
+	const uint32_t faceCount = (uint32_t)obj.faceData.size();
+	if (faceDataEnd + faceCount > std::size(objFaceData)) {
+		throw std::runtime_error("failed to append face data, the materials buffer is full");
+	}
+	if (offsets.size() <= obj.getId()) {offsets.resize(obj.getId() + 1, faceDataEnd);}
+	offsets[obj.getId()] = faceDataEnd;
+
+	obj.resolveFaceOverrides();
+	const auto& faceSlots = obj.getFaceSlots();
+	for (uint32_t face = 0; face < faceCount; face++) {
+		objFaceData[faceDataEnd + faceSlots[face]] = obj.faceData[face];
+	}
+	// No frame in flight reads the new range yet
+	MssboBuffer.writeToBuffer(objFaceData + faceDataEnd, faceCount * sizeof(ObjFaceData), faceDataEnd * sizeof(ObjFaceData));
+	faceDataEnd += faceCount;
+}
+
 } // namespace festi
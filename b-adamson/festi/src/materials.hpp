@@ -1,6 +1,7 @@
 #pragma once
 
 #include "buffer.hpp"
+#include "mapped_file.hpp"
 
 // lib
 #define GLM_FORCE_RADIANS
@@ -18,10 +19,17 @@
 #include <string>
 #include <optional>
 #include <random>
+#include <future>
+#include <chrono>
 
 namespace festi {
 
 class FestiModel;
+class FestiUploadBatch;
+class FestiDescriptorSetLayout;
+class FestiDescriptorPool;
+class FestiTextureStreamer;
+struct FrameInfo;
 using FS_ImageMap = std::unordered_map<std::string, std::pair<uint32_t, VkImageView>>;
 using FS_Model = std::shared_ptr<FestiModel>;
 using FS_ModelMap = std::unordered_map<uint32_t, FS_Model>;
@@ -33,6 +41,18 @@ using FS_PointLightMap = std::unordered_map<uint32_t, FS_PointLight>;
 class FestiWorld;
 using FS_World = std::shared_ptr<FestiWorld>;
 
+// Materials set: binding 0 is the Mssbo, binding 1 the texture arrays small textures are packed into and
+// binding 2 the variable sized bindless texture array (a variable count binding has to come last)
+constexpr uint32_t FS_TEXTURE_ARRAYS_BINDING = 1;
+constexpr uint32_t FS_TEXTURES_BINDING = 2;
+constexpr uint32_t FS_MAX_TEXTURE_ARRAY_LAYERS = 256;
+constexpr uint32_t FS_TEXTURE_ARRAY_MAX_SIZE = 512; // textures no larger than this are packed instead of streamed
+
+// Material texture indices either address textures[] directly, or hold a textureArrays[] index in the
+// low 16 bits and the layer + 1 in the high 16 bits
+inline uint32_t encodeArrayTexture(uint32_t array, uint32_t layer) {return ((layer + 1) << 16) | array;}
+inline bool isArrayTexture(uint32_t index) {return index != FS_UNSPECIFIED && (index >> 16) != 0;}
+
 enum class FS_ImageMapFlags {
     DIFFUSE,
     NORMAL,
@@ -94,12 +114,55 @@ struct ObjFaceData {
     }
 };
 
+struct DecodedImage {
+    uint32_t width = 0;
+    uint32_t height = 0;
+    uint32_t mipLevels = 1; // levels present in data, the rest are blitted on the GPU
+    VkFormat format = VK_FORMAT_R8G8B8A8_UNORM;
+    bool fromCache = false;
+    std::string cacheFile; // where the levels were read from or written to, empty when caching failed
+    std::vector<uint8_t> data;
+    // Set instead of data when the pixels are read straight out of a mapped cache file
+    std::shared_ptr<FestiMappedFile> mappedFile;
+    size_t mappedOffset = 0;
+
+    const uint8_t* bytes() const {return mappedFile ? mappedFile->data() + mappedOffset : data.data();}
+    size_t byteSize() const {return mappedFile ? mappedFile->size() - mappedOffset : data.size();}
+};
+
+struct TextureSource {
+    std::string filePath;
+    std::string cachePath; // cooked KTX2 location, empty when the device has no BC support
+    VkFormat format;
+    FS_ImageMapFlags flag;
+    bool blitMipmaps;
+};
+
+struct TextureRequest {
+    std::string name;
+    std::future<DecodedImage> decoded;
+};
+
+// Same format, same size textures sharing one image, one allocation and one descriptor
+struct TextureArray {
+    VkFormat format;
+    uint32_t width;
+    uint32_t height;
+    uint32_t layerCount = 0;
+    VkImage image = VK_NULL_HANDLE;
+    FestiAllocation memory{};
+    VkImageView view = VK_NULL_HANDLE;
+};
+
 struct MaterialsSSBO {
     ObjFaceData objFaceData[65536] = {};
     Material materials[200];
 
     void appendMaterialFaceIDs(FS_ModelMap& gameObjects);
+    // Places a model that became resident after appendMaterialFaceIDs past every other model's faces
+    void appendFaceData(FestiModel& obj, FestiBuffer& MssboBuffer);
     static std::vector<uint32_t> offsets;
+    static uint32_t faceDataEnd;
 };
 
 class FestiMaterials {
@@ -117,21 +180,39 @@ public:
         const std::string& filePath, 
         VkFormat format);
 
+    // Waits for the queued texture decodes and hands them to the streamer with only their smallest
+    // mips resident. Must be called before getImageViewsDescriptorInfo
+    void finaliseTextures();
+
+    // Hands textures requested since finaliseTextures to the streamer as their decodes land. Their uploads go
+    // out with the upload manager's next flush and their descriptors are written by writePendingDescriptors
+    void finaliseLateTextures();
+    // False while any texture the material samples is still decoding
+    bool texturesReady(uint32_t materialID) const;
+
     std::vector<VkDescriptorImageInfo> getImageViewsDescriptorInfo();
+    std::vector<VkDescriptorImageInfo> getTextureArraysDescriptorInfo();
+
+    // Requests mip levels from each visible object's distance and UV density, then streams within budget
+    void updateTextureStreaming(FrameInfo& frameInfo, float viewportHeight);
+    // Writes views that changed since this frame's descriptor set was last used
+    void writePendingDescriptors(
+        FestiDescriptorSetLayout& setLayout, FestiDescriptorPool& pool, VkDescriptorSet set, uint32_t frameIndex);
+    void setTextureBudget(VkDeviceSize bytes);
 
     std::vector<uint32_t> getSpecialisationConstants();
     
 private:
     // helpers
-    void writeImageDataToGPU(
-        FestiDevice& device, 
-        VkImage image, 
-        const std::vector<uint8_t>& imageData, 
-        uint32_t width, 
-        uint32_t height);
-
+    uint32_t reserveTextureIndex(const std::string& name);
+    uint32_t reserveTextureArrayLayer(const std::string& name, VkFormat format, uint32_t width, uint32_t height);
+    void createTextureArray(TextureArray& textureArray, std::vector<DecodedImage>& layers, 
+        std::vector<uint8_t>& packedData, FestiUploadBatch& uploads);
     uint32_t appendTextureMap(tinyobj::material_t& matData, const std::string& imgDirPath, const FS_ImageMapFlags flag);
 
+    static DecodedImage decodeImage(const TextureSource& source);
+    VkImageView createTextureImage(const DecodedImage& decoded, FestiUploadBatch& uploads);
+
     void createDiffuseSampler();
 
     FestiDevice& festiDevice;
@@ -140,7 +221,14 @@ private:
 
     VkSampler diffuseSampler;
     FS_ImageMap imageViews;
-    std::vector<VkDeviceMemory> imageMemories;
+    std::vector<TextureRequest> textureRequests;
+    std::unordered_set<uint32_t> pendingTextureSlots; // of textureRequests
+    bool texturesFinalised = false; // later textures are all streamed, the texture arrays binding can't be updated
+    std::unique_ptr<FestiTextureStreamer> textureStreamer;
+    std::vector<TextureArray> textureArrays;
+    uint32_t nextTextureSlot = 0;
+    std::chrono::high_resolution_clock::time_point texturesRequestedAt;
+    std::vector<FestiAllocation> imageMemories;
     std::vector<VkImage> images;
 
     static std::unordered_map<std::string, uint32_t> materialNamesMap;
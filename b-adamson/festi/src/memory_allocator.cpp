@@ -0,0 +1,311 @@
+#include "memory_allocator.hpp"
+
+// std
+#include <algorithm>
+#include <iostream>
+#include <iterator>
+#include <stdexcept>
+
+namespace festi {
+
+namespace {
+
+VkDeviceSize alignUp(VkDeviceSize value, VkDeviceSize alignment) {
+	return (value + alignment - 1) / alignment * alignment;
+}
+
+float toMiB(VkDeviceSize bytes) {return bytes / (1024.f * 1024.f);}
+
+} // namespace
+
+const char* memoryCategoryName(FS_MemoryCategory category) {
+	switch (category) {
+		case FS_MemoryCategory::VERTEX: return "vertex";
+		case FS_MemoryCategory::INDEX: return "index";
+		case FS_MemoryCategory::INSTANCE: return "instance";
+		case FS_MemoryCategory::UNIFORM: return "uniform";
+		case FS_MemoryCategory::MSSBO: return "Mssbo";
+		case FS_MemoryCategory::STAGING: return "staging";
+		case FS_MemoryCategory::TEXTURE: return "texture";
+		case FS_MemoryCategory::SHADOW_MAP: return "shadow map";
+		case FS_MemoryCategory::DEPTH: return "depth";
+		default: return "unknown";
+	}
+}
+
+FestiMemoryAllocator::FestiMemoryAllocator(VkPhysicalDevice physicalDevice, VkDevice device, bool memoryBudgetSupported)
+	: physicalDevice{physicalDevice}, device{device}, memoryBudgetSupported{memoryBudgetSupported} {
+	vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+	nonCoherentAtomSize = std::max<VkDeviceSize>(properties.limits.nonCoherentAtomSize, 1);
+
+	// A block never takes more than an eighth of its heap, small host visible heaps would run out otherwise
+	blockSizes.resize(memoryProperties.memoryTypeCount);
+	for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++) {
+		const VkDeviceSize heapSize = memoryProperties.memoryHeaps[memoryProperties.memoryTypes[i].heapIndex].size;
+		blockSizes[i] = alignUp(std::min(FS_MEMORY_BLOCK_SIZE, heapSize / 8), nonCoherentAtomSize);
+	}
+	pools.resize(2 * memoryProperties.memoryTypeCount);
+	heapAllocatedBytes.resize(memoryProperties.memoryHeapCount);
+	heapWarned.resize(memoryProperties.memoryHeapCount);
+}
+
+FestiMemoryAllocator::~FestiMemoryAllocator() {
+	for (uint32_t i = 0; i < pools.size(); i++) {
+		for (auto& block : pools[i]) {freeMemory(block->memory, block->mapped, block->size, i / 2);}
+	}
+}
+
+uint32_t FestiMemoryAllocator::findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties) const {
+	for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++) {
+		if ((typeFilter & (1 << i)) &&
+			(memoryProperties.memoryTypes[i].propertyFlags & properties) == properties) {
+			return i;
+		}
+	}
+	throw std::runtime_error("failed to find suitable memory type!");
+}
+
+FestiAllocation FestiMemoryAllocator::allocate(
+	const VkMemoryRequirements& requirements,
+	VkMemoryPropertyFlags properties,
+	bool linear,
+	FS_MemoryCategory category) {
+	const uint32_t memoryType = findMemoryType(requirements.memoryTypeBits, properties);
+	const VkMemoryPropertyFlags typeFlags = memoryProperties.memoryTypes[memoryType].propertyFlags;
+	VkDeviceSize size = requirements.size;
+	VkDeviceSize alignment = std::max<VkDeviceSize>(requirements.alignment, 1);
+	// Flushes round out to whole atoms, which mustn't reach into a neighbouring allocation
+	if ((typeFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) && !(typeFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT)) {
+		alignment = alignUp(alignment, nonCoherentAtomSize);
+		size = alignUp(size, nonCoherentAtomSize);
+	}
+
+	std::lock_guard<std::mutex> lock(mutex);
+	FestiAllocation allocation{};
+	allocation.pool = 2 * memoryType + linear;
+	allocation.size = size;
+	allocation.category = category;
+	auto countAllocation = [this, category, size]() {
+		FestiMemoryCategoryStats& categoryStats = categories[(size_t)category];
+		categoryStats.bytes += size;
+		categoryStats.peakBytes = std::max(categoryStats.peakBytes, categoryStats.bytes);
+		categoryStats.count++;
+	};
+	if (size > blockSizes[memoryType] / FS_DEDICATED_ALLOCATION_FRACTION) {
+		allocation.memory = allocateMemory(size, memoryType, &allocation.mapped);
+		dedicatedCount++;
+		dedicatedBytes += size;
+		countAllocation();
+		return allocation;
+	}
+
+	auto& pool = pools[allocation.pool];
+	FestiMemoryBlock* block = nullptr;
+	for (auto& candidate : pool) {
+		if (allocateFromBlock(*candidate, size, alignment, allocation.offset)) {
+			block = candidate.get();
+			break;
+		}
+	}
+	if (block == nullptr) {
+		auto newBlock = std::make_unique<FestiMemoryBlock>();
+		newBlock->size = blockSizes[memoryType];
+		newBlock->memory = allocateMemory(newBlock->size, memoryType, &newBlock->mapped);
+		newBlock->freeRanges[0] = newBlock->size;
+		block = newBlock.get();
+		pool.push_back(std::move(newBlock));
+		if (!allocateFromBlock(*block, size, alignment, allocation.offset)) {
+			throw std::runtime_error("failed to sub-allocate device memory!");
+		}
+	}
+	block->allocationCount++;
+	allocation.memory = block->memory;
+	allocation.block = block;
+	if (block->mapped != nullptr) {allocation.mapped = static_cast<char*>(block->mapped) + allocation.offset;}
+	countAllocation();
+	return allocation;
+}
+
+void FestiMemoryAllocator::free(FestiAllocation& allocation) {
+	if (allocation.memory == VK_NULL_HANDLE) {return;}
+	std::lock_guard<std::mutex> lock(mutex);
+	FestiMemoryCategoryStats& categoryStats = categories[(size_t)allocation.category];
+	categoryStats.bytes -= allocation.size;
+	categoryStats.count--;
+	if (allocation.block == nullptr) {
+		freeMemory(allocation.memory, allocation.mapped, allocation.size, allocation.pool / 2);
+		dedicatedCount--;
+		dedicatedBytes -= allocation.size;
+		allocation = FestiAllocation{};
+		return;
+	}
+
+	FestiMemoryBlock* block = allocation.block;
+	freeToBlock(*block, allocation.offset, allocation.size);
+	block->allocationCount--;
+	// One empty block is kept per pool, so resources recreated on every resize don't reallocate
+	auto& pool = pools[allocation.pool];
+	if (block->allocationCount == 0 && std::any_of(pool.begin(), pool.end(), [block](const auto& other) {
+			return other.get() != block && other->allocationCount == 0;
+		})) {
+		freeMemory(block->memory, block->mapped, block->size, allocation.pool / 2);
+		pool.erase(std::find_if(pool.begin(), pool.end(), [block](const auto& other) {return other.get() == block;}));
+	}
+	allocation = FestiAllocation{};
+}
+
+FestiMemoryStats FestiMemoryAllocator::getStats() {
+	std::lock_guard<std::mutex> lock(mutex);
+	FestiMemoryStats stats{};
+	stats.dedicatedCount = dedicatedCount;
+	stats.dedicatedBytes = dedicatedBytes;
+	for (auto& pool : pools) {
+		for (auto& block : pool) {
+			stats.blockCount++;
+			stats.allocationCount += block->allocationCount;
+			stats.blockBytes += block->size;
+			stats.usedBytes += block->size;
+			for (auto& range : block->freeRanges) {
+				stats.usedBytes -= range.second;
+				stats.freeRangeCount++;
+				stats.largestFreeRange = std::max(stats.largestFreeRange, range.second);
+			}
+		}
+	}
+	return stats;
+}
+
+VkDeviceMemory FestiMemoryAllocator::allocateMemory(VkDeviceSize size, uint32_t memoryType, void** mapped) {
+	VkMemoryAllocateInfo allocInfo{};
+	allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	allocInfo.allocationSize = size;
+	allocInfo.memoryTypeIndex = memoryType;
+
+	VkDeviceMemory memory;
+	if (vkAllocateMemory(device, &allocInfo, nullptr, &memory) != VK_SUCCESS) {
+		throw std::runtime_error("failed to allocate device memory!");
+	}
+
+	*mapped = nullptr;
+	if ((memoryProperties.memoryTypes[memoryType].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) &&
+		vkMapMemory(device, memory, 0, VK_WHOLE_SIZE, 0, mapped) != VK_SUCCESS) {
+		vkFreeMemory(device, memory, nullptr);
+		throw std::runtime_error("failed to map device memory!");
+	}
+
+	const uint32_t heap = memoryProperties.memoryTypes[memoryType].heapIndex;
+	heapAllocatedBytes[heap] += size;
+	checkBudget(heap);
+	return memory;
+}
+
+void FestiMemoryAllocator::freeMemory(VkDeviceMemory memory, void* mapped, VkDeviceSize size, uint32_t memoryType) {
+	if (mapped != nullptr) {vkUnmapMemory(device, memory);}
+	vkFreeMemory(device, memory, nullptr);
+	heapAllocatedBytes[memoryProperties.memoryTypes[memoryType].heapIndex] -= size;
+}
+
+std::vector<FestiHeapBudget> FestiMemoryAllocator::queryHeapBudgets() {
+	std::vector<FestiHeapBudget> budgets(memoryProperties.memoryHeapCount);
+	VkPhysicalDeviceMemoryBudgetPropertiesEXT budgetProperties{};
+	budgetProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT;
+	if (memoryBudgetSupported) {
+		VkPhysicalDeviceMemoryProperties2 properties2{};
+		properties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2;
+		properties2.pNext = &budgetProperties;
+		vkGetPhysicalDeviceMemoryProperties2(physicalDevice, &properties2);
+	}
+	for (uint32_t i = 0; i < memoryProperties.memoryHeapCount; i++) {
+		const VkMemoryHeap& heap = memoryProperties.memoryHeaps[i];
+		budgets[i].deviceLocal = heap.flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT;
+		if (memoryBudgetSupported) {
+			budgets[i].usage = budgetProperties.heapUsage[i];
+			budgets[i].budget = budgetProperties.heapBudget[i];
+		} else {
+			budgets[i].usage = heapAllocatedBytes[i];
+			budgets[i].budget = (VkDeviceSize)(heap.size * FS_MEMORY_DEFAULT_BUDGET);
+		}
+	}
+	return budgets;
+}
+
+void FestiMemoryAllocator::checkBudget(uint32_t heap) {
+	const FestiHeapBudget budget = queryHeapBudgets()[heap];
+	const bool nearBudget = budget.usage >= budget.budget * FS_MEMORY_BUDGET_WARNING;
+	if (nearBudget && !heapWarned[heap]) {
+		std::cerr << "warning: memory heap " << heap << (budget.deviceLocal ? " (device local)" : "") << " at "
+			<< toMiB(budget.usage) << " of its " << toMiB(budget.budget) << " MiB budget" << std::endl;
+	}
+	heapWarned[heap] = nearBudget;
+}
+
+FestiMemoryCategoryStats FestiMemoryAllocator::getCategoryStats(FS_MemoryCategory category) {
+	std::lock_guard<std::mutex> lock(mutex);
+	return categories[(size_t)category];
+}
+
+std::vector<FestiHeapBudget> FestiMemoryAllocator::getHeapBudgets() {
+	std::lock_guard<std::mutex> lock(mutex);
+	return queryHeapBudgets();
+}
+
+void FestiMemoryAllocator::printReport() {
+	const FestiMemoryStats stats = getStats();
+	std::lock_guard<std::mutex> lock(mutex);
+	std::cout << "Device memory by category:\n";
+	for (size_t i = 0; i < categories.size(); i++) {
+		const FestiMemoryCategoryStats& category = categories[i];
+		std::cout << "\t" << memoryCategoryName((FS_MemoryCategory)i) << ": " << toMiB(category.bytes) << " MiB in "
+			<< category.count << " allocations, peak " << toMiB(category.peakBytes) << " MiB\n";
+	}
+	std::cout << "\t" << stats.allocationCount << " allocations in " << stats.blockCount << " blocks ("
+		<< toMiB(stats.usedBytes) << " / " << toMiB(stats.blockBytes) << " MiB, " << stats.fragmentation() * 100.f
+		<< "% fragmented), " << stats.dedicatedCount << " dedicated (" << toMiB(stats.dedicatedBytes) << " MiB)\n";
+
+	const std::vector<FestiHeapBudget> budgets = queryHeapBudgets();
+	for (size_t i = 0; i < budgets.size(); i++) {
+		std::cout << "\theap " << i << (budgets[i].deviceLocal ? " (device local)" : "") << ": "
+			<< toMiB(budgets[i].usage) << " / " << toMiB(budgets[i].budget) << " MiB"
+			<< (memoryBudgetSupported ? "" : " (estimated)") << "\n";
+	}
+}
+
+bool FestiMemoryAllocator::allocateFromBlock(
+	FestiMemoryBlock& block, VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize& offset) {
+	// Best fit leaves the large ranges whole for large requests
+	auto best = block.freeRanges.end();
+	for (auto it = block.freeRanges.begin(); it != block.freeRanges.end(); ++it) {
+		if (alignUp(it->first, alignment) + size > it->first + it->second) {continue;}
+		if (best == block.freeRanges.end() || it->second < best->second) {best = it;}
+	}
+	if (best == block.freeRanges.end()) {return false;}
+
+	// Alignment padding goes back on the free list
+	const VkDeviceSize start = best->first;
+	const VkDeviceSize end = best->first + best->second;
+	offset = alignUp(start, alignment);
+	block.freeRanges.erase(best);
+	if (offset > start) {block.freeRanges[start] = offset - start;}
+	if (offset + size < end) {block.freeRanges[offset + size] = end - offset - size;}
+	return true;
+}
+
+void FestiMemoryAllocator::freeToBlock(FestiMemoryBlock& block, VkDeviceSize offset, VkDeviceSize size) {
+	auto next = block.freeRanges.lower_bound(offset);
+	if (next != block.freeRanges.end() && offset + size == next->first) {
+		size += next->second;
+		next = block.freeRanges.erase(next);
+	}
+	if (next != block.freeRanges.begin()) {
+		auto previous = std::prev(next);
+		if (previous->first + previous->second == offset) {
+			previous->second += size;
+			return;
+		}
+	}
+	block.freeRanges.emplace_hint(next, offset, size);
+}
+
+} // namespace festi
@@ -0,0 +1,136 @@
+#pragma once
+
+// lib
+#include <vulkan/vulkan.h>
+
+// std
+#include <array>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace festi {
+
+constexpr VkDeviceSize FS_MEMORY_BLOCK_SIZE = 64ull << 20; // upper bound, small heaps get smaller blocks
+constexpr VkDeviceSize FS_DEDICATED_ALLOCATION_FRACTION = 4; // requests over a quarter of a block get their own memory
+constexpr float FS_MEMORY_BUDGET_WARNING = .9f; // share of a heap's budget in use before warning
+constexpr float FS_MEMORY_DEFAULT_BUDGET = .8f; // share of a heap assumed available without VK_EXT_memory_budget
+
+// What an allocation holds, for accounting only
+enum class FS_MemoryCategory {
+	VERTEX,
+	INDEX,
+	INSTANCE,
+	UNIFORM,
+	MSSBO,
+	STAGING,
+	TEXTURE,
+	SHADOW_MAP,
+	DEPTH,
+	COUNT
+};
+
+const char* memoryCategoryName(FS_MemoryCategory category);
+
+// One vkAllocateMemory shared by many resources, host visible blocks stay mapped for their lifetime
+struct FestiMemoryBlock {
+	VkDeviceMemory memory = VK_NULL_HANDLE;
+	VkDeviceSize size = 0;
+	void* mapped = nullptr;
+	std::map<VkDeviceSize, VkDeviceSize> freeRanges; // offset to size, neighbours are always merged
+	uint32_t allocationCount = 0;
+};
+
+// Where a buffer or image is bound. block is null for dedicated allocations, which own their memory
+struct FestiAllocation {
+	VkDeviceMemory memory = VK_NULL_HANDLE;
+	VkDeviceSize offset = 0;
+	VkDeviceSize size = 0;
+	void* mapped = nullptr; // start of this allocation, null unless host visible
+	FestiMemoryBlock* block = nullptr;
+	uint32_t pool = 0;
+	FS_MemoryCategory category = FS_MemoryCategory::VERTEX;
+};
+
+struct FestiMemoryCategoryStats {
+	VkDeviceSize bytes = 0;
+	VkDeviceSize peakBytes = 0;
+	uint32_t count = 0;
+};
+
+// usage and budget come from VK_EXT_memory_budget, which counts other processes too, when the device has it.
+// Otherwise usage is what this allocator holds and budget a fixed share of the heap
+struct FestiHeapBudget {
+	VkDeviceSize usage = 0;
+	VkDeviceSize budget = 0;
+	bool deviceLocal = false;
+};
+
+struct FestiMemoryStats {
+	uint32_t blockCount = 0;
+	uint32_t dedicatedCount = 0;
+	uint32_t allocationCount = 0; // in blocks
+	VkDeviceSize blockBytes = 0;
+	VkDeviceSize usedBytes = 0; // in blocks
+	VkDeviceSize dedicatedBytes = 0;
+	uint32_t freeRangeCount = 0;
+	VkDeviceSize largestFreeRange = 0;
+
+	// 0 while the free space in each block is one range, towards 1 as it splinters into small ones
+	float fragmentation() const {
+		const VkDeviceSize freeBytes = blockBytes - usedBytes;
+		return freeBytes == 0 ? 0.f : 1.f - (float)largestFreeRange / (float)freeBytes;
+	}
+};
+
+// Sub-allocates device memory from large blocks, one free list per memory type. Buffers and optimal tiling
+// images draw from separate pools so neighbours never need bufferImageGranularity padding between them
+class FestiMemoryAllocator {
+public:
+	FestiMemoryAllocator(VkPhysicalDevice physicalDevice, VkDevice device, bool memoryBudgetSupported);
+	~FestiMemoryAllocator();
+
+	FestiMemoryAllocator(const FestiMemoryAllocator&) = delete;
+	FestiMemoryAllocator& operator=(const FestiMemoryAllocator&) = delete;
+
+	// linear is true for buffers and linear tiling images
+	FestiAllocation allocate(
+		const VkMemoryRequirements& requirements,
+		VkMemoryPropertyFlags properties,
+		bool linear,
+		FS_MemoryCategory category);
+	void free(FestiAllocation& allocation);
+
+	FestiMemoryStats getStats();
+	FestiMemoryCategoryStats getCategoryStats(FS_MemoryCategory category);
+	std::vector<FestiHeapBudget> getHeapBudgets();
+	void printReport();
+	uint32_t findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties) const;
+
+private:
+	VkDeviceMemory allocateMemory(VkDeviceSize size, uint32_t memoryType, void** mapped);
+	void freeMemory(VkDeviceMemory memory, void* mapped, VkDeviceSize size, uint32_t memoryType);
+	std::vector<FestiHeapBudget> queryHeapBudgets();
+	void checkBudget(uint32_t heap);
+	static bool allocateFromBlock(
+		FestiMemoryBlock& block, VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize& offset);
+	static void freeToBlock(FestiMemoryBlock& block, VkDeviceSize offset, VkDeviceSize size);
+
+	VkPhysicalDevice physicalDevice;
+	VkDevice device;
+	bool memoryBudgetSupported;
+	VkPhysicalDeviceMemoryProperties memoryProperties;
+	VkDeviceSize nonCoherentAtomSize;
+	std::vector<VkDeviceSize> blockSizes; // per memory type
+	std::vector<std::vector<std::unique_ptr<FestiMemoryBlock>>> pools; // memory type * 2 + linear
+	uint32_t dedicatedCount = 0;
+	VkDeviceSize dedicatedBytes = 0;
+	std::array<FestiMemoryCategoryStats, (size_t)FS_MemoryCategory::COUNT> categories{};
+	std::vector<VkDeviceSize> heapAllocatedBytes;
+	std::vector<bool> heapWarned; // re-armed once usage drops back under the warning level
+	std::mutex mutex;
+};
+
+} // namespace festi
@@ -0,0 +1,199 @@
+#include "mesh_cache.hpp"
+
+#include "mapped_file.hpp"
+#include "utils.hpp"
+
+// std
+#include <cstring>
+#include <filesystem>
+#include <iomanip>
+#include <sstream>
+
+namespace festi {
+
+namespace {
+
+constexpr uint32_t FS_MESH_CACHE_MAGIC = 0x484D5346; // "FSMH"
+constexpr uint32_t FS_MESH_CACHE_VERSION = 4;
+
+// Followed by the vertex, index, face material and face order arrays, the LODs, then the sources and materials
+struct MeshCacheHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t vertexSize; // catches Vertex layout changes
+	uint32_t vertexCount;
+	uint32_t indexCount;
+	uint32_t materialCount;
+	uint32_t sourceCount;
+	uint32_t lodCount;
+	float shapeArea;
+};
+
+struct SourceStamp {
+	uint64_t size;
+	int64_t writeTime;
+	uint64_t hash;
+};
+
+bool stampSource(const std::string& filePath, SourceStamp& stamp) {
+	std::error_code error;
+	const auto writeTime = std::filesystem::last_write_time(filePath, error);
+	if (error) {return false;}
+	stamp.size = std::filesystem::file_size(filePath, error);
+	if (error) {return false;}
+	stamp.writeTime = (int64_t)writeTime.time_since_epoch().count();
+	return true;
+}
+
+bool hashSource(const std::string& filePath, uint64_t& hash) {
+	FestiMappedFile file(filePath);
+	if (!file.valid()) {return false;}
+	hash = hashBytes(file.data(), file.size());
+	return true;
+}
+
+class BlobWriter {
+public:
+	std::vector<uint8_t> bytes;
+
+	void write(const void* data, size_t size) {
+		const uint8_t* first = static_cast<const uint8_t*>(data);
+		bytes.insert(bytes.end(), first, first + size);
+	}
+	template <typename T>
+	void write(const T& value) {write(&value, sizeof(T));}
+	void write(const std::string& value) {
+		write((uint32_t)value.size());
+		write(value.data(), value.size());
+	}
+};
+
+// Bounds checked, a truncated or corrupt file reads as a miss
+class BlobReader {
+public:
+	BlobReader(const uint8_t* data, size_t size) : position{data}, end{data + size} {}
+
+	bool read(void* data, size_t size) {
+		if ((size_t)(end - position) < size) {return false;}
+		std::memcpy(data, position, size);
+		position += size;
+		return true;
+	}
+	template <typename T>
+	bool read(T& value) {return read(&value, sizeof(T));}
+	bool read(std::string& value) {
+		uint32_t size;
+		if (!read(size) || (size_t)(end - position) < size) {return false;}
+		value.assign(reinterpret_cast<const char*>(position), size);
+		position += size;
+		return true;
+	}
+	template <typename T>
+	bool read(std::vector<T>& values, size_t count) {
+		values.resize(count);
+		return read(values.data(), count * sizeof(T));
+	}
+	bool atEnd() const {return position == end;}
+
+private:
+	const uint8_t* position;
+	const uint8_t* end;
+};
+
+} // namespace
+
+std::string getMeshCachePath(const std::string& objPath, const std::string& mtlDirPath) {
+	// The MTL directory decides which materials are baked in, so each one gets its own cache
+	std::ostringstream extension;
+	extension << "." << std::hex << std::setw(16) << std::setfill('0') << hashBytes(mtlDirPath.data(), mtlDirPath.size())
+		<< ".fmesh";
+	return FS_MESH_CACHE_DIR + "/" + std::filesystem::path(objPath).replace_extension(extension.str()).generic_string();
+}
+
+bool writeMeshCache(const std::string& filePath, const MeshData& mesh) {
+	MeshCacheHeader header{FS_MESH_CACHE_MAGIC, FS_MESH_CACHE_VERSION, (uint32_t)sizeof(Vertex),
+		(uint32_t)mesh.vertices.size(), (uint32_t)mesh.indices.size(), (uint32_t)mesh.materials.size(),
+		(uint32_t)mesh.sourceFiles.size(), (uint32_t)mesh.lods.size(), mesh.shapeArea};
+
+	BlobWriter blob;
+	blob.write(mesh.vertices.data(), mesh.vertices.size() * sizeof(Vertex));
+	blob.write(mesh.indices.data(), mesh.indices.size() * sizeof(uint32_t));
+	blob.write(mesh.faceMaterials.data(), mesh.faceMaterials.size() * sizeof(int32_t));
+	blob.write(mesh.faceOrder.data(), mesh.faceOrder.size() * sizeof(uint32_t));
+	for (const auto& lod : mesh.lods) {
+		blob.write((uint32_t)lod.indices.size());
+		blob.write(lod.error);
+		blob.write(lod.indices.data(), lod.indices.size() * sizeof(uint32_t));
+		blob.write(lod.faceGroups.data(), lod.faceGroups.size() * sizeof(int32_t));
+	}
+	for (const auto& source : mesh.sourceFiles) {
+		SourceStamp stamp;
+		if (!stampSource(source, stamp) || !hashSource(source, stamp.hash)) {return false;}
+		blob.write(stamp);
+		blob.write(source);
+	}
+	for (const auto& material : mesh.materials) {
+		blob.write(material.name);
+		blob.write(material.diffuse_texname);
+		blob.write(material.normal_texname);
+		blob.write(material.specular_texname);
+		blob.write(material.diffuse);
+		blob.write(material.specular);
+		blob.write(material.shininess);
+	}
+	return writeCacheFile(filePath, &header, sizeof(header), blob.bytes.data(), blob.bytes.size());
+}
+
+bool readMeshCache(const std::string& filePath, MeshData& mesh) {
+	FestiMappedFile file(filePath);
+	if (!file.valid()) {return false;}
+
+	BlobReader reader(file.data(), file.size());
+	MeshCacheHeader header;
+	if (!reader.read(header) || header.magic != FS_MESH_CACHE_MAGIC || header.version != FS_MESH_CACHE_VERSION ||
+		header.vertexSize != sizeof(Vertex) || header.indexCount % 3 != 0) {return false;}
+
+	// The arrays come straight out of the mapping, one copy each
+	MeshData cached;
+	cached.shapeArea = header.shapeArea;
+	if (!reader.read(cached.vertices, header.vertexCount) ||
+		!reader.read(cached.indices, header.indexCount) ||
+		!reader.read(cached.faceMaterials, header.indexCount / 3) ||
+		!reader.read(cached.faceOrder, header.indexCount / 3)) {return false;}
+
+	cached.lods.resize(header.lodCount);
+	for (auto& lod : cached.lods) {
+		uint32_t lodIndexCount;
+		if (!reader.read(lodIndexCount) || lodIndexCount % 3 != 0 || !reader.read(lod.error) ||
+			!reader.read(lod.indices, lodIndexCount) ||
+			!reader.read(lod.faceGroups, lodIndexCount / 3)) {return false;}
+	}
+
+	for (uint32_t i = 0; i < header.sourceCount; i++) {
+		SourceStamp stored, current;
+		std::string source;
+		if (!reader.read(stored) || !reader.read(source)) {return false;}
+		if (!stampSource(source, current) || current.size != stored.size) {return false;}
+		if (current.writeTime != stored.writeTime && (!hashSource(source, current.hash) || current.hash != stored.hash)) {
+			return false;
+		}
+		cached.sourceFiles.push_back(source);
+	}
+
+	cached.materials.resize(header.materialCount);
+	for (auto& material : cached.materials) {
+		if (!reader.read(material.name) ||
+			!reader.read(material.diffuse_texname) ||
+			!reader.read(material.normal_texname) ||
+			!reader.read(material.specular_texname) ||
+			!reader.read(material.diffuse) ||
+			!reader.read(material.specular) ||
+			!reader.read(material.shininess)) {return false;}
+	}
+	if (!reader.atEnd()) {return false;}
+
+	mesh = std::move(cached);
+	return true;
+}
+
+} // namespace festi
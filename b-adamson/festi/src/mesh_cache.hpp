@@ -0,0 +1,43 @@
+#pragma once
+
+#include "mesh_optimiser.hpp"
+#include "mesh_simplifier.hpp"
+#include "model.hpp"
+
+// std
+#include <string>
+#include <vector>
+
+namespace festi {
+
+// Meshes are cached under this directory, mirroring the path of the OBJ they came from with a hash of the
+// MTL directory in the extension
+const std::string FS_MESH_CACHE_DIR = "cache";
+
+// How a full build from the OBJ went, reported with the load. Never cached, zero on a cache hit
+struct MeshBuildStats {
+	float parseMegabytesPerSecond = 0.f;
+	MeshOptimiseStats optimise; // ACMR before and after reordering
+};
+
+// Everything createModelFromFile derives from an OBJ before it touches the GPU or the global material table
+struct MeshData {
+	std::vector<Vertex> vertices;
+	std::vector<uint32_t> indices;
+	std::vector<int32_t> faceMaterials; // index into materials per face, -1 for faces without one
+	std::vector<uint32_t> faceOrder; // rank of each face in the optimised draw order (see optimiseMesh)
+	std::vector<LodMesh> lods; // coarser LODs over the same vertices, finest first
+	std::vector<tinyobj::material_t> materials; // only the fields FestiMaterials reads survive the cache
+	float shapeArea = 0.f;
+	std::vector<std::string> sourceFiles; // OBJ and MTL files, a change to any of them invalidates the cache
+	MeshBuildStats buildStats;
+};
+
+std::string getMeshCachePath(const std::string& objPath, const std::string& mtlDirPath);
+
+// Sources are stamped with size, write time and content hash. A stamp mismatch falls back to the hash,
+// so touched but unchanged files still hit
+bool writeMeshCache(const std::string& filePath, const MeshData& mesh);
+bool readMeshCache(const std::string& filePath, MeshData& mesh);
+
+} // namespace festi
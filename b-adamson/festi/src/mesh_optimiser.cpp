@@ -0,0 +1,335 @@
+#include "mesh_optimiser.hpp"
+
+// std
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+
+namespace festi {
+
+namespace {
+
+float vertexScore(int cachePosition, uint32_t remainingTriangles) {
+	if (remainingTriangles == 0) {return -1.f;}
+	float score = 0.f;
+	if (cachePosition >= 0) {
+		// The last triangle's vertices score the same, so the next triangle doesn't favour one of its edges
+		if (cachePosition < 3) {
+			score = .75f;
+		} else {
+			const float scaler = 1.f / (FS_FORSYTH_CACHE_SIZE - 3);
+			score = std::pow(1.f - (cachePosition - 3) * scaler, 1.5f);
+		}
+	}
+	// Vertices with few triangles left are worth finishing off
+	return score + 2.f / std::sqrt((float)remainingTriangles);
+}
+
+// Tom Forsyth's linear-speed vertex cache optimisation. Takes triangles over local vertex indices and
+// returns the triangles in draw order
+std::vector<uint32_t> orderForVertexCache(const std::vector<uint32_t>& localIndices, uint32_t vertexCount) {
+	const uint32_t triangleCount = (uint32_t)(localIndices.size() / 3);
+
+	std::vector<uint32_t> adjacencyOffsets(vertexCount + 1, 0);
+	for (uint32_t v : localIndices) {adjacencyOffsets[v + 1]++;}
+	std::partial_sum(adjacencyOffsets.begin(), adjacencyOffsets.end(), adjacencyOffsets.begin());
+	std::vector<uint32_t> adjacency(localIndices.size());
+	std::vector<uint32_t> remaining(vertexCount, 0);
+	for (uint32_t i = 0; i < localIndices.size(); i++) {
+		const uint32_t v = localIndices[i];
+		adjacency[adjacencyOffsets[v] + remaining[v]++] = i / 3;
+	}
+
+	std::vector<int> cachePosition(vertexCount, -1);
+	std::vector<float> vertexScores(vertexCount);
+	for (uint32_t v = 0; v < vertexCount; v++) {vertexScores[v] = vertexScore(-1, remaining[v]);}
+	std::vector<float> triangleScores(triangleCount);
+	for (uint32_t t = 0; t < triangleCount; t++) {
+		triangleScores[t] = vertexScores[localIndices[3 * t]] + vertexScores[localIndices[3 * t + 1]] +
+			vertexScores[localIndices[3 * t + 2]];
+	}
+
+	std::vector<bool> added(triangleCount, false);
+	std::vector<uint32_t> order;
+	order.reserve(triangleCount);
+	std::vector<uint32_t> cache, newCache;
+	cache.reserve(FS_FORSYTH_CACHE_SIZE + 3);
+	newCache.reserve(FS_FORSYTH_CACHE_SIZE + 3);
+
+	auto rescore = [&](uint32_t v, int position) {
+		cachePosition[v] = position;
+		const float score = vertexScore(position, remaining[v]);
+		const float delta = score - vertexScores[v];
+		vertexScores[v] = score;
+		for (uint32_t i = adjacencyOffsets[v]; i < adjacencyOffsets[v] + remaining[v]; i++) {
+			triangleScores[adjacency[i]] += delta;
+		}
+	};
+
+	uint32_t cursor = 0;
+	int64_t best = -1;
+	while (order.size() < triangleCount) {
+		// Dead end, carry on from the next triangle in input order
+		if (best < 0) {
+			while (added[cursor]) {cursor++;}
+			best = cursor;
+		}
+		const uint32_t triangle = (uint32_t)best;
+		added[triangle] = true;
+		order.push_back(triangle);
+
+		const uint32_t* corners = &localIndices[3 * triangle];
+		for (int k = 0; k < 3; k++) {
+			const uint32_t v = corners[k];
+			uint32_t* first = &adjacency[adjacencyOffsets[v]];
+			uint32_t* last = first + remaining[v];
+			std::iter_swap(std::find(first, last, triangle), last - 1);
+			remaining[v]--;
+		}
+
+		newCache.assign(corners, corners + 3);
+		for (uint32_t v : cache) {
+			if (v != corners[0] && v != corners[1] && v != corners[2]) {newCache.push_back(v);}
+		}
+		for (size_t i = FS_FORSYTH_CACHE_SIZE; i < newCache.size(); i++) {rescore(newCache[i], -1);}
+		newCache.resize(std::min<size_t>(newCache.size(), FS_FORSYTH_CACHE_SIZE));
+		for (size_t i = 0; i < newCache.size(); i++) {rescore(newCache[i], (int)i);}
+		cache.swap(newCache);
+
+		// Only triangles touching the cache changed score, the best of them goes next
+		best = -1;
+		float bestScore = -1.f;
+		for (uint32_t v : cache) {
+			for (uint32_t i = adjacencyOffsets[v]; i < adjacencyOffsets[v] + remaining[v]; i++) {
+				const uint32_t t = adjacency[i];
+				if (triangleScores[t] > bestScore) {
+					bestScore = triangleScores[t];
+					best = t;
+				}
+			}
+		}
+	}
+	return order;
+}
+
+// FIFO cache simulation over global vertex IDs. Stamps only grow, so starting a new group is a jump
+// of cacheSize rather than clearing the cache
+class FifoCache {
+public:
+	FifoCache(size_t vertexCount, uint32_t cacheSize) : insertedAt(vertexCount, 0), cacheSize{cacheSize} {}
+
+	bool access(uint32_t v) {
+		if (insertedAt[v] != 0 && time - insertedAt[v] < cacheSize) {return true;}
+		insertedAt[v] = ++time;
+		return false;
+	}
+	void flush() {time += cacheSize;}
+
+private:
+	std::vector<uint64_t> insertedAt;
+	uint64_t time = 0;
+	uint32_t cacheSize;
+};
+
+float groupACMR(const std::vector<uint32_t>& indices, const std::vector<uint32_t>& faces, FifoCache& cache) {
+	if (faces.empty()) {return 0.f;}
+	cache.flush();
+	uint32_t misses = 0;
+	for (uint32_t face : faces) {
+		for (int k = 0; k < 3; k++) {misses += !cache.access(indices[3 * face + k]);}
+	}
+	return (float)misses / faces.size();
+}
+
+// Splits the cache ordered faces where a triangle misses all three vertices, the cache is cold there so
+// the split costs next to nothing, then draws outward facing clusters first. Reverts when that costs
+// more than 5% ACMR
+void orderForOverdraw(
+	const std::vector<Vertex>& vertices,
+	const std::vector<uint32_t>& indices,
+	std::vector<uint32_t>& faces,
+	FifoCache& cache) {
+	struct Cluster {
+		uint32_t first;
+		uint32_t count;
+		float sortKey;
+	};
+	std::vector<Cluster> clusters;
+	cache.flush();
+	for (uint32_t i = 0; i < faces.size(); i++) {
+		uint32_t misses = 0;
+		for (int k = 0; k < 3; k++) {misses += !cache.access(indices[3 * faces[i] + k]);}
+		if (clusters.empty() || (misses == 3 && clusters.back().count >= FS_MIN_OVERDRAW_CLUSTER)) {
+			clusters.push_back({i, 0, 0.f});
+		}
+		clusters.back().count++;
+	}
+	if (clusters.size() < 2) {return;}
+
+	auto faceCentroidAndNormal = [&](uint32_t face, glm::vec3& centroid, glm::vec3& normal) {
+		const glm::vec3& p0 = vertices[indices[3 * face]].position;
+		const glm::vec3& p1 = vertices[indices[3 * face + 1]].position;
+		const glm::vec3& p2 = vertices[indices[3 * face + 2]].position;
+		centroid = (p0 + p1 + p2) / 3.f;
+		normal = glm::cross(p1 - p0, p2 - p0); // length is twice the area
+	};
+
+	glm::vec3 meshCentroid{0.f};
+	float meshArea = 0.f;
+	for (uint32_t face : faces) {
+		glm::vec3 centroid, normal;
+		faceCentroidAndNormal(face, centroid, normal);
+		const float area = glm::length(normal);
+		meshCentroid += centroid * area;
+		meshArea += area;
+	}
+	if (meshArea <= 0.f) {return;}
+	meshCentroid /= meshArea;
+
+	for (auto& cluster : clusters) {
+		glm::vec3 clusterCentroid{0.f}, clusterNormal{0.f};
+		float clusterArea = 0.f;
+		for (uint32_t i = cluster.first; i < cluster.first + cluster.count; i++) {
+			glm::vec3 centroid, normal;
+			faceCentroidAndNormal(faces[i], centroid, normal);
+			const float area = glm::length(normal);
+			clusterCentroid += centroid * area;
+			clusterNormal += normal;
+			clusterArea += area;
+		}
+		const float normalLength = glm::length(clusterNormal);
+		if (clusterArea > 0.f && normalLength > 0.f) {
+			cluster.sortKey = glm::dot(clusterCentroid / clusterArea - meshCentroid, clusterNormal / normalLength);
+		}
+	}
+	std::stable_sort(clusters.begin(), clusters.end(),
+		[](const Cluster& a, const Cluster& b) { return a.sortKey > b.sortKey; });
+
+	std::vector<uint32_t> sorted;
+	sorted.reserve(faces.size());
+	for (const auto& cluster : clusters) {
+		sorted.insert(sorted.end(), faces.begin() + cluster.first, faces.begin() + cluster.first + cluster.count);
+	}
+	if (groupACMR(indices, sorted, cache) <= groupACMR(indices, faces, cache) * 1.05f) {
+		faces.swap(sorted);
+	}
+}
+
+// Faces sorted by group, each group in Forsyth order then overdraw order. Ungrouped faces (-1) sort last,
+// as FS_UNSPECIFIED material IDs do
+std::vector<uint32_t> orderFaces(
+	const std::vector<Vertex>& vertices,
+	const std::vector<uint32_t>& indices,
+	const std::vector<int32_t>& faceGroups) {
+	const uint32_t faceCount = (uint32_t)(indices.size() / 3);
+	std::vector<uint32_t> faces(faceCount);
+	std::iota(faces.begin(), faces.end(), 0);
+	std::stable_sort(faces.begin(), faces.end(), [&faceGroups](uint32_t a, uint32_t b) {
+		return (uint32_t)faceGroups[a] < (uint32_t)faceGroups[b];
+	});
+
+	FifoCache cache(vertices.size(), FS_ACMR_CACHE_SIZE);
+	std::vector<uint32_t> localIDs(vertices.size(), UINT32_MAX);
+	std::vector<uint32_t> localIndices;
+	std::vector<uint32_t> groupFaces;
+	for (uint32_t groupStart = 0; groupStart < faceCount;) {
+		uint32_t groupEnd = groupStart;
+		while (groupEnd < faceCount && faceGroups[faces[groupEnd]] == faceGroups[faces[groupStart]]) {groupEnd++;}
+
+		// Local vertex numbering keeps the scoring arrays sized to the group
+		uint32_t localCount = 0;
+		localIndices.clear();
+		for (uint32_t i = groupStart; i < groupEnd; i++) {
+			for (int k = 0; k < 3; k++) {
+				uint32_t& local = localIDs[indices[3 * faces[i] + k]];
+				if (local == UINT32_MAX) {local = localCount++;}
+				localIndices.push_back(local);
+			}
+		}
+		for (uint32_t i = groupStart; i < groupEnd; i++) {
+			for (int k = 0; k < 3; k++) {localIDs[indices[3 * faces[i] + k]] = UINT32_MAX;}
+		}
+
+		groupFaces.clear();
+		for (uint32_t triangle : orderForVertexCache(localIndices, localCount)) {
+			groupFaces.push_back(faces[groupStart + triangle]);
+		}
+		orderForOverdraw(vertices, indices, groupFaces, cache);
+		std::copy(groupFaces.begin(), groupFaces.end(), faces.begin() + groupStart);
+		groupStart = groupEnd;
+	}
+	return faces;
+}
+
+} // namespace
+
+float computeACMR(const std::vector<uint32_t>& indices, const std::vector<uint32_t>& faces, uint32_t cacheSize) {
+	if (faces.empty()) {return 0.f;}
+	const uint32_t vertexCount = indices.empty() ? 0 : *std::max_element(indices.begin(), indices.end()) + 1;
+	FifoCache cache(vertexCount, cacheSize);
+	return groupACMR(indices, faces, cache);
+}
+
+MeshOptimiseStats optimiseMesh(
+	std::vector<Vertex>& vertices,
+	std::vector<uint32_t>& indices,
+	const std::vector<int32_t>& faceGroups,
+	std::vector<uint32_t>& faceOrder) {
+	MeshOptimiseStats stats;
+	const uint32_t faceCount = (uint32_t)(indices.size() / 3);
+	faceOrder.resize(faceCount);
+	if (faceCount == 0) {return stats;}
+
+	// Measured in the order sortFacesByMaterial would leave the faces unoptimised
+	std::vector<uint32_t> unoptimised(faceCount);
+	std::iota(unoptimised.begin(), unoptimised.end(), 0);
+	std::stable_sort(unoptimised.begin(), unoptimised.end(), [&faceGroups](uint32_t a, uint32_t b) {
+		return (uint32_t)faceGroups[a] < (uint32_t)faceGroups[b];
+	});
+	stats.acmrBefore = computeACMR(indices, unoptimised, FS_ACMR_CACHE_SIZE);
+
+	const std::vector<uint32_t> faces = orderFaces(vertices, indices, faceGroups);
+	for (uint32_t rank = 0; rank < faceCount; rank++) {faceOrder[faces[rank]] = rank;}
+
+	// Renumber vertices by first use in draw order, unreferenced ones go last
+	std::vector<uint32_t> remap(vertices.size(), UINT32_MAX);
+	std::vector<Vertex> reordered;
+	reordered.reserve(vertices.size());
+	for (uint32_t face : faces) {
+		for (int k = 0; k < 3; k++) {
+			uint32_t& index = remap[indices[3 * face + k]];
+			if (index == UINT32_MAX) {
+				index = (uint32_t)reordered.size();
+				reordered.push_back(vertices[indices[3 * face + k]]);
+			}
+		}
+	}
+	for (uint32_t v = 0; v < vertices.size(); v++) {
+		if (remap[v] == UINT32_MAX) {
+			remap[v] = (uint32_t)reordered.size();
+			reordered.push_back(vertices[v]);
+		}
+	}
+	for (uint32_t& index : indices) {index = remap[index];}
+	vertices.swap(reordered);
+
+	stats.acmrAfter = computeACMR(indices, faces, FS_ACMR_CACHE_SIZE);
+	return stats;
+}
+
+void optimiseFaceOrder(
+	const std::vector<Vertex>& vertices,
+	std::vector<uint32_t>& indices,
+	std::vector<int32_t>& faceGroups) {
+	const std::vector<uint32_t> faces = orderFaces(vertices, indices, faceGroups);
+	std::vector<uint32_t> orderedIndices(indices.size());
+	std::vector<int32_t> orderedGroups(faces.size());
+	for (uint32_t i = 0; i < faces.size(); i++) {
+		std::copy_n(indices.begin() + 3 * faces[i], 3, orderedIndices.begin() + 3 * i);
+		orderedGroups[i] = faceGroups[faces[i]];
+	}
+	indices.swap(orderedIndices);
+	faceGroups.swap(orderedGroups);
+}
+
+} // namespace festi
@@ -0,0 +1,40 @@
+#pragma once
+
+#include "model.hpp"
+
+// std
+#include <cstdint>
+#include <vector>
+
+namespace festi {
+
+constexpr uint32_t FS_FORSYTH_CACHE_SIZE = 32; // modelled cache for scoring
+constexpr uint32_t FS_ACMR_CACHE_SIZE = 16; // FIFO cache ACMR is measured against
+constexpr uint32_t FS_MIN_OVERDRAW_CLUSTER = 32; // triangles, smaller clusters are merged into the previous one
+
+struct MeshOptimiseStats {
+    float acmrBefore = 0.f;
+    float acmrAfter = 0.f;
+};
+
+// Orders the triangles of each face group (the faces sharing a material, which stay contiguous when drawn):
+// Forsyth vertex cache ordering, then clusters split where the cache runs cold, sorted outward facing first
+// to cut overdraw. Face IDs never change, faceOrder receives each face's rank in the optimised order.
+// Finally vertices are renumbered by first use so fetches walk the vertex buffer forwards
+MeshOptimiseStats optimiseMesh(
+    std::vector<Vertex>& vertices,
+    std::vector<uint32_t>& indices,
+    const std::vector<int32_t>& faceGroups,
+    std::vector<uint32_t>& faceOrder);
+
+// The same per group ordering for meshes whose vertices are shared with another (LODs). Faces are physically
+// reordered and sorted by group, vertices are left alone
+void optimiseFaceOrder(
+    const std::vector<Vertex>& vertices,
+    std::vector<uint32_t>& indices,
+    std::vector<int32_t>& faceGroups);
+
+// Average cache misses per triangle for indices drawn in faceOrder, with a FIFO cache
+float computeACMR(const std::vector<uint32_t>& indices, const std::vector<uint32_t>& faces, uint32_t cacheSize);
+
+} // namespace festi
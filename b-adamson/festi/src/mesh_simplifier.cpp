@@ -0,0 +1,287 @@
+#include "mesh_simplifier.hpp"
+
+#include "mesh_optimiser.hpp"
+
+// std
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <numeric>
+#include <tuple>
+
+namespace festi {
+
+namespace {
+
+// Sum of squared distances to a set of planes, each weighted by the area of the triangle it came from
+struct Quadric {
+	double a2 = 0., ab = 0., ac = 0., ad = 0., b2 = 0., bc = 0., bd = 0., c2 = 0., cd = 0., d2 = 0.;
+	double weight = 0.;
+
+	static Quadric fromTriangle(const glm::vec3& p0, const glm::vec3& p1, const glm::vec3& p2) {
+		Quadric q;
+		const glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+		const float length = glm::length(normal);
+		if (length == 0.f) {return q;}
+		const double a = normal.x / length, b = normal.y / length, c = normal.z / length;
+		const double d = -(a * p0.x + b * p0.y + c * p0.z);
+		const double w = .5 * length;
+		q.a2 = w * a * a; q.ab = w * a * b; q.ac = w * a * c; q.ad = w * a * d;
+		q.b2 = w * b * b; q.bc = w * b * c; q.bd = w * b * d;
+		q.c2 = w * c * c; q.cd = w * c * d;
+		q.d2 = w * d * d;
+		q.weight = w;
+		return q;
+	}
+
+	void add(const Quadric& other) {
+		a2 += other.a2; ab += other.ab; ac += other.ac; ad += other.ad;
+		b2 += other.b2; bc += other.bc; bd += other.bd;
+		c2 += other.c2; cd += other.cd;
+		d2 += other.d2;
+		weight += other.weight;
+	}
+
+	// Mean squared distance of p from the planes
+	double error(const glm::vec3& p) const {
+		if (weight <= 0.) {return 0.;}
+		const double x = p.x, y = p.y, z = p.z;
+		const double e = a2 * x * x + b2 * y * y + c2 * z * z + 2. * (ab * x * y + ac * x * z + bc * y * z) +
+			2. * (ad * x + bd * y + cd * z) + d2;
+		return std::max(e, 0.) / weight;
+	}
+};
+
+struct Collapse {
+	uint32_t from; // local vertex IDs
+	uint32_t to;
+	double cost;
+};
+
+} // namespace
+
+float simplifyMesh(const std::vector<Vertex>& vertices, std::vector<uint32_t>& indices, size_t targetIndexCount) {
+	if (indices.size() <= targetIndexCount) {return 0.f;}
+
+	// Local vertex numbering keeps everything below sized to this mesh rather than the vertex buffer
+	std::vector<uint32_t> localIDs(vertices.size(), UINT32_MAX);
+	std::vector<uint32_t> localVertices;
+	std::vector<uint32_t> triangles(indices.size());
+	for (size_t i = 0; i < indices.size(); i++) {
+		uint32_t& local = localIDs[indices[i]];
+		if (local == UINT32_MAX) {
+			local = (uint32_t)localVertices.size();
+			localVertices.push_back(indices[i]);
+		}
+		triangles[i] = local;
+	}
+	const uint32_t localCount = (uint32_t)localVertices.size();
+	auto position = [&](uint32_t local) -> const glm::vec3& {return vertices[localVertices[local]].position;};
+
+	// Vertices split for normals or uvs share a position. Topology, quadrics and locks work per position,
+	// triangles keep their own vertex so attributes survive
+	std::vector<uint32_t> byPosition(localCount);
+	std::iota(byPosition.begin(), byPosition.end(), 0);
+	std::sort(byPosition.begin(), byPosition.end(), [&](uint32_t a, uint32_t b) {
+		const glm::vec3& pa = position(a);
+		const glm::vec3& pb = position(b);
+		return std::tie(pa.x, pa.y, pa.z) < std::tie(pb.x, pb.y, pb.z);
+	});
+	std::vector<uint32_t> positionIDs(localCount);
+	std::vector<uint32_t> wedgeCounts;
+	for (uint32_t i = 0; i < localCount; i++) {
+		if (i == 0 || position(byPosition[i]) != position(byPosition[i - 1])) {wedgeCounts.push_back(0);}
+		positionIDs[byPosition[i]] = (uint32_t)wedgeCounts.size() - 1;
+		wedgeCounts.back()++;
+	}
+	const uint32_t positionCount = (uint32_t)wedgeCounts.size();
+
+	// Seams, and edges without exactly two triangles (borders and non-manifold fans), lock their vertices
+	std::vector<bool> locked(positionCount);
+	for (uint32_t p = 0; p < positionCount; p++) {locked[p] = wedgeCounts[p] > 1;}
+	std::vector<uint64_t> edges;
+	edges.reserve(triangles.size());
+	for (size_t i = 0; i < triangles.size(); i += 3) {
+		for (int k = 0; k < 3; k++) {
+			const uint32_t a = positionIDs[triangles[i + k]];
+			const uint32_t b = positionIDs[triangles[i + (k + 1) % 3]];
+			edges.push_back((uint64_t)std::min(a, b) << 32 | std::max(a, b));
+		}
+	}
+	std::sort(edges.begin(), edges.end());
+	for (size_t first = 0; first < edges.size();) {
+		size_t last = first;
+		while (last < edges.size() && edges[last] == edges[first]) {last++;}
+		if (last - first != 2) {
+			locked[(uint32_t)(edges[first] >> 32)] = true;
+			locked[(uint32_t)edges[first]] = true;
+		}
+		first = last;
+	}
+
+	std::vector<Quadric> quadrics(positionCount);
+	for (size_t i = 0; i < triangles.size(); i += 3) {
+		const Quadric q = Quadric::fromTriangle(position(triangles[i]), position(triangles[i + 1]), position(triangles[i + 2]));
+		for (int k = 0; k < 3; k++) {quadrics[positionIDs[triangles[i + k]]].add(q);}
+	}
+
+	// Each pass collapses the cheapest edges whose neighbourhoods haven't been touched yet this pass, so
+	// adjacency only needs rebuilding between passes
+	const size_t targetTriangles = targetIndexCount / 3;
+	size_t triangleCount = triangles.size() / 3;
+	double maxCost = 0.;
+	std::vector<uint32_t> adjacencyOffsets(positionCount + 1);
+	std::vector<uint32_t> adjacency;
+	std::vector<bool> touched(positionCount);
+	std::vector<bool> dead;
+	std::vector<Collapse> collapses;
+	std::vector<uint32_t> neighboursFrom, neighboursTo;
+	while (triangleCount > targetTriangles) {
+		std::fill(adjacencyOffsets.begin(), adjacencyOffsets.end(), 0);
+		for (uint32_t v : triangles) {adjacencyOffsets[positionIDs[v] + 1]++;}
+		std::partial_sum(adjacencyOffsets.begin(), adjacencyOffsets.end(), adjacencyOffsets.begin());
+		adjacency.resize(triangles.size());
+		std::vector<uint32_t> fill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+		for (uint32_t i = 0; i < triangles.size(); i++) {adjacency[fill[positionIDs[triangles[i]]]++] = i / 3;}
+
+		collapses.clear();
+		for (size_t i = 0; i < triangles.size(); i += 3) {
+			for (int k = 0; k < 3; k++) {
+				const uint32_t a = triangles[i + k];
+				const uint32_t b = triangles[i + (k + 1) % 3];
+				const uint32_t pa = positionIDs[a], pb = positionIDs[b];
+				if (pa == pb) {continue;}
+				Quadric q = quadrics[pa];
+				q.add(quadrics[pb]);
+				if (!locked[pa]) {collapses.push_back({a, b, q.error(position(b))});}
+				if (!locked[pb]) {collapses.push_back({b, a, q.error(position(a))});}
+			}
+		}
+		std::sort(collapses.begin(), collapses.end(), [](const Collapse& a, const Collapse& b) {return a.cost < b.cost;});
+
+		std::fill(touched.begin(), touched.end(), false);
+		dead.assign(triangles.size() / 3, false);
+		size_t collapsed = 0;
+		for (const Collapse& collapse : collapses) {
+			if (triangleCount <= targetTriangles) {break;}
+			const uint32_t from = positionIDs[collapse.from], to = positionIDs[collapse.to];
+			if (touched[from] || touched[to]) {continue;}
+
+			// The edge must be shared by exactly the two triangles that vanish, no triangle around it may flip, and
+			// the two ends may share no other neighbours, or the collapse would fold the surface onto itself
+			uint32_t shared = 0;
+			bool valid = true;
+			neighboursFrom.clear();
+			for (uint32_t i = adjacencyOffsets[from]; i < adjacencyOffsets[from + 1] && valid; i++) {
+				const uint32_t* corners = &triangles[3 * adjacency[i]];
+				bool hasTo = false;
+				for (int k = 0; k < 3; k++) {
+					const uint32_t p = positionIDs[corners[k]];
+					hasTo |= p == to;
+					if (p != from && p != to) {neighboursFrom.push_back(p);}
+				}
+				if (hasTo) {shared++; continue;}
+
+				glm::vec3 before[3], after[3];
+				for (int k = 0; k < 3; k++) {
+					before[k] = position(corners[k]);
+					after[k] = positionIDs[corners[k]] == from ? position(collapse.to) : before[k];
+				}
+				const glm::vec3 normalBefore = glm::cross(before[1] - before[0], before[2] - before[0]);
+				const glm::vec3 normalAfter = glm::cross(after[1] - after[0], after[2] - after[0]);
+				const float lengths = glm::length(normalBefore) * glm::length(normalAfter);
+				valid = lengths > 0.f && glm::dot(normalBefore, normalAfter) >= FS_LOD_MIN_NORMAL_DOT * lengths;
+			}
+			if (!valid || shared != 2) {continue;}
+
+			neighboursTo.clear();
+			for (uint32_t i = adjacencyOffsets[to]; i < adjacencyOffsets[to + 1]; i++) {
+				for (int k = 0; k < 3; k++) {
+					const uint32_t p = positionIDs[triangles[3 * adjacency[i] + k]];
+					if (p != from && p != to) {neighboursTo.push_back(p);}
+				}
+			}
+			std::sort(neighboursFrom.begin(), neighboursFrom.end());
+			neighboursFrom.erase(std::unique(neighboursFrom.begin(), neighboursFrom.end()), neighboursFrom.end());
+			std::sort(neighboursTo.begin(), neighboursTo.end());
+			neighboursTo.erase(std::unique(neighboursTo.begin(), neighboursTo.end()), neighboursTo.end());
+			std::vector<uint32_t>::iterator a = neighboursFrom.begin(), b = neighboursTo.begin();
+			uint32_t common = 0;
+			while (a != neighboursFrom.end() && b != neighboursTo.end()) {
+				if (*a < *b) {a++;} else if (*b < *a) {b++;} else {common++; a++; b++;}
+			}
+			if (common != 2) {continue;}
+
+			for (uint32_t i = adjacencyOffsets[from]; i < adjacencyOffsets[from + 1]; i++) {
+				const uint32_t triangle = adjacency[i];
+				uint32_t* corners = &triangles[3 * triangle];
+				bool hasTo = false;
+				for (int k = 0; k < 3; k++) {
+					hasTo |= positionIDs[corners[k]] == to;
+					touched[positionIDs[corners[k]]] = true;
+				}
+				if (hasTo) {
+					dead[triangle] = true;
+					continue;
+				}
+				for (int k = 0; k < 3; k++) {
+					if (positionIDs[corners[k]] == from) {corners[k] = collapse.to;}
+				}
+			}
+			quadrics[to].add(quadrics[from]);
+			maxCost = std::max(maxCost, collapse.cost);
+			triangleCount -= 2;
+			collapsed++;
+		}
+		if (collapsed == 0) {break;}
+
+		size_t live = 0;
+		for (size_t t = 0; t < dead.size(); t++) {
+			if (dead[t]) {continue;}
+			std::copy_n(triangles.begin() + 3 * t, 3, triangles.begin() + 3 * live);
+			live++;
+		}
+		triangles.resize(3 * live);
+	}
+
+	indices.resize(triangles.size());
+	for (size_t i = 0; i < triangles.size(); i++) {indices[i] = localVertices[triangles[i]];}
+	return (float)std::sqrt(maxCost);
+}
+
+std::vector<LodMesh> buildLods(
+	const std::vector<Vertex>& vertices,
+	const std::vector<uint32_t>& indices,
+	const std::vector<int32_t>& faceGroups) {
+	std::map<int32_t, std::vector<uint32_t>> groups;
+	for (size_t face = 0; face < faceGroups.size(); face++) {
+		auto& groupIndices = groups[faceGroups[face]];
+		groupIndices.insert(groupIndices.end(), indices.begin() + 3 * face, indices.begin() + 3 * face + 3);
+	}
+
+	std::vector<LodMesh> lods;
+	size_t previousCount = indices.size();
+	float error = 0.f;
+	for (uint32_t level = 1; level < FS_MAX_LODS; level++) {
+		LodMesh lod;
+		float levelError = 0.f;
+		for (auto& kv : groups) {
+			auto& groupIndices = kv.second;
+			const size_t target = (size_t)(groupIndices.size() / 3 * FS_LOD_REDUCTION) * 3;
+			levelError = std::max(levelError, simplifyMesh(vertices, groupIndices, target));
+			lod.indices.insert(lod.indices.end(), groupIndices.begin(), groupIndices.end());
+			lod.faceGroups.insert(lod.faceGroups.end(), groupIndices.size() / 3, kv.first);
+		}
+		if (lod.indices.size() > previousCount * FS_LOD_MIN_REDUCTION) {break;}
+
+		// Each level is measured against the one before, so the errors stack
+		error += levelError;
+		lod.error = error;
+		previousCount = lod.indices.size();
+		optimiseFaceOrder(vertices, lod.indices, lod.faceGroups);
+		lods.push_back(std::move(lod));
+	}
+	return lods;
+}
+
+} // namespace festi
@@ -0,0 +1,35 @@
+#pragma once
+
+#include "model.hpp"
+
+// std
+#include <cstdint>
+#include <vector>
+
+namespace festi {
+
+constexpr uint32_t FS_MAX_LODS = 4; // including the full resolution mesh
+constexpr float FS_LOD_REDUCTION = .5f; // each LOD aims for this fraction of the previous one's triangles
+constexpr float FS_LOD_MIN_REDUCTION = .85f; // a LOD that keeps more than this fraction isn't worth its indices
+constexpr float FS_LOD_MIN_NORMAL_DOT = .25f; // collapses that turn a triangle further than this are rejected
+
+// A simplified version of a mesh over the same vertex buffer
+struct LodMesh {
+    std::vector<uint32_t> indices;
+    std::vector<int32_t> faceGroups; // per face, as MeshData::faceMaterials
+    float error = 0.f; // model space distance the surface may have moved from the full resolution mesh
+};
+
+// Quadric error edge collapse, down to targetIndexCount or as close as it gets. Vertices only ever collapse onto
+// their neighbours, so the result indexes the same vertex buffer. Vertices on borders and attribute seams
+// are locked, which also keeps a group's outline intact against the groups around it.
+// Returns the largest collapse error, in model space units
+float simplifyMesh(const std::vector<Vertex>& vertices, std::vector<uint32_t>& indices, size_t targetIndexCount);
+
+// Up to FS_MAX_LODS - 1 coarser LODs, each simplified from the one before group by group, in draw order
+std::vector<LodMesh> buildLods(
+    const std::vector<Vertex>& vertices,
+    const std::vector<uint32_t>& indices,
+    const std::vector<int32_t>& faceGroups);
+
+} // namespace festi
@@ -0,0 +1,192 @@
+#include "meshlets.hpp"
+
+#include "model.hpp"
+
+// std
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+#include <tuple>
+
+namespace festi {
+
+namespace {
+
+void finishMeshlet(
+	const std::vector<Vertex>& vertices,
+	const std::vector<uint32_t>& indices,
+	uint32_t first,
+	uint32_t count,
+	float orientation,
+	MeshletSet& meshlets) {
+	glm::vec3 min = vertices[indices[first]].position, max = min;
+	glm::vec3 normalSum{0.f};
+	for (uint32_t i = first; i < first + count; i += 3) {
+		const glm::vec3& p0 = vertices[indices[i]].position;
+		const glm::vec3& p1 = vertices[indices[i + 1]].position;
+		const glm::vec3& p2 = vertices[indices[i + 2]].position;
+		min = glm::min(min, glm::min(p0, glm::min(p1, p2)));
+		max = glm::max(max, glm::max(p0, glm::max(p1, p2)));
+		normalSum += glm::cross(p1 - p0, p2 - p0);
+	}
+	const glm::vec3 centre = .5f * (min + max);
+	float radius = 0.f;
+	for (uint32_t i = first; i < first + count; i++) {
+		radius = std::max(radius, glm::length(vertices[indices[i]].position - centre));
+	}
+
+	// The cone must hold every triangle's normal, degenerate triangles face nowhere and are skipped
+	float cutoff = 2.f;
+	const float axisLength = glm::length(normalSum);
+	const glm::vec3 axis = axisLength > 0.f ? orientation * normalSum / axisLength : glm::vec3{0.f};
+	if (orientation != 0.f && axisLength > 0.f) {
+		float minDot = 1.f;
+		for (uint32_t i = first; i < first + count; i += 3) {
+			const glm::vec3& p0 = vertices[indices[i]].position;
+			const glm::vec3 normal = glm::cross(vertices[indices[i + 1]].position - p0, vertices[indices[i + 2]].position - p0);
+			const float length = glm::length(normal);
+			if (length > 0.f) {minDot = std::min(minDot, orientation * glm::dot(normal, axis) / length);}
+		}
+		if (minDot > 0.f) {cutoff = std::sqrt(std::max(1.f - minDot * minDot, 0.f));}
+	}
+
+	meshlets.firstIndex.push_back(first);
+	meshlets.indexCount.push_back(count);
+	meshlets.centreX.push_back(centre.x);
+	meshlets.centreY.push_back(centre.y);
+	meshlets.centreZ.push_back(centre.z);
+	meshlets.radius.push_back(radius);
+	meshlets.axisX.push_back(axis.x);
+	meshlets.axisY.push_back(axis.y);
+	meshlets.axisZ.push_back(axis.z);
+	meshlets.coneCutoff.push_back(cutoff);
+}
+
+} // namespace
+
+void appendMeshlets(
+	const std::vector<Vertex>& vertices,
+	const std::vector<uint32_t>& indices,
+	uint32_t firstIndex,
+	uint32_t indexCount,
+	float orientation,
+	MeshletSet& meshlets) {
+	// The faces are already in vertex cache order, so consecutive triangles make compact clusters
+	uint32_t meshletStart = firstIndex;
+	std::vector<uint32_t> meshletVertices;
+	meshletVertices.reserve(FS_MESHLET_MAX_VERTICES);
+	for (uint32_t i = firstIndex; i < firstIndex + indexCount; i += 3) {
+		uint32_t newVertices = 0;
+		for (int k = 0; k < 3; k++) {
+			const uint32_t v = indices[i + k];
+			const bool seen = std::find(meshletVertices.begin(), meshletVertices.end(), v) != meshletVertices.end() ||
+				(k > 0 && v == indices[i]) || (k > 1 && v == indices[i + 1]);
+			newVertices += !seen;
+		}
+		if (meshletVertices.size() + newVertices > FS_MESHLET_MAX_VERTICES ||
+			i - meshletStart >= 3 * FS_MESHLET_MAX_TRIANGLES) {
+			finishMeshlet(vertices, indices, meshletStart, i - meshletStart, orientation, meshlets);
+			meshletStart = i;
+			meshletVertices.clear();
+		}
+		for (int k = 0; k < 3; k++) {
+			const uint32_t v = indices[i + k];
+			if (std::find(meshletVertices.begin(), meshletVertices.end(), v) == meshletVertices.end()) {
+				meshletVertices.push_back(v);
+			}
+		}
+	}
+	if (meshletStart < firstIndex + indexCount) {
+		finishMeshlet(vertices, indices, meshletStart, firstIndex + indexCount - meshletStart, orientation, meshlets);
+	}
+}
+
+float closedMeshOrientation(const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices) {
+	if (indices.empty()) {return 0.f;}
+
+	// Vertices split for normals or uvs still join the surface, so edges are compared by position
+	std::vector<uint32_t> byPosition(vertices.size());
+	std::iota(byPosition.begin(), byPosition.end(), 0);
+	std::sort(byPosition.begin(), byPosition.end(), [&](uint32_t a, uint32_t b) {
+		const glm::vec3& pa = vertices[a].position;
+		const glm::vec3& pb = vertices[b].position;
+		return std::tie(pa.x, pa.y, pa.z) < std::tie(pb.x, pb.y, pb.z);
+	});
+	std::vector<uint32_t> positionIDs(vertices.size());
+	uint32_t positionCount = 0;
+	for (size_t i = 0; i < byPosition.size(); i++) {
+		if (i > 0 && vertices[byPosition[i]].position != vertices[byPosition[i - 1]].position) {positionCount++;}
+		positionIDs[byPosition[i]] = positionCount;
+	}
+
+	std::vector<uint64_t> edges;
+	edges.reserve(indices.size());
+	double volume = 0.;
+	for (size_t i = 0; i < indices.size(); i += 3) {
+		for (int k = 0; k < 3; k++) {
+			edges.push_back((uint64_t)positionIDs[indices[i + k]] << 32 | positionIDs[indices[i + (k + 1) % 3]]);
+		}
+		const glm::vec3& p0 = vertices[indices[i]].position;
+		volume += glm::dot(p0, glm::cross(vertices[indices[i + 1]].position, vertices[indices[i + 2]].position));
+	}
+	std::sort(edges.begin(), edges.end());
+	for (size_t i = 0; i < edges.size(); i++) {
+		const uint64_t reverse = edges[i] << 32 | edges[i] >> 32;
+		if ((i > 0 && edges[i] == edges[i - 1]) || !std::binary_search(edges.begin(), edges.end(), reverse)) {return 0.f;}
+	}
+	return volume > 0. ? 1.f : volume < 0. ? -1.f : 0.f;
+}
+
+void extractFrustumPlanes(const glm::mat4& clip, glm::vec4 planes[6]) {
+	const glm::vec4 row0{clip[0][0], clip[1][0], clip[2][0], clip[3][0]};
+	const glm::vec4 row1{clip[0][1], clip[1][1], clip[2][1], clip[3][1]};
+	const glm::vec4 row2{clip[0][2], clip[1][2], clip[2][2], clip[3][2]};
+	const glm::vec4 row3{clip[0][3], clip[1][3], clip[2][3], clip[3][3]};
+	// Depth runs zero to one
+	planes[0] = row3 + row0;
+	planes[1] = row3 - row0;
+	planes[2] = row3 + row1;
+	planes[3] = row3 - row1;
+	planes[4] = row2;
+	planes[5] = row3 - row2;
+	for (int i = 0; i < 6; i++) {
+		const float length = glm::length(glm::vec3(planes[i]));
+		if (length > 0.f) {planes[i] /= length;}
+	}
+}
+
+void cullMeshlets(
+	const MeshletSet& meshlets,
+	const glm::vec4 planes[6],
+	const glm::vec3& camera,
+	bool cullBackfaces,
+	std::vector<uint8_t>& visible) {
+	const size_t count = meshlets.size();
+	visible.resize(count);
+	const float* cx = meshlets.centreX.data();
+	const float* cy = meshlets.centreY.data();
+	const float* cz = meshlets.centreZ.data();
+	const float* r = meshlets.radius.data();
+	const float* ax = meshlets.axisX.data();
+	const float* ay = meshlets.axisY.data();
+	const float* az = meshlets.axisZ.data();
+	const float* cutoff = meshlets.coneCutoff.data();
+	const float backfaceScale = cullBackfaces ? 1.f : 0.f;
+	uint8_t* out = visible.data();
+
+	// Branch free over plain arrays so it vectorises. A cluster is backfacing when every point of its
+	// bounding sphere sees every normal in its cone from behind
+	for (size_t i = 0; i < count; i++) {
+		bool inside = true;
+		for (int p = 0; p < 6; p++) {
+			inside &= planes[p].x * cx[i] + planes[p].y * cy[i] + planes[p].z * cz[i] + planes[p].w >= -r[i];
+		}
+		const float dx = cx[i] - camera.x, dy = cy[i] - camera.y, dz = cz[i] - camera.z;
+		const float distance = std::sqrt(dx * dx + dy * dy + dz * dz);
+		const bool backfacing =
+			backfaceScale * (dx * ax[i] + dy * ay[i] + dz * az[i]) > cutoff[i] * distance + r[i] * (1.f + cutoff[i]);
+		out[i] = inside & !backfacing;
+	}
+}
+
+} // namespace festi
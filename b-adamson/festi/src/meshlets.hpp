@@ -0,0 +1,57 @@
+#pragma once
+
+// lib
+#define GLM_FORCE_RADIANS
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+#include <glm/glm.hpp>
+
+// std
+#include <cstdint>
+#include <vector>
+
+namespace festi {
+
+struct Vertex;
+
+constexpr uint32_t FS_MESHLET_MAX_VERTICES = 64;
+constexpr uint32_t FS_MESHLET_MAX_TRIANGLES = 124;
+
+// Runs of consecutive triangles in the index buffer, small enough to cull individually. Bounds are kept as
+// separate arrays so cullMeshlets vectorises over them
+struct MeshletSet {
+    std::vector<uint32_t> firstIndex;
+    std::vector<uint32_t> indexCount;
+    std::vector<float> centreX, centreY, centreZ, radius; // model space bounding sphere
+    std::vector<float> axisX, axisY, axisZ; // mean outward facing direction
+    std::vector<float> coneCutoff; // sin of the normal cone's half angle, above 1 when the cone can't be culled
+
+    size_t size() const {return firstIndex.size();}
+};
+
+// Splits [firstIndex, firstIndex + indexCount) into meshlets in draw order. orientation is 1 when the
+// triangles wind outward, -1 when inward and 0 when they have no consistent outside (no backface culling)
+void appendMeshlets(
+    const std::vector<Vertex>& vertices,
+    const std::vector<uint32_t>& indices,
+    uint32_t firstIndex,
+    uint32_t indexCount,
+    float orientation,
+    MeshletSet& meshlets);
+
+// 1 or -1 when every edge is shared by exactly two triangles winding it in opposite directions, with the
+// sign of the enclosed volume. 0 otherwise. Only for closed meshes does a backfacing cluster being hidden
+// by the rest of the mesh not depend on the pipeline culling back faces
+float closedMeshOrientation(const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices);
+
+// Normalised frustum planes in the space the clip matrix maps from, facing inward
+void extractFrustumPlanes(const glm::mat4& clip, glm::vec4 planes[6]);
+
+// visible[i] is 1 when meshlet i may be seen. Planes and camera are in model space
+void cullMeshlets(
+    const MeshletSet& meshlets,
+    const glm::vec4 planes[6],
+    const glm::vec3& camera,
+    bool cullBackfaces,
+    std::vector<uint8_t>& visible);
+
+} // namespace festi
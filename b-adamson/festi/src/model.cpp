@@ -1,10 +1,16 @@
 #include "model.hpp"
 
+#include "mesh_cache.hpp"
+#include "mesh_optimiser.hpp"
+#include "mesh_simplifier.hpp"
+#include "obj_loader.hpp"
+#include "thread_pool.hpp"
+#include "upload_batch.hpp"
 #include "utils.hpp"
+#include "vertex_dedup.hpp"
 
 // libs
 #define GLM_ENABLE_EXPERIMENTAL
-#include <glm/gtx/hash.hpp>
 #include <glm/gtx/euler_angles.hpp>
 #include <glm/gtx/quaternion.hpp>
 #define TINYOBJLOADER_IMPLEMENTATION
@@ -13,7 +19,10 @@
 
 // std
 #include <cassert>
+#include <chrono>
+#include <cstddef>
 #include <cstring>
+#include <future>
 #include <unordered_map>
 #include <map>
 #include <memory>
@@ -21,23 +30,14 @@
 #include <stdexcept>
 #include <cmath>
 #include <algorithm>
-
-template <>
-struct std::hash<festi::Vertex> {
-	size_t operator()(const festi::Vertex& vertex) const {
-		size_t seed = 0;
-		festi::hashCombine(
-			seed, 
-			vertex.position, vertex.normal, vertex.tangent,
-			vertex.bitangent, vertex.uv);
-		return seed;
-  	}
-};
+#include <numeric>
 
 namespace festi {
 
 std::vector<uint32_t> MaterialsSSBO::offsets{};
+uint32_t MaterialsSSBO::faceDataEnd = 0;
 std::unordered_map<std::string, uint32_t> FestiModel::materialNamesMap;
+std::unordered_map<std::string, std::weak_ptr<const FestiMesh>> FestiModel::meshRegistry;
 
 FestiModel::FestiModel(FestiDevice& device) : festiDevice{device} {
 	static uint32_t currentID = 0;
@@ -67,28 +67,22 @@ std::shared_ptr<FestiPointLight> FestiPointLight::createPointLight(FS_PointLight
 	return gameObject;
 }
 
-std::shared_ptr<FestiModel> FestiModel::createModelFromFile(
-	FestiDevice& device, 
-	FestiMaterials& festiMaterials,
-	FS_ModelMap& gameObjects,
-	const std::string& filepath,
-	const std::string& mtlDirPath,
-	const std::string& imgDirPath) {
-	tinyobj::attrib_t attrib;
-	std::vector<tinyobj::shape_t> shapes;
-	std::vector<tinyobj::material_t> materials;
-	std::string warn, err;
-
-	if (!tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &err, filepath.c_str(), mtlDirPath.c_str())) {
-		throw std::runtime_error(warn + err); 
-	}
-
-	std::vector<ObjFaceData> faceData{};
-
-	auto gameObject = std::make_shared<FestiModel>(device);
-
-	std::unordered_map<Vertex, uint32_t> uniqueVertices{};
-	for (const auto& shape : shapes) {
+// Parses the OBJ, dedups its vertices and builds tangents; the work a mesh cache hit skips
+MeshData FestiModel::buildMeshFromObj(const std::string& filepath, const std::string& mtlDirPath) {
+	ObjData obj = loadObj(filepath, mtlDirPath);
+	const auto& attrib = obj.attrib;
+
+	MeshData mesh;
+	mesh.materials = std::move(obj.materials);
+	mesh.buildStats.parseMegabytesPerSecond = obj.parseMegabytesPerSecond;
+	mesh.sourceFiles.push_back(filepath);
+	mesh.sourceFiles.insert(mesh.sourceFiles.end(), obj.materialLibraries.begin(), obj.materialLibraries.end());
+
+	size_t indexCount = 0;
+	for (const auto& shape : obj.shapes) {indexCount += shape.mesh.indices.size();}
+	mesh.indices.reserve(indexCount);
+	FestiVertexDedup uniqueVertices(indexCount);
+	for (const auto& shape : obj.shapes) {
 		for (size_t i = 0; i < shape.mesh.indices.size(); i++) {
 		const auto& index = shape.mesh.indices[i];
 		if (shape.mesh.num_face_vertices[(size_t)(i / 3)] != 3) {
@@ -118,115 +112,579 @@ std::shared_ptr<FestiModel> FestiModel::createModelFromFile(
 			};
 		}
 
-		if (uniqueVertices.count(vertex) == 0) {
-			uniqueVertices[vertex] = static_cast<uint32_t>(gameObject->vertices.size());
-			gameObject->vertices.push_back(vertex);
+		bool inserted;
+		mesh.indices.push_back(uniqueVertices.findOrInsert(vertex, inserted));
+		if (inserted) {mesh.vertices.push_back(vertex);}
 		}
-		gameObject->indices.push_back(uniqueVertices[vertex]);
+		mesh.faceMaterials.insert(mesh.faceMaterials.end(), shape.mesh.material_ids.begin(), shape.mesh.material_ids.end());
+	}
+	FestiModel::setTangentsBitangentsShapeArea(mesh.vertices, mesh.indices, mesh.shapeArea);
+
+	mesh.buildStats.optimise = optimiseMesh(mesh.vertices, mesh.indices, mesh.faceMaterials, mesh.faceOrder);
+	mesh.lods = buildLods(mesh.vertices, mesh.indices, mesh.faceMaterials);
+	return mesh;
+}
+
+// The half of a load that touches neither Vulkan nor global state, so it runs on any thread. A valid .fmesh is
+// mapped and copied straight into the mesh, otherwise the OBJ is built and cached
+MeshData FestiModel::readOrBuildMesh(const std::string& filepath, const std::string& mtlDirPath) {
+	const auto start = std::chrono::high_resolution_clock::now();
+	const std::string cachePath = getMeshCachePath(filepath, mtlDirPath);
+	MeshData mesh;
+	const bool cacheHit = readMeshCache(cachePath, mesh);
+	if (!cacheHit) {
+		mesh = buildMeshFromObj(filepath, mtlDirPath);
+		if (!writeMeshCache(cachePath, mesh)) {
+			std::cerr << "Failed to write mesh cache: " << cachePath << "\n";
 		}
-		FestiModel::setTangentsBitangentsShapeArea(gameObject->vertices, gameObject->indices, gameObject->getShapeArea());
-		faceData.resize(shape.mesh.material_ids.size());
-		for (size_t i = 0; i < materials.size(); i++) {
-			uint32_t id;
-			auto& mat = materials[i];
-			auto it = materialNamesMap.find(mat.name);
-			// does this obj contain a material we dont have?
-			if (it != materialNamesMap.end()) {
-				// if so, find material id
-				id = it->second;
-			}
-			else {
-				// if no, create a new material, populate it, and set id to that material
-				id = (uint32_t)materialNamesMap.size();
-
-				Material newMaterial;
-				newMaterial.diffuseTextureIndex = festiMaterials.appendTextureMap(mat, imgDirPath, FS_ImageMapFlags::DIFFUSE);
-				newMaterial.normalTextureIndex = festiMaterials.appendTextureMap(mat, imgDirPath, FS_ImageMapFlags::NORMAL);
-				newMaterial.specularTextureIndex = festiMaterials.appendTextureMap(mat, imgDirPath, FS_ImageMapFlags::SPECULAR);
-				newMaterial.shininess = mat.shininess;
-				newMaterial.diffuseColor = {mat.diffuse[0], mat.diffuse[1], mat.diffuse[2], 1.f};
-				newMaterial.specularColor = {mat.specular[0], mat.specular[1], mat.specular[2], 1.f};
-				materialNamesMap[mat.name] = id;
-				festiMaterials.Mssbo.materials[id] = newMaterial;
-			}
+	}
 
-			for (size_t j = 0; j < shape.mesh.material_ids.size(); j++) {
-				if (shape.mesh.material_ids[j] == (int)i) {
-					ObjFaceData objFaceData{};
-					objFaceData.materialID = id;
-					faceData[j] = objFaceData;
-					// faceData[j].materialID = id;
-				}
-			}
+	// One summary line per load, so cache hits can be told apart from full builds
+	const std::chrono::duration<double, std::milli> elapsed = std::chrono::high_resolution_clock::now() - start;
+	std::cout << "Loaded " << filepath << (cacheHit ? " from mesh cache" : " from OBJ") << " in " << elapsed.count() << " ms";
+	if (!cacheHit) {
+		const MeshBuildStats& stats = mesh.buildStats;
+		std::cout << ", parsed at " << stats.parseMegabytesPerSecond << " MB/s, ACMR " 
+			<< stats.optimise.acmrBefore << " -> " << stats.optimise.acmrAfter;
+	}
+	std::cout << "\n";
+	return mesh;
+}
+
+// Material IDs are global across models, so they're resolved on every load rather than cached
+std::vector<uint32_t> FestiModel::registerMaterials(
+	FestiMaterials& festiMaterials,
+	std::vector<tinyobj::material_t>& materials,
+	const std::string& imgDirPath) {
+	std::vector<uint32_t> materialIDs(materials.size());
+	for (size_t i = 0; i < materials.size(); i++) {
+		uint32_t id;
+		auto& mat = materials[i];
+		auto it = materialNamesMap.find(mat.name);
+		// does this obj contain a material we dont have?
+		if (it != materialNamesMap.end()) {
+			// if so, find material id
+			id = it->second;
 		}
+		else {
+			// if no, create a new material, populate it, and set id to that material
+			id = (uint32_t)materialNamesMap.size();
+
+			Material newMaterial;
+			newMaterial.diffuseTextureIndex = festiMaterials.appendTextureMap(mat, imgDirPath, FS_ImageMapFlags::DIFFUSE);
+			newMaterial.normalTextureIndex = festiMaterials.appendTextureMap(mat, imgDirPath, FS_ImageMapFlags::NORMAL);
+			newMaterial.specularTextureIndex = festiMaterials.appendTextureMap(mat, imgDirPath, FS_ImageMapFlags::SPECULAR);
+			newMaterial.shininess = mat.shininess;
+			newMaterial.diffuseColor = {mat.diffuse[0], mat.diffuse[1], mat.diffuse[2], 1.f};
+			newMaterial.specularColor = {mat.specular[0], mat.specular[1], mat.specular[2], 1.f};
+			materialNamesMap[mat.name] = id;
+			festiMaterials.Mssbo.materials[id] = newMaterial;
+		}
+		materialIDs[i] = id;
 	}
+	return materialIDs;
+}
 
-	gameObject->createVertexBuffer(gameObject->vertices);
-	gameObject->createIndexBuffer(gameObject->indices);
-	gameObject->faceData.resize(faceData.size());
-	gameObject->faceData = faceData;
+std::shared_ptr<const FestiMesh> FestiModel::loadMesh(
+	FestiDevice& device, 
+	FestiMaterials& festiMaterials,
+	const std::string& filepath,
+	const std::string& mtlDirPath,
+	const std::string& imgDirPath) {
+	MeshData data = readOrBuildMesh(filepath, mtlDirPath);
+	auto mesh = std::make_shared<FestiMesh>(data);
+	mesh->resolveMaterials(registerMaterials(festiMaterials, data.materials, imgDirPath));
+	// The copies are flushed with the frame's other uploads, ahead of its first draw
+	mesh->upload(device).reset();
+	return mesh;
+}
+
+std::shared_ptr<FestiModel> FestiModel::createModelFromFile(
+	FestiDevice& device, 
+	FestiMaterials& festiMaterials,
+	FS_ModelMap& gameObjects,
+	const std::string& filepath,
+	const std::string& mtlDirPath,
+	const std::string& imgDirPath) {
+	// Models of the same file share its geometry, only transforms, face data and instances are their own
+	auto& registered = meshRegistry[filepath + "|" + mtlDirPath];
+	std::shared_ptr<const FestiMesh> mesh = registered.lock();
+	if (!mesh) {
+		mesh = loadMesh(device, festiMaterials, filepath, mtlDirPath, imgDirPath);
+		registered = mesh;
+	}
+
+	auto gameObject = std::make_shared<FestiModel>(device);
+	gameObject->mesh = mesh;
+	gameObject->faceData = mesh->faceData;
+	gameObject->shapeArea = mesh->shapeArea;
+	gameObject->hasVertexBuffer = mesh->vertexCount > 0;
+	gameObject->hasIndexBuffer = mesh->geometry.indices.count > 0;
 
 	gameObject->insertKeyframe(0, FS_KEYFRAME_FACE_MATERIALS | FS_KEYFRAME_AS_INSTANCE | FS_KEYFRAME_VISIBILITY | FS_KEYFRAME_POS_ROT_SCALE);
 	gameObjects.emplace(gameObject->getId(), gameObject);
 	return gameObject;
 }
 
-void FestiModel::setTangentsBitangentsShapeArea(std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices, float& area) {
-    for (size_t i = 0; i < indices.size(); i += 3) {
+struct FestiModel::PendingLoads {
+	struct LoadedMesh {
+		std::shared_ptr<FestiMesh> mesh;
+		std::vector<tinyobj::material_t> materials;
+	};
+
+	struct Mesh {
+		FestiDevice& device;
+		std::string imgDirPath;
+		std::future<LoadedMesh> loaded; // CPU half, on the shared thread pool
+		std::shared_ptr<const FestiMesh> mesh; // set once its materials are registered and its upload submitted
+		std::unique_ptr<FestiUploadBatch> uploads;
+		std::vector<std::weak_ptr<FestiModel>> models;
+	};
+
+	std::unordered_map<std::string, Mesh> meshes; // by mesh registry key
+	// Instance buffers replaced while a frame in flight may still read them, with the frame they're freed on
+	std::vector<std::pair<uint64_t, std::unique_ptr<FestiBuffer>>> retiredBuffers;
+	uint64_t frame = 0;
+};
 
-        Vertex& v0 = vertices[indices[i + 0]];
-        Vertex& v1 = vertices[indices[i + 1]];
-        Vertex& v2 = vertices[indices[i + 2]];
+FestiModel::PendingLoads FestiModel::pendingLoads;
 
-        glm::vec3 deltaPos1 = v1.position - v0.position;
-        glm::vec3 deltaPos2 = v2.position - v0.position;
-        glm::vec2 deltaUV1 = v1.uv - v0.uv;
-        glm::vec2 deltaUV2 = v2.uv - v0.uv;
-		
-        float r = 1.0f / (deltaUV1.x * deltaUV2.y - deltaUV2.x * deltaUV1.y);
-        glm::vec3 tangent = (deltaPos1 * deltaUV2.y - deltaPos2 * deltaUV1.y) * r;
-        glm::vec3 bitangent = (deltaPos2 * deltaUV1.x - deltaPos1 * deltaUV2.x) * r;
+std::shared_ptr<FestiModel> FestiModel::createModelFromFileAsync(
+	FestiDevice& device, 
+	FS_ModelMap& gameObjects,
+	const std::string& filepath,
+	const std::string& mtlDirPath,
+	const std::string& imgDirPath) {
+	auto gameObject = std::make_shared<FestiModel>(device);
+	gameObject->insertKeyframe(0, FS_KEYFRAME_AS_INSTANCE | FS_KEYFRAME_VISIBILITY | FS_KEYFRAME_POS_ROT_SCALE);
+	gameObjects.emplace(gameObject->getId(), gameObject);
+	// Models created after the Mssbo was built still need an offset slot, it's filled once they're resident
+	if (MaterialsSSBO::offsets.size() <= gameObject->getId()) {MaterialsSSBO::offsets.resize(gameObject->getId() + 1, 0);}
+
+	// Models of the same file wait on one load
+	const std::string key = filepath + "|" + mtlDirPath;
+	auto pending = pendingLoads.meshes.find(key);
+	if (pending == pendingLoads.meshes.end()) {
+		PendingLoads::Mesh load{device, imgDirPath};
+		// A mesh another model already holds only has to wait for the next frame
+		load.mesh = meshRegistry[key].lock();
+		if (!load.mesh) {
+			load.loaded = FestiThreadPool::shared().submit([filepath, mtlDirPath]() {
+				MeshData data = readOrBuildMesh(filepath, mtlDirPath);
+				auto mesh = std::make_shared<FestiMesh>(data);
+				return PendingLoads::LoadedMesh{mesh, std::move(data.materials)};
+			});
+		}
+		pending = pendingLoads.meshes.emplace(key, std::move(load)).first;
+	}
+	pending->second.models.push_back(gameObject);
+	return gameObject;
+}
 
-        v0.tangent += tangent;
-        v1.tangent += tangent;
-        v2.tangent += tangent;
+void FestiModel::updatePendingLoads(FestiMaterials& festiMaterials, FS_ModelMap& gameObjects, FestiBuffer& MssboBuffer) {
+	// This frame's fence has been waited on, so buffers retired FS_MAX_FRAMES_IN_FLIGHT frames ago are unused
+	pendingLoads.frame++;
+	auto& retired = pendingLoads.retiredBuffers;
+	retired.erase(std::remove_if(retired.begin(), retired.end(), 
+		[](const auto& buffer) {return buffer.first <= pendingLoads.frame;}), retired.end());
+	if (pendingLoads.meshes.empty()) {return;}
+
+	// Materials are global, so they're registered here on the main thread
+	for (auto& kv : pendingLoads.meshes) {
+		auto& load = kv.second;
+		if (load.mesh || load.loaded.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {continue;}
+
+		PendingLoads::LoadedMesh loaded = load.loaded.get();
+		const std::vector<uint32_t> materialIDs = registerMaterials(festiMaterials, loaded.materials, load.imgDirPath);
+		for (uint32_t id : materialIDs) {
+			MssboBuffer.writeToBuffer(&festiMaterials.Mssbo.materials[id], sizeof(Material), 
+				offsetof(MaterialsSSBO, materials) + id * sizeof(Material));
+		}
+		loaded.mesh->resolveMaterials(materialIDs);
+		load.uploads = loaded.mesh->upload(load.device);
+		load.mesh = loaded.mesh;
+	}
 
-        v0.bitangent += bitangent;
-        v1.bitangent += bitangent;
-        v2.bitangent += bitangent;
+	// Nothing may sample a texture before it's in the bindless array, so each mesh waits on the textures its
+	// own materials sample
+	festiMaterials.finaliseLateTextures();
+	for (auto it = pendingLoads.meshes.begin(); it != pendingLoads.meshes.end();) {
+		auto& load = it->second;
+		const bool texturesReady = load.mesh && std::all_of(load.mesh->materialRanges.begin(), load.mesh->materialRanges.end(),
+			[&](const MaterialRange& range) {return festiMaterials.texturesReady(range.materialID);});
+		if (!load.mesh || (load.uploads && !load.uploads->isComplete()) || !texturesReady) {
+			it++;
+			continue;
+		}
 
-		area += glm::length(glm::cross(v1.position - v0.position, v2.position - v0.position));
-    }
+		meshRegistry[it->first] = load.mesh;
+		for (auto& model : load.models) {
+			if (auto obj = model.lock()) {obj->makeResident(load.mesh, festiMaterials, gameObjects, MssboBuffer);}
+		}
+		it = pendingLoads.meshes.erase(it);
+	}
+}
 
-    for (auto& vertex : vertices) {
-        vertex.tangent = glm::normalize(vertex.tangent);
-        vertex.bitangent = glm::normalize(vertex.bitangent);
-    }
+void FestiModel::cancelPendingLoads() {
+	pendingLoads.meshes.clear();
+	pendingLoads.retiredBuffers.clear();
+}
+
+void FestiModel::makeResident(
+	std::shared_ptr<const FestiMesh> resident,
+	FestiMaterials& festiMaterials,
+	FS_ModelMap& gameObjects,
+	FestiBuffer& MssboBuffer) {
+	mesh = std::move(resident);
+	faceData = mesh->faceData;
+	shapeArea = mesh->shapeArea;
+	hasVertexBuffer = mesh->vertexCount > 0;
+	hasIndexBuffer = mesh->geometry.indices.count > 0;
+	insertKeyframe(0, FS_KEYFRAME_FACE_MATERIALS);
+
+	// A script can't catch these any more, so an edit that doesn't fit the mesh is dropped rather than thrown
+	for (auto& edit : pendingFaceEdits) {
+		try {
+			if (edit.frame == FS_UNSPECIFIED) {
+				setFaces(edit.data, edit.faces);
+			} else {
+				const bool allFaces = !edit.faces.empty() && edit.faces[0] == FS_UNSPECIFIED;
+				insertKeyframe(edit.frame, FS_KEYFRAME_FACE_MATERIALS, allFaces ? ALL_FACES() : edit.faces);
+			}
+		} catch (const std::runtime_error& error) {
+			std::cerr << "Dropped face edit made while loading: " << error.what() << "\n";
+		}
+	}
+	pendingFaceEdits.clear();
+
+	festiMaterials.Mssbo.appendFaceData(*this, MssboBuffer);
+	createInstanceBuffer(getInstanceBufferSize());
+	updateInstances();
+
+	// Models instanced over this one were sized and placed while it had no surface
+	for (auto& kv : gameObjects) {
+		auto& obj = kv.second;
+		if (!obj->instanceBuffer) {continue;}
+		const auto& asInstanceKeyframes = obj->keyframes.asInstanceData;
+		if (std::none_of(asInstanceKeyframes.begin(), asInstanceKeyframes.end(), 
+			[this](const auto& kf) {return kf.second.parentObject.get() == this;})) {continue;}
+
+		const uint32_t size = obj->getInstanceBufferSize();
+		if (obj->instanceBuffer->getInstanceCount() < size) {
+			pendingLoads.retiredBuffers.emplace_back(pendingLoads.frame + FS_MAX_FRAMES_IN_FLIGHT, std::move(obj->instanceBuffer));
+			obj->createInstanceBuffer(size);
+		}
+		obj->updateInstances();
+	}
 }
 
-void FestiModel::createVertexBuffer(const std::vector<Vertex> &vertices) {
+FestiMesh::FestiMesh(MeshData& mesh) {
+	vertices = std::move(mesh.vertices);
+	indices = std::move(mesh.indices);
+	shapeArea = mesh.shapeArea;
+	faceOrder = std::move(mesh.faceOrder);
+
+	faceData.resize(mesh.faceMaterials.size());
+	for (size_t face = 0; face < mesh.faceMaterials.size(); face++) {
+		const int32_t material = mesh.faceMaterials[face];
+		if (material >= 0 && (size_t)material < mesh.materials.size()) {
+			faceData[face].materialID = (uint32_t)material;
+		}
+	}
+
+	computeBounds();
+	sortFacesByMaterial(drawIndices);
+	appendLods(mesh.lods, mesh.materials.size(), drawIndices);
+	buildMeshlets(drawIndices);
+
+	// Coarser LODs follow the full resolution faces in the buffer, indexCount only covers the latter
 	vertexCount = static_cast<uint32_t>(vertices.size());
-	hasVertexBuffer = vertexCount > 0;
+	indexCount = lods.empty() ? static_cast<uint32_t>(drawIndices.size()) : lods[0].indexCount;
+	indexType = vertexCount <= UINT16_MAX + 1 ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32;
+}
+
+void FestiMesh::resolveMaterials(const std::vector<uint32_t>& materialIDs) {
+	auto resolve = [&](uint32_t& materialID) {
+		if (materialID != FS_UNSPECIFIED) {materialID = materialIDs[materialID];}
+	};
+	for (auto& data : faceData) {resolve(data.materialID);}
+	for (auto& range : materialRanges) {resolve(range.materialID);}
+	for (auto& lod : lods) {
+		for (auto& range : lod.ranges) {resolve(range.materialID);}
+	}
+}
+
+FestiMesh::~FestiMesh() {
+	if (geometryArena) {geometryArena->free(geometry);}
+}
+
+std::unique_ptr<FestiUploadBatch> FestiMesh::upload(FestiDevice& device) {
+	geometryArena = &device.getGeometryArena();
+	geometry = geometryArena->allocate(vertexCount, (uint32_t)drawIndices.size(), indexType);
+
+	// The staging copies are taken on submit, so the packed streams only need to live until then
+	auto uploads = std::make_unique<FestiUploadBatch>(device);
+	std::vector<glm::vec3> positions;
+	std::vector<PackedVertexAttributes> attributes;
+	std::vector<uint16_t> shortIndices;
+	uploadVertices(*uploads, positions, attributes);
+	uploadIndices(*uploads, shortIndices);
+	uploads->submitAsync();
+
+	drawIndices.clear();
+	drawIndices.shrink_to_fit();
+	return uploads;
+}
+
+void FestiModel::setTangentsBitangentsShapeArea(std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices, float& area) {
+	// Per triangle terms first, then every vertex gathers its own triangles in index order. That adds the same
+	// values in the same order a serial scatter would, so the result doesn't depend on the thread count
+	const size_t triangleCount = indices.size() / 3;
+	std::vector<glm::vec3> tangents(triangleCount);
+	std::vector<glm::vec3> bitangents(triangleCount);
+	std::vector<float> areas(triangleCount);
+	auto& pool = FestiThreadPool::shared();
+	pool.parallelFor(triangleCount, FS_TANGENT_BATCH_SIZE, [&](size_t first, size_t last) {
+		for (size_t t = first; t < last; t++) {
+			const Vertex& v0 = vertices[indices[3 * t + 0]];
+			const Vertex& v1 = vertices[indices[3 * t + 1]];
+			const Vertex& v2 = vertices[indices[3 * t + 2]];
+
+			glm::vec3 deltaPos1 = v1.position - v0.position;
+			glm::vec3 deltaPos2 = v2.position - v0.position;
+			glm::vec2 deltaUV1 = v1.uv - v0.uv;
+			glm::vec2 deltaUV2 = v2.uv - v0.uv;
+
+			float r = 1.0f / (deltaUV1.x * deltaUV2.y - deltaUV2.x * deltaUV1.y);
+			tangents[t] = (deltaPos1 * deltaUV2.y - deltaPos2 * deltaUV1.y) * r;
+			bitangents[t] = (deltaPos2 * deltaUV1.x - deltaPos1 * deltaUV2.x) * r;
+			areas[t] = glm::length(glm::cross(deltaPos1, deltaPos2));
+		}
+	});
+
+	std::vector<uint32_t> adjacencyOffsets(vertices.size() + 1, 0);
+	for (uint32_t v : indices) {adjacencyOffsets[v + 1]++;}
+	std::partial_sum(adjacencyOffsets.begin(), adjacencyOffsets.end(), adjacencyOffsets.begin());
+	std::vector<uint32_t> adjacency(indices.size());
+	{
+		std::vector<uint32_t> fill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+		for (size_t i = 0; i < indices.size(); i++) {adjacency[fill[indices[i]]++] = (uint32_t)(i / 3);}
+	}
+
+	pool.parallelFor(vertices.size(), FS_TANGENT_BATCH_SIZE, [&](size_t first, size_t last) {
+		for (size_t v = first; v < last; v++) {
+			Vertex& vertex = vertices[v];
+			for (uint32_t i = adjacencyOffsets[v]; i < adjacencyOffsets[v + 1]; i++) {
+				vertex.tangent += tangents[adjacency[i]];
+				vertex.bitangent += bitangents[adjacency[i]];
+			}
+			vertex.tangent = glm::normalize(vertex.tangent);
+			vertex.bitangent = glm::normalize(vertex.bitangent);
+		}
+	});
+
+	for (float triangleArea : areas) {area += triangleArea;}
+}
+
+void FestiMesh::sortFacesByMaterial(std::vector<uint32_t>& sortedIndices) {
+	// Faces keep their IDs on the CPU side (scripts and keyframes address them), only the
+	// uploaded index buffer is grouped into one contiguous range per material
+	const uint32_t faceCount = static_cast<uint32_t>(indices.size() / 3);
+	std::vector<uint32_t> order(faceCount);
+	std::iota(order.begin(), order.end(), 0);
+	// Within a material, faces keep the order the mesh optimiser chose for the vertex cache and overdraw
+	std::stable_sort(order.begin(), order.end(), [this](uint32_t a, uint32_t b) {
+		if (faceData[a].materialID != faceData[b].materialID) {return faceData[a].materialID < faceData[b].materialID;}
+		return !faceOrder.empty() && faceOrder[a] < faceOrder[b];
+	});
+
+	sortedIndices.resize(indices.size());
+	faceSlots.resize(faceCount);
+	materialRanges.clear();
+	for (uint32_t slot = 0; slot < faceCount; slot++) {
+		const uint32_t face = order[slot];
+		std::copy_n(indices.begin() + 3 * face, 3, sortedIndices.begin() + 3 * slot);
+		faceSlots[face] = slot;
+
+		const uint32_t materialID = faceData[face].materialID;
+		if (materialRanges.empty() || materialRanges.back().materialID != materialID) {
+			materialRanges.push_back({3 * slot, 0, materialID});
+		}
+		materialRanges.back().indexCount += 3;
+	}
+
+	// Texture streaming estimates on-screen texel density from these
+	for (auto& range : materialRanges) {
+		float surfaceArea = 0.f;
+		float uvArea = 0.f;
+		for (uint32_t i = range.firstIndex; i < range.firstIndex + range.indexCount; i += 3) {
+			const Vertex& v0 = vertices[sortedIndices[i]];
+			const Vertex& v1 = vertices[sortedIndices[i + 1]];
+			const Vertex& v2 = vertices[sortedIndices[i + 2]];
+			surfaceArea += glm::length(glm::cross(v1.position - v0.position, v2.position - v0.position));
+			const glm::vec2 deltaUV1 = v1.uv - v0.uv;
+			const glm::vec2 deltaUV2 = v2.uv - v0.uv;
+			uvArea += std::abs(deltaUV1.x * deltaUV2.y - deltaUV2.x * deltaUV1.y);
+		}
+		range.texelDensity = surfaceArea > 0.f ? std::sqrt(uvArea / surfaceArea) : 0.f;
+	}
+	lods = {{0, (uint32_t)sortedIndices.size(), 0.f, materialRanges}};
+}
+
+void FestiMesh::appendLods(const std::vector<LodMesh>& meshLods, size_t materialCount, std::vector<uint32_t>& sortedIndices) {
+	// LOD faces are grouped by the same material IDs as the full mesh, keeping their optimised order within each
+	for (const auto& meshLod : meshLods) {
+		auto materialOf = [&](uint32_t face) {
+			const int32_t material = meshLod.faceGroups[face];
+			return material >= 0 && (size_t)material < materialCount ? (uint32_t)material : FS_UNSPECIFIED;
+		};
+		std::vector<uint32_t> order(meshLod.faceGroups.size());
+		std::iota(order.begin(), order.end(), 0);
+		std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {return materialOf(a) < materialOf(b);});
+
+		MeshLod lod{(uint32_t)sortedIndices.size(), (uint32_t)meshLod.indices.size(),
+			boundsRadius > 0.f ? meshLod.error / boundsRadius : 0.f, {}};
+		for (uint32_t face : order) {
+			const uint32_t materialID = materialOf(face);
+			if (lod.ranges.empty() || lod.ranges.back().materialID != materialID) {
+				lod.ranges.push_back({(uint32_t)sortedIndices.size(), 0, materialID});
+			}
+			lod.ranges.back().indexCount += 3;
+			sortedIndices.insert(sortedIndices.end(), meshLod.indices.begin() + 3 * face, meshLod.indices.begin() + 3 * face + 3);
+		}
+		lods.push_back(std::move(lod));
+	}
+}
+
+void FestiMesh::computeBounds() {
+	if (vertices.empty()) {return;}
+	glm::vec3 min = vertices[0].position, max = vertices[0].position;
+	for (const auto& vertex : vertices) {
+		min = glm::min(min, vertex.position);
+		max = glm::max(max, vertex.position);
+	}
+	boundsCentre = .5f * (min + max);
+	boundsRadius = 0.f;
+	for (const auto& vertex : vertices) {boundsRadius = std::max(boundsRadius, glm::length(vertex.position - boundsCentre));}
+}
+
+void FestiMesh::buildMeshlets(const std::vector<uint32_t>& sortedIndices) {
+	closedOrientation = closedMeshOrientation(vertices, indices);
+	for (auto& lod : lods) {
+		for (const auto& range : lod.ranges) {
+			lod.rangeMeshlets.push_back((uint32_t)lod.meshlets.size());
+			appendMeshlets(vertices, sortedIndices, range.firstIndex, range.indexCount, closedOrientation, lod.meshlets);
+		}
+		lod.rangeMeshlets.push_back((uint32_t)lod.meshlets.size());
+	}
+}
+
+void FestiModel::selectLods(FS_ModelMap& gameObjects, const glm::vec3& cameraPosition, float pixelsPerUnit) {
+	for (auto& kv : gameObjects) {
+		auto& obj = kv.second;
+		obj->currentLod = 0;
+		if (!obj->mesh || obj->mesh->lods.size() < 2 || obj->instanceRadius <= 0.f) {continue;}
+
+		// No instance is closer than this, and the largest one there projects biggest
+		const float centreDistance = glm::length(obj->instanceBoundsCentre - cameraPosition);
+		if (centreDistance <= obj->instanceBoundsRadius) {continue;}
+		const float distance = centreDistance - obj->instanceBoundsRadius + obj->instanceRadius;
+		const float projectedRadius = obj->instanceRadius * pixelsPerUnit / distance;
+		while (obj->currentLod + 1 < obj->mesh->lods.size() &&
+			obj->mesh->lods[obj->currentLod + 1].relativeError * projectedRadius <= FS_LOD_PIXEL_ERROR) {
+			obj->currentLod++;
+		}
+	}
+}
+
+void FestiModel::resolveFaceOverrides() {
+	hasFaceOverrides = false;
 	if (!hasVertexBuffer) {return;}
+
+	std::vector<uint32_t> slotMaterials(getNumberOfFaces());
+	for (const auto& range : mesh->materialRanges) {
+		auto first = slotMaterials.begin() + range.firstIndex / 3;
+		std::fill(first, first + range.indexCount / 3, range.materialID);
+	}
+	auto isDefault = [&](uint32_t face, const ObjFaceData& data) {
+		return data == ObjFaceData(slotMaterials[mesh->faceSlots[face]], 1.f, 1.f, glm::vec2(0.f));
+	};
+
+	for (uint32_t face = 0; face < faceData.size() && !hasFaceOverrides; face++) {
+		hasFaceOverrides = !isDefault(face, faceData[face]);
+	}
+	for (auto& kv : keyframes.objFaceData) {
+		if (hasFaceOverrides) {break;}
+		for (auto& frameData : kv.second) {
+			if (!isDefault(kv.first, frameData.second)) {hasFaceOverrides = true; break;}
+		}
+	}
+}
+
+void FestiModel::cullMeshlets(FS_ModelMap& gameObjects, const glm::mat4& projectionView, const glm::vec3& cameraPosition) {
+	for (auto& kv : gameObjects) {
+		auto& obj = kv.second;
+		obj->meshletsCulled = false;
+		if (!obj->mesh || obj->mesh->lods.empty() || obj->hasFaceOverrides || obj->instanceCount != 1 || obj->asInstanceData.parentObject) {continue;}
+
+		// Culling happens in model space, so the meshlet bounds never need transforming
+		const glm::mat4 modelMatrix = obj->transform.getModelMatrix();
+		glm::vec4 planes[6];
+		extractFrustumPlanes(projectionView * modelMatrix, planes);
+		const glm::vec3 camera = glm::vec3(glm::inverse(modelMatrix) * glm::vec4(cameraPosition, 1.f));
+		// Back faces of a closed mesh are only hidden from outside it
+		const bool cullBackfaces = obj->mesh->closedOrientation != 0.f && glm::length(camera - obj->mesh->boundsCentre) > obj->mesh->boundsRadius;
+
+		const MeshLod& lod = obj->mesh->lods[obj->currentLod];
+		festi::cullMeshlets(lod.meshlets, planes, camera, cullBackfaces, obj->meshletVisibility);
+
+		// Consecutive visible meshlets of a range join into one draw
+		obj->visibleRanges.clear();
+		for (size_t r = 0; r < lod.ranges.size(); r++) {
+			bool extending = false;
+			for (uint32_t m = lod.rangeMeshlets[r]; m < lod.rangeMeshlets[r + 1]; m++) {
+				if (!obj->meshletVisibility[m]) {
+					extending = false;
+					continue;
+				}
+				if (extending) {
+					obj->visibleRanges.back().indexCount += lod.meshlets.indexCount[m];
+				} else {
+					obj->visibleRanges.push_back({lod.meshlets.firstIndex[m], lod.meshlets.indexCount[m], lod.ranges[r].materialID});
+					extending = true;
+				}
+			}
+		}
+		obj->meshletsCulled = true;
+	}
+}
+
+void FestiMesh::uploadVertices(
+	FestiUploadBatch& uploads,
+	std::vector<glm::vec3>& positions,
+	std::vector<PackedVertexAttributes>& attributes) {
+	if (vertexCount == 0) {return;}
 	assert(vertexCount >= 3 && "Vertex count must be at least 3");
-	vertexBuffer = FestiBuffer::writeToLocalGPU(
-		(void*)vertices.data(), 
-		festiDevice, 
-		sizeof(vertices[0]), 
-		vertexCount, 
-		VK_BUFFER_USAGE_VERTEX_BUFFER_BIT);
-}
-
-void FestiModel::createIndexBuffer(const std::vector<uint32_t> &indices) {
-	indexCount = static_cast<uint32_t>(indices.size());
-	hasIndexBuffer = indexCount > 0;
-	if (!hasIndexBuffer) {return;}
-	indexBuffer = FestiBuffer::writeToLocalGPU(
-		(void*)indices.data(), 
-		festiDevice, 
-		sizeof(indices[0]), 
-		indexCount, 
-		VK_BUFFER_USAGE_INDEX_BUFFER_BIT);
+	// The CPU keeps full vertices for instancing and scripts, only the packed streams are uploaded
+	positions.resize(vertexCount);
+	attributes.resize(vertexCount);
+	for (uint32_t i = 0; i < vertexCount; i++) {
+		positions[i] = vertices[i].position;
+		attributes[i] = PackedVertexAttributes::pack(vertices[i]);
+	}
+	geometryArena->addUpload(uploads, geometry, FS_GeometryStream::POSITION, positions.data());
+	geometryArena->addUpload(uploads, geometry, FS_GeometryStream::ATTRIBUTE, attributes.data());
+}
+
+void FestiMesh::uploadIndices(FestiUploadBatch& uploads, std::vector<uint16_t>& shortIndices) {
+	if (drawIndices.empty()) {return;}
+	// Indices stay relative to the mesh's own vertices, so 16 bits still reach them all
+	if (indexType == VK_INDEX_TYPE_UINT16) {
+		shortIndices.assign(drawIndices.begin(), drawIndices.end());
+		geometryArena->addUpload(uploads, geometry, FS_GeometryStream::INDEX, shortIndices.data());
+		return;
+	}
+	geometryArena->addUpload(uploads, geometry, FS_GeometryStream::INDEX, drawIndices.data());
 }
 
 void FestiModel::createInstanceBuffer(uint32_t size) {
@@ -237,51 +695,95 @@ void FestiModel::createInstanceBuffer(uint32_t size) {
 		sizeof(Instance),
 		size,
 		VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
-		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+		FS_MemoryCategory::INSTANCE);
 }
 
 void FestiModel::writeToInstanceBuffer(const std::vector<Instance>& instances) {
 	instanceCount = (uint32_t)instances.size();
-	instanceBuffer->writeToBuffer((void*)instances.data(), instances.size() * sizeof(instances[0]));
+	if (instanceCount > 0) {instanceBuffer->writeToBuffer((void*)instances.data(), instances.size() * sizeof(instances[0]));}
+
+	// World space bounds of the instances, for LOD selection
+	std::vector<glm::vec4> spheres(instances.size());
+	glm::vec3 centre{0.f};
+	for (size_t i = 0; i < instances.size(); i++) {
+		const Instance& instance = instances[i];
+		const glm::mat4 modelMat{instance.modelMatColumn1, instance.modelMatColumn2, instance.modelMatColumn3, instance.modelMatColumn4};
+		const float scale = std::max({glm::length(glm::vec3(modelMat[0])), glm::length(glm::vec3(modelMat[1])), glm::length(glm::vec3(modelMat[2]))});
+		spheres[i] = glm::vec4(glm::vec3(modelMat * glm::vec4(mesh->boundsCentre, 1.f)), mesh->boundsRadius * scale);
+		centre += glm::vec3(spheres[i]);
+	}
+	instanceBoundsCentre = instances.empty() ? centre : centre / (float)instances.size();
+	instanceBoundsRadius = 0.f;
+	instanceRadius = 0.f;
+	for (const auto& sphere : spheres) {
+		instanceBoundsRadius = std::max(instanceBoundsRadius, glm::length(glm::vec3(sphere) - instanceBoundsCentre) + sphere.w);
+		instanceRadius = std::max(instanceRadius, sphere.w);
+	}
+}
+
+uint32_t FestiModel::getInstanceBufferSize() {
+	// Parents still loading have no surface yet and count as none
+	uint32_t instanceBufferSize = 1;
+	for (auto& kv : keyframes.asInstanceData) {
+		auto& KFasInstanceData = kv.second;
+		if (!KFasInstanceData.parentObject) {continue;}
+		const auto& scale = KFasInstanceData.parentObject->transform.scale;
+		uint32_t KFInstancesCount = 
+			static_cast<uint32_t>(KFasInstanceData.random.density * KFasInstanceData.parentObject->getShapeArea() / glm::dot(scale, scale)) 
+				+ ((KFasInstanceData.building.strutsPerColumnRange[1] + 1) * (KFasInstanceData.building.columnDensity + 1))
+				 * KFasInstanceData.parentObject->getNumberOfFaces() * KFasInstanceData.layers;
+		if (instanceBufferSize < KFInstancesCount) instanceBufferSize = KFInstancesCount;
+	}
+	return instanceBufferSize;
 }
 
 void FestiModel::setInstanceBufferSizesOnGameObjects(FS_ModelMap& gameObjects) {
 	for (auto& kv : gameObjects) {
-		uint32_t instanceBufferSize = 1;
 		auto& obj = kv.second;
-		for (auto& kv : obj->keyframes.asInstanceData) {
-			auto& KFasInstanceData = kv.second;
-			if (!KFasInstanceData.parentObject) {continue;}
-			const auto& scale = KFasInstanceData.parentObject->transform.scale;
-			uint32_t KFInstancesCount = 
-				static_cast<uint32_t>(KFasInstanceData.random.density * KFasInstanceData.parentObject->getShapeArea() / glm::dot(scale, scale)) 
-					+ ((KFasInstanceData.building.strutsPerColumnRange[1] + 1) * (KFasInstanceData.building.columnDensity + 1))
-					 * KFasInstanceData.parentObject->getNumberOfFaces() * KFasInstanceData.layers;
-			if (instanceBufferSize < KFInstancesCount) instanceBufferSize = KFInstancesCount;
-		}
-		obj->createInstanceBuffer(instanceBufferSize);
+		obj->createInstanceBuffer(obj->getInstanceBufferSize());
+	}
+}
+
+void FestiModel::updateInstances() {
+	if (instanceBuffer == nullptr) {return;}
+	const auto& parent = asInstanceData.parentObject;
+	if (!parent) {
+		writeToInstanceBuffer(std::vector<Instance>(1, {transform.getModelMatrix(), transform.getNormalMatrix()}));
+	} else if (parent->isResident()) {
+		writeToInstanceBuffer(parent->getTransformsToPointsOnSurface(asInstanceData, transform));
+	} else {
+		// Instances over a parent still loading appear once it's resident
+		writeToInstanceBuffer({});
 	}
 }
 
 void FestiModel::draw(VkCommandBuffer commandBuffer) {
 	if (instanceBuffer == nullptr) { return; }
+	const FestiMeshGeometry& geometry = mesh->geometry;
 	if (hasIndexBuffer) {
-		vkCmdDrawIndexed(commandBuffer, indexCount, instanceCount, 0, 0, 0);
+		const MeshLod& lod = mesh->lods[hasFaceOverrides ? 0 : currentLod];
+		vkCmdDrawIndexed(commandBuffer, lod.indexCount, instanceCount, 
+			geometry.indices.first + lod.firstIndex, (int32_t)geometry.vertices.first, 0);
 	} else {
-		vkCmdDraw(commandBuffer, vertexCount, instanceCount, 0, 0);
+		vkCmdDraw(commandBuffer, mesh->vertexCount, instanceCount, geometry.vertices.first, 0);
 	}
 }
 
-void FestiModel::bind(VkCommandBuffer commandBuffer) {
+void FestiModel::draw(VkCommandBuffer commandBuffer, const MaterialRange& range) {
 	if (instanceBuffer == nullptr) { return; }
-	VkBuffer buffers[] = {vertexBuffer->getBuffer(), instanceBuffer->getBuffer()};
-	VkDeviceSize offsets[2] = {0};
-	if (instanceBuffer->getBufferSize() == 0) { return; }
-	vkCmdBindVertexBuffers(commandBuffer, 0, 2, buffers, offsets);
+	const FestiMeshGeometry& geometry = mesh->geometry;
+	vkCmdDrawIndexed(commandBuffer, range.indexCount, instanceCount, 
+		geometry.indices.first + range.firstIndex, (int32_t)geometry.vertices.first, 0);
+}
 
-	if (hasIndexBuffer) {
-		vkCmdBindIndexBuffer(commandBuffer, indexBuffer->getBuffer(), 0, VK_INDEX_TYPE_UINT32);
-	}
+// Bindings: 0 positions, 1 instances, 2 packed attributes
+bool FestiModel::bind(VkCommandBuffer commandBuffer) {
+	if (instanceBuffer == nullptr || instanceBuffer->getBufferSize() == 0) { return false; }
+	VkBuffer buffer = instanceBuffer->getBuffer();
+	VkDeviceSize offset = 0;
+	vkCmdBindVertexBuffers(commandBuffer, 1, 1, &buffer, &offset);
+	return true;
 }
 
 glm::mat4 Transform::getModelMatrix() {
@@ -359,7 +861,9 @@ void FestiModel::insertKeyframe(uint32_t frame, uint32_t flags, std::vector<uint
         keyframes.inMotion.insert(frame);
     }
 
-    if (flags & FS_KEYFRAME_FACE_MATERIALS) {
+    if ((flags & FS_KEYFRAME_FACE_MATERIALS) && !isResident()) {
+        pendingFaceEdits.push_back({frame, ObjFaceData(), faceIDs});
+    } else if (flags & FS_KEYFRAME_FACE_MATERIALS) {
         int numberOfFaces = getNumberOfFaces();
         if (!hasVertexBuffer) throw std::runtime_error("Cannot keyframe material data on object with no materials");
         if (std::any_of(faceIDs.begin(), faceIDs.end(), [numberOfFaces](int x) {return x >= numberOfFaces;})) {
@@ -370,10 +874,11 @@ void FestiModel::insertKeyframe(uint32_t frame, uint32_t flags, std::vector<uint
             keyframes.objFaceData[id][frame] = faceData[id];
             keyframes.modifiedFaces.insert(id);
         }
+        resolveFaceOverrides();
     }
 
     if (flags & FS_KEYFRAME_AS_INSTANCE) {
-		if (!hasVertexBuffer) throw std::runtime_error("Cannot keyframe models that don't have vertices");
+		if (isResident() && !hasVertexBuffer) throw std::runtime_error("Cannot keyframe models that don't have vertices");
 		if (asInstanceData.random.randomness <= 0) throw std::runtime_error("Randomness must be positive");
 		if (asInstanceData.random.solidity <= 0 || asInstanceData.random.solidity > 1) throw std::runtime_error("Solidity must be 0 < s <= 1");
         keyframes.asInstanceData[frame] = asInstanceData;
@@ -407,31 +912,74 @@ void FestiWorld::insertKeyframe(uint32_t frame, uint32_t flags) {
 void FestiModel::setFaces(ObjFaceData& data, std::vector<uint32_t> faces) {
 
 	if (faces.empty()) throw std::runtime_error("Need to specifiy atleast one face in setFaces");
+	if (!isResident()) {
+		pendingFaceEdits.push_back({FS_UNSPECIFIED, data, faces});
+		return;
+	}
 	if (faces[0] == FS_UNSPECIFIED) {
 		std::fill(faceData.begin(), faceData.end(), data);
-		return;
+	} else {
+		int numberOfFaces = getNumberOfFaces();
+		if (std::any_of(faces.begin(), faces.end(), [numberOfFaces](int x) {return x >= numberOfFaces;})) {
+			throw std::runtime_error("Cannot set a faceID that does not exist");
+		}
+		for (const auto& face : faces) {
+			faceData[face] = data;
+		}
 	}
 
-	int numberOfFaces = getNumberOfFaces();
-	if (std::any_of(faces.begin(), faces.end(), [numberOfFaces](int x) {return x >= numberOfFaces;})) {
-        throw std::runtime_error("Cannot set a faceID that does not exist");
-    }
+	faceDataChanged = true;
+	resolveFaceOverrides();
+}
+
+namespace {
 
-	for (const auto& face : faces) {
-		faceData[face] = data;
+// Octahedral mapping of a unit vector onto [-1, 1]^2
+glm::vec2 octEncode(glm::vec3 v) {
+	v /= std::abs(v.x) + std::abs(v.y) + std::abs(v.z);
+	glm::vec2 p = {v.x, v.y};
+	if (v.z < 0.f) {
+		p = {(1.f - std::abs(v.y)) * (v.x >= 0.f ? 1.f : -1.f), (1.f - std::abs(v.x)) * (v.y >= 0.f ? 1.f : -1.f)};
 	}
+	return p;
+}
 
+int16_t toSnorm16(float value) {
+	return static_cast<int16_t>(std::round(std::clamp(value, -1.f, 1.f) * 32767.f));
+}
 
-	// faceData[45] = data;
+bool isUnitVector(const glm::vec3& v) {
+	return std::isfinite(v.x) && std::isfinite(v.y) && std::isfinite(v.z) && (v.x != 0.f || v.y != 0.f || v.z != 0.f);
+}
+
+} // namespace
+
+PackedVertexAttributes PackedVertexAttributes::pack(const Vertex& vertex) {
+	PackedVertexAttributes packed;
+	packed.uv = vertex.uv;
+
+	// Degenerate UVs leave NaN tangents, those fall back to an arbitrary axis
+	const glm::vec3 normal = isUnitVector(vertex.normal) ? vertex.normal : glm::vec3(0.f, 1.f, 0.f);
+	const glm::vec3 tangent = isUnitVector(vertex.tangent) ? vertex.tangent : glm::vec3(1.f, 0.f, 0.f);
+	const glm::vec2 n = octEncode(normal);
+	packed.normal[0] = toSnorm16(n.x);
+	packed.normal[1] = toSnorm16(n.y);
+
+	// The tangent's y is remapped to [0, 1] and signed by the handedness, so the shader rebuilds the
+	// bitangent as cross(normal, tangent) * sign. The magnitude never reaches 0 so the sign survives
+	const float sign = glm::dot(glm::cross(normal, tangent), vertex.bitangent) < 0.f ? -1.f : 1.f;
+	const glm::vec2 t = octEncode(tangent);
+	packed.tangent[0] = toSnorm16(t.x);
+	packed.tangent[1] = toSnorm16(sign * std::max(t.y * .5f + .5f, 1.f / 32767.f));
+	return packed;
 }
 
 std::vector<VkVertexInputAttributeDescription> Vertex::getAttributeDescriptions() {
 	std::vector<VkVertexInputAttributeDescription> attributeDescriptions;
-	attributeDescriptions.push_back({0, 0, VK_FORMAT_R32G32B32_SFLOAT, offsetof(Vertex, position)});
-	attributeDescriptions.push_back({1, 0, VK_FORMAT_R32G32B32_SFLOAT, offsetof(Vertex, normal)});
-	attributeDescriptions.push_back({2, 0, VK_FORMAT_R32G32B32_SFLOAT, offsetof(Vertex, tangent)});
-	attributeDescriptions.push_back({3, 0, VK_FORMAT_R32G32B32_SFLOAT, offsetof(Vertex, bitangent)});
-	attributeDescriptions.push_back({4, 0, VK_FORMAT_R32G32_SFLOAT   , offsetof(Vertex, uv)});
+	attributeDescriptions.push_back({0, 0, VK_FORMAT_R32G32B32_SFLOAT, 0});
+	attributeDescriptions.push_back({1, 2, VK_FORMAT_R16G16_SNORM    , offsetof(PackedVertexAttributes, normal)});
+	attributeDescriptions.push_back({2, 2, VK_FORMAT_R16G16_SNORM    , offsetof(PackedVertexAttributes, tangent)});
+	attributeDescriptions.push_back({3, 2, VK_FORMAT_R32G32_SFLOAT   , offsetof(PackedVertexAttributes, uv)});
 
 	attributeDescriptions.push_back({5,  1, VK_FORMAT_R32G32B32A32_SFLOAT, offsetof(Instance, modelMatColumn1)});
 	attributeDescriptions.push_back({6,  1, VK_FORMAT_R32G32B32A32_SFLOAT, offsetof(Instance, modelMatColumn2)});
@@ -445,8 +993,9 @@ std::vector<VkVertexInputAttributeDescription> Vertex::getAttributeDescriptions(
 
 std::vector<VkVertexInputBindingDescription> Vertex::getBindingDescriptions() {
 	std::vector<VkVertexInputBindingDescription> bindingDescriptions;
-	bindingDescriptions.push_back({0, sizeof(Vertex), VK_VERTEX_INPUT_RATE_VERTEX});
+	bindingDescriptions.push_back({0, sizeof(glm::vec3), VK_VERTEX_INPUT_RATE_VERTEX});
 	bindingDescriptions.push_back({1, sizeof(Instance), VK_VERTEX_INPUT_RATE_INSTANCE});
+	bindingDescriptions.push_back({2, sizeof(PackedVertexAttributes), VK_VERTEX_INPUT_RATE_VERTEX});
 	return bindingDescriptions;
 }
 
@@ -460,6 +1009,8 @@ std::vector<Instance> FestiModel::getTransformsToPointsOnSurface(const AsInstanc
 	Transform& parentTransform = transform;
 	const glm::mat4& parentModelMatrix = parentTransform.getModelMatrix();
 	const glm::vec3 up = glm::normalize(parentTransform.getNormalMatrix() * glm::vec4(keyframe.parentObject->facing, 1.f));
+	const auto& vertices = mesh->vertices;
+	const auto& indices = mesh->indices;
 
 	for (size_t layer = 0; layer < keyframe.layers; ++layer) {
 		for (size_t i = 0; i < indices.size(); i += 3) {
@@ -698,27 +1249,30 @@ void FestiModel::setObjectToCurrentKeyFrame(uint32_t MssboOffset, std::unique_pt
     auto posRotScaleKF = getKeyframeForFrame(frame, keyframes.transforms);
     bool hasMoved = updatePropertyIfNeeded(transform, posRotScaleKF->second, atEndOrStart);
 
-    // Update face data
-    for (auto& faceID : keyframes.modifiedFaces) {
-        auto materialKF = getKeyframeForFrame(frame, keyframes.objFaceData[faceID]);
-        updatePropertyIfNeeded(faceData[faceID], materialKF->second, atEndOrStart);
+    // Update face data, writing to the buffer only the faces that changed. Models drawn per
+    // material range never read their face data on the GPU
+    if (hasFaceOverrides && faceDataChanged) {
+        // Edits made while drawn per material range were never uploaded
+        std::vector<ObjFaceData> slotData(faceData.size());
+        for (size_t face = 0; face < faceData.size(); face++) {slotData[mesh->faceSlots[face]] = faceData[face];}
+        MssboBuffer->writeToBuffer(slotData.data(), slotData.size() * sizeof(ObjFaceData), MssboOffset * sizeof(ObjFaceData));
+        faceDataChanged = false;
+    }
+    if (hasFaceOverrides) {
+        for (auto& faceID : keyframes.modifiedFaces) {
+            auto materialKF = getKeyframeForFrame(frame, keyframes.objFaceData[faceID]);
+            if (updatePropertyIfNeeded(faceData[faceID], materialKF->second, atEndOrStart)) {
+                auto offset = (MssboOffset + mesh->faceSlots[faceID]) * sizeof(ObjFaceData);
+                MssboBuffer->writeToBuffer(&faceData[faceID], sizeof(ObjFaceData), offset);
+            }
+        }
     }
-
-    // Write to buffer if any face data has changed
-    auto data = faceData.data();
-    auto size = faceData.size() * sizeof(ObjFaceData);
-    auto offset = MssboOffset * sizeof(ObjFaceData);
-    MssboBuffer->writeToBuffer(data, size, offset);
 
     // Update asInstanceData if needed
     auto asInstKF = getKeyframeForFrame(frame, keyframes.asInstanceData);
     bool parentHasMoved = asInstanceData.parentObject ? asInstanceData.parentObject->keyframes.inMotion.count(frame) : false;
     if (updatePropertyIfNeeded(asInstanceData, asInstKF->second, hasMoved || parentHasMoved || atEndOrStart)) {
-        if (asInstKF->second.parentObject) {
-            writeToInstanceBuffer(asInstKF->second.parentObject->getTransformsToPointsOnSurface(asInstKF->second, transform));
-        } else {
-            writeToInstanceBuffer(std::vector<Instance>(1, {transform.getModelMatrix(), transform.getNormalMatrix()}));
-        }
+        updateInstances();
     }
 }
 
@@ -1,7 +1,9 @@
 #pragma once
 
 #include "buffer.hpp"
+#include "geometry_arena.hpp"
 #include "materials.hpp"
+#include "meshlets.hpp"
 
 // lib
 #define GLM_FORCE_RADIANS
@@ -52,6 +54,20 @@ struct Vertex {
 			&& uv == other.uv && tangent == other.tangent && bitangent == other.bitangent;}
 };
 
+// GPU layout of Vertex, split into two streams so depth-only passes fetch 12 bytes a vertex: positions as
+// plain vec3s, and these 16 bytes of everything else (28 in total against 56). Normal and tangent are
+// octahedral encoded to snorm16x2, the tangent's second component also carries the bitangent sign (see
+// PackedVertexAttributes::pack). UVs stay 32 bit float, meshes here tile them far past the range where
+// half floats keep texel precision
+struct PackedVertexAttributes {
+    int16_t normal[2];
+    int16_t tangent[2];
+    glm::vec2 uv;
+
+    static PackedVertexAttributes pack(const Vertex& vertex);
+};
+static_assert(sizeof(PackedVertexAttributes) == 16, "PackedVertexAttributes must match the vertex input layout");
+
 struct Instance {
 	glm::vec4 modelMatColumn1;
 	glm::vec4 modelMatColumn2;
@@ -107,6 +123,86 @@ struct Transform {
 
 };
 
+constexpr size_t FS_TANGENT_BATCH_SIZE = 16384; // triangles or vertices per parallel batch when building tangents
+
+struct MeshData;
+struct LodMesh;
+class FestiUploadBatch;
+
+struct MaterialRange {
+    uint32_t firstIndex;
+    uint32_t indexCount;
+    uint32_t materialID;
+    float texelDensity = 0.f; // sqrt(uv area / model space area), how much texture one unit of surface covers
+};
+
+constexpr float FS_LOD_PIXEL_ERROR = 1.f; // the coarsest LOD whose error projects below this many pixels is drawn
+
+// A contiguous run of the index buffer drawing the whole model at one level of detail. LOD 0 is the full
+// resolution mesh, coarser LODs follow it in the buffer and share its vertices
+struct MeshLod {
+    uint32_t firstIndex;
+    uint32_t indexCount;
+    float relativeError; // simplification error over the bounding sphere radius
+    std::vector<MaterialRange> ranges;
+    MeshletSet meshlets;
+    std::vector<uint32_t> rangeMeshlets; // first meshlet of each range, then the meshlet count
+};
+
+// Geometry built from one OBJ: its vertices and indices with everything derived from them. Immutable once
+// uploaded, so every model loaded from the same file shares one (see FestiModel::createModelFromFile). On the GPU
+// it's a range of the device's geometry arena
+class FestiMesh {
+public:
+    // Builds everything derived from the mesh on the CPU, so it can run on a worker thread. Faces keep the
+    // OBJ's own material indices until resolveMaterials
+    explicit FestiMesh(MeshData& mesh);
+    ~FestiMesh();
+
+    FestiMesh(const FestiMesh&) = delete;
+    FestiMesh &operator=(const FestiMesh&) = delete;
+
+    // Maps the OBJ's material indices to global material IDs
+    void resolveMaterials(const std::vector<uint32_t>& materialIDs);
+    // Allocates the mesh's ranges of the geometry arena and submits their contents. The mesh can be drawn once
+    // the returned batch completes
+    std::unique_ptr<FestiUploadBatch> upload(FestiDevice& device);
+
+    std::vector<Vertex> vertices;
+    std::vector<uint32_t> indices; // by face ID
+    std::vector<ObjFaceData> faceData; // per-material defaults each model starts from
+    float shapeArea = 0.f;
+
+	FestiMeshGeometry geometry; // LOD, range and meshlet first indices are relative to geometry.indices.first
+	uint32_t vertexCount = 0;
+	uint32_t indexCount = 0; // full resolution faces, coarser LODs follow them in the buffer
+	VkIndexType indexType = VK_INDEX_TYPE_UINT32; // UINT16 when every vertex is reachable with 16 bits
+
+    // faces are uploaded sorted by material; faceSlots maps a face ID to its position on the GPU
+    std::vector<MaterialRange> materialRanges;
+    std::vector<uint32_t> faceSlots;
+    std::vector<uint32_t> faceOrder; // optimised draw rank of each face within its material
+
+    std::vector<MeshLod> lods;
+    glm::vec3 boundsCentre{0.f}; // model space
+    float boundsRadius = 0.f;
+    float closedOrientation = 0.f; // see closedMeshOrientation, backfacing meshlets are only culled when closed
+
+private:
+    void computeBounds();
+    void sortFacesByMaterial(std::vector<uint32_t>& sortedIndices);
+    void appendLods(const std::vector<LodMesh>& meshLods, size_t materialCount, std::vector<uint32_t>& sortedIndices);
+    void buildMeshlets(const std::vector<uint32_t>& sortedIndices);
+    void uploadVertices(
+        FestiUploadBatch& uploads,
+        std::vector<glm::vec3>& positions,
+        std::vector<PackedVertexAttributes>& attributes);
+	void uploadIndices(FestiUploadBatch& uploads, std::vector<uint16_t>& shortIndices);
+
+    std::vector<uint32_t> drawIndices; // index buffer contents, released once uploaded
+    FestiGeometryArena* geometryArena = nullptr; // set once uploaded
+};
+
 class FestiModel {
 
 template <typename T>
@@ -184,6 +280,21 @@ public:
         const std::string& filepath,
         const std::string& mtlDir,
         const std::string& imgDir);
+    // Returns straight away with a model that isn't drawn until updatePendingLoads makes it resident. The cache
+    // read or OBJ build and everything derived from the mesh run on the shared thread pool. Everything can be
+    // keyframed meanwhile, setFaces and face data keyframes are queued and replayed in order once it's resident
+    static std::shared_ptr<FestiModel> createModelFromFileAsync(
+        FestiDevice& device, 
+        FS_ModelMap& gameObjects,
+        const std::string& filepath,
+        const std::string& mtlDir,
+        const std::string& imgDir);
+    // Called once per frame after the frame's fence. Registers the materials of meshes whose CPU work has
+    // finished and submits their uploads, then makes models resident once their uploads and textures are in
+    static void updatePendingLoads(FestiMaterials& festiMaterials, FS_ModelMap& gameObjects, FestiBuffer& MssboBuffer);
+    // Drops loads still in flight. Called once the device is idle, before it's destroyed
+    static void cancelPendingLoads();
+    bool isResident() const {return mesh != nullptr;}
     
     void setObjectToCurrentKeyFrame(
         uint32_t MssboOffset, 
@@ -191,20 +302,47 @@ public:
         const uint32_t frame
     );
 
-    void bind(VkCommandBuffer commandBuffer);
+    // Binds the instance buffer only, the geometry arena's buffers are bound once per pass. False when there's
+    // nothing to draw
+    bool bind(VkCommandBuffer commandBuffer);
     void draw(VkCommandBuffer commandBuffer);
+    void draw(VkCommandBuffer commandBuffer, const MaterialRange& range);
 
     void insertKeyframe(uint32_t idx, uint32_t flags, std::vector<uint32_t> faceIDs = {0});
     void setFaces(ObjFaceData& data, std::vector<uint32_t> faces = {FS_UNSPECIFIED});
 
     uint32_t getId() {return id;}
     static uint32_t getMaterial(std::string name) {return materialNamesMap[name];}
-    uint32_t getNumberOfFaces() {return indexCount / 3;}
+    uint32_t getNumberOfFaces() {return mesh ? mesh->indexCount / 3 : 0;}
+    VkIndexType getIndexType() const {return mesh->geometry.indexType;}
     float& getShapeArea() {return shapeArea;}
-    std::vector<uint32_t> ALL_FACES() {std::vector<uint32_t> vec(indexCount / 3); std::iota(vec.begin(), vec.end(), 0); return vec;}
+    // While loading the face count isn't known yet, FS_UNSPECIFIED stands for every face until then
+    std::vector<uint32_t> ALL_FACES() {
+        if (!isResident()) {return {FS_UNSPECIFIED};}
+        std::vector<uint32_t> vec(getNumberOfFaces()); std::iota(vec.begin(), vec.end(), 0); return vec;
+    }
 
     std::vector<Instance> getTransformsToPointsOnSurface(const AsInstanceData& keyframe, Transform& childTransform);
 
+    // Models whose face data differs from the per-material defaults are drawn in one call
+    // and look their face data up per primitive; everything else is drawn per material range.
+    // Rerun by setFaces and face keyframes, so runtime edits can move a model onto the per face path
+    void resolveFaceOverrides();
+    bool usesPerFaceData() {return hasFaceOverrides;}
+    const std::vector<MaterialRange>& getMaterialRanges() {return mesh->materialRanges;}
+    const std::vector<uint32_t>& getFaceSlots() {return mesh->faceSlots;}
+
+    // Picks every model's LOD from the projected size of its bounding sphere. pixelsPerUnit is how many pixels
+    // one world unit covers at distance one
+    static void selectLods(FS_ModelMap& gameObjects, const glm::vec3& cameraPosition, float pixelsPerUnit);
+    // Culls the meshlets of each model's current LOD against the camera, merging the survivors into draw ranges.
+    // Only single instance models drawn per material range are culled
+    static void cullMeshlets(FS_ModelMap& gameObjects, const glm::mat4& projectionView, const glm::vec3& cameraPosition);
+    const std::vector<MaterialRange>& getDrawRanges() {
+        if (meshletsCulled) {return visibleRanges;}
+        return mesh->lods.empty() ? mesh->materialRanges : mesh->lods[currentLod].ranges;
+    }
+
     static void setInstanceBufferSizesOnGameObjects(FS_ModelMap& gameObjects);
     void writeToInstanceBuffer(const std::vector<Instance>& instances);
 
@@ -215,11 +353,30 @@ public:
     bool hasVertexBuffer = false;
     
 private:
+    struct PendingLoads;
+
     // helpers
+    static std::shared_ptr<const FestiMesh> loadMesh(
+        FestiDevice& device,
+        FestiMaterials& festiMaterials,
+        const std::string& filepath,
+        const std::string& mtlDirPath,
+        const std::string& imgDirPath);
+    static MeshData readOrBuildMesh(const std::string& filepath, const std::string& mtlDirPath);
+    static MeshData buildMeshFromObj(const std::string& filepath, const std::string& mtlDirPath);
+    static std::vector<uint32_t> registerMaterials(
+        FestiMaterials& festiMaterials,
+        std::vector<tinyobj::material_t>& materials,
+        const std::string& imgDirPath);
+    void makeResident(
+        std::shared_ptr<const FestiMesh> resident,
+        FestiMaterials& festiMaterials,
+        FS_ModelMap& gameObjects,
+        FestiBuffer& MssboBuffer);
     static void setTangentsBitangentsShapeArea(std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices, float& area);
-    void createVertexBuffer(const std::vector<Vertex>& vertices);
-	void createIndexBuffer(const std::vector<uint32_t>& indices);
     void createInstanceBuffer(uint32_t size);
+    uint32_t getInstanceBufferSize();
+    void updateInstances();
     void addRndInstance(	
         std::vector<Instance>& instanceMatrices,
         Transform instanceTransform, 
@@ -248,18 +405,35 @@ private:
     float shapeArea = 0;
     glm::vec3 facing = {0.f, 1.f, 0.f};
 
-	std::unique_ptr<FestiBuffer> vertexBuffer = nullptr;
-    std::vector<Vertex> vertices;
-	uint32_t vertexCount;
-
-	std::unique_ptr<FestiBuffer> indexBuffer = nullptr;
-    std::vector<uint32_t> indices;
-	uint32_t indexCount;
+    std::shared_ptr<const FestiMesh> mesh = nullptr;
+    bool hasFaceOverrides = false;
+    // Set by setFaces, the per material draw path never uploads face data so it's written once the model needs it
+    bool faceDataChanged = false;
+
+    // setFaces and face data keyframes made before the mesh is resident, replayed by makeResident
+    struct PendingFaceEdit {
+        uint32_t frame; // FS_UNSPECIFIED for setFaces
+        ObjFaceData data; // setFaces only, keyframes take the face data current at replay
+        std::vector<uint32_t> faces;
+    };
+    std::vector<PendingFaceEdit> pendingFaceEdits;
+
+    // Models with face overrides always draw LOD 0, their face data is looked up per full resolution primitive
+    uint32_t currentLod = 0;
+    glm::vec3 instanceBoundsCentre{0.f}; // world space sphere around every instance's bounding sphere
+    float instanceBoundsRadius = 0.f;
+    float instanceRadius = 0.f; // the largest instance's bounding sphere
+
+    bool meshletsCulled = false;
+    std::vector<uint8_t> meshletVisibility;
+    std::vector<MaterialRange> visibleRanges;
 
     std::unique_ptr<FestiBuffer> instanceBuffer = nullptr;
     uint32_t instanceCount;
 
     static std::unordered_map<std::string, uint32_t> materialNamesMap;
+    static std::unordered_map<std::string, std::weak_ptr<const FestiMesh>> meshRegistry; // by OBJ and MTL directory
+    static PendingLoads pendingLoads;
 
     friend class FestiMaterials;
 };
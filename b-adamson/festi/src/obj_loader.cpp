@@ -0,0 +1,395 @@
+#include "obj_loader.hpp"
+
+#include "mapped_file.hpp"
+#include "thread_pool.hpp"
+
+// std
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+
+namespace festi {
+
+namespace {
+
+enum class ObjLine {VERTEX, TEXCOORD, NORMAL, FACE, OBJECT, GROUP, USE_MATERIAL, MATERIAL_LIBRARY, OTHER};
+
+// State changes, replayed in file order when the chunks are merged
+struct ObjEvent {
+    ObjLine type;
+    std::string name;
+    size_t faceOffset; // triangles parsed earlier in the same chunk
+};
+
+struct ObjChunk {
+    const char* begin;
+    const char* end;
+    // Attributes in the chunk, and after the first pass the attributes in all chunks before it
+    size_t vertexCount = 0;
+    size_t texcoordCount = 0;
+    size_t normalCount = 0;
+    size_t vertexBase = 0;
+    size_t texcoordBase = 0;
+    size_t normalBase = 0;
+    std::vector<tinyobj::index_t> indices;
+    std::vector<ObjEvent> events;
+};
+
+inline bool isSpace(char c) {return c == ' ' || c == '\t';}
+inline bool isDigit(char c) {return c >= '0' && c <= '9';}
+
+inline const char* skipSpace(const char* p, const char* end) {
+    while (p < end && isSpace(*p)) {p++;}
+    return p;
+}
+
+inline const char* lineEnd(const char* p, const char* end) {
+    const void* newline = std::memchr(p, '\n', end - p);
+    return newline ? static_cast<const char*>(newline) : end;
+}
+
+inline bool hasKeyword(const char* p, const char* end, const char* keyword, size_t length) {
+    return (size_t)(end - p) > length && std::memcmp(p, keyword, length) == 0 && isSpace(p[length]);
+}
+
+// Both passes classify lines here so the attribute counts of the first match the writes of the second.
+// rest is left just past the keyword
+ObjLine classifyLine(const char* p, const char* end, const char*& rest) {
+    p = skipSpace(p, end);
+    rest = p;
+    if (p == end) {return ObjLine::OTHER;}
+    switch (*p) {
+    case 'v':
+        if (hasKeyword(p, end, "v", 1)) {rest = p + 1; return ObjLine::VERTEX;}
+        if (hasKeyword(p, end, "vt", 2)) {rest = p + 2; return ObjLine::TEXCOORD;}
+        if (hasKeyword(p, end, "vn", 2)) {rest = p + 2; return ObjLine::NORMAL;}
+        break;
+    case 'f':
+        if (hasKeyword(p, end, "f", 1)) {rest = p + 1; return ObjLine::FACE;}
+        break;
+    case 'o':
+        if (hasKeyword(p, end, "o", 1)) {rest = p + 1; return ObjLine::OBJECT;}
+        break;
+    case 'g':
+        if (hasKeyword(p, end, "g", 1)) {rest = p + 1; return ObjLine::GROUP;}
+        break;
+    case 'u':
+        if (hasKeyword(p, end, "usemtl", 6)) {rest = p + 6; return ObjLine::USE_MATERIAL;}
+        break;
+    case 'm':
+        if (hasKeyword(p, end, "mtllib", 6)) {rest = p + 6; return ObjLine::MATERIAL_LIBRARY;}
+        break;
+    }
+    return ObjLine::OTHER;
+}
+
+// [sign] digits [. digits] [e [sign] digits], which covers what exporters write. Accumulates up to 19
+// significant digits and scales once, so results can differ from strtod in the last bit of a float at most
+const char* parseFloat(const char* p, const char* end, float& value) {
+    static constexpr double powersOf10[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+    p = skipSpace(p, end);
+    const char* start = p;
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+')) {negative = *p == '-'; p++;}
+
+    uint64_t mantissa = 0;
+    int exponent = 0;
+    int significantDigits = 0;
+    const char* digitsStart = p;
+    for (; p < end && isDigit(*p); p++) {
+        if (significantDigits < 19) {
+            mantissa = mantissa * 10 + (*p - '0');
+            significantDigits += mantissa != 0;
+        } else {
+            exponent++;
+        }
+    }
+    if (p < end && *p == '.') {
+        for (p++; p < end && isDigit(*p); p++) {
+            if (significantDigits < 19) {
+                mantissa = mantissa * 10 + (*p - '0');
+                significantDigits += mantissa != 0;
+                exponent--;
+            }
+        }
+    }
+    if (p == digitsStart || (p == digitsStart + 1 && *digitsStart == '.')) {return start;}
+
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        p++;
+        bool negativeExponent = false;
+        if (p < end && (*p == '-' || *p == '+')) {negativeExponent = *p == '-'; p++;}
+        int e = 0;
+        for (; p < end && isDigit(*p); p++) {
+            if (e < 1000) {e = e * 10 + (*p - '0');}
+        }
+        exponent += negativeExponent ? -e : e;
+    }
+
+    double result = (double)mantissa;
+    while (exponent > 22) {result *= 1e22; exponent -= 22;}
+    while (exponent < -22) {result /= 1e22; exponent += 22;}
+    result = exponent < 0 ? result / powersOf10[-exponent] : result * powersOf10[exponent];
+    value = (float)(negative ? -result : result);
+    return p;
+}
+
+const char* parseInt(const char* p, const char* end, int& value) {
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+')) {negative = *p == '-'; p++;}
+    const char* digitsStart = p;
+    int result = 0;
+    for (; p < end && isDigit(*p); p++) {result = result * 10 + (*p - '0');}
+    if (p == digitsStart) {return nullptr;}
+    value = negative ? -result : result;
+    return p;
+}
+
+// OBJ indices are 1 based, or relative to the attributes read so far when negative
+inline int resolveIndex(int index, size_t count) {
+    if (index == 0 || (index < 0 && (size_t)-index > count)) {
+        throw std::runtime_error("failed to parse obj, face index out of range");
+    }
+    return index > 0 ? index - 1 : (int)count + index;
+}
+
+// v, v/vt, v//vn or v/vt/vn
+const char* parseFaceVertex(
+    const char* p, const char* end, size_t vertexCount, size_t texcoordCount, size_t normalCount, tinyobj::index_t& index) {
+    index = {-1, -1, -1};
+    int value;
+    if (!(p = parseInt(p, end, value))) {return nullptr;}
+    index.vertex_index = resolveIndex(value, vertexCount);
+    if (p == end || *p != '/') {return p;}
+    p++;
+    if (p < end && *p != '/') {
+        if (!(p = parseInt(p, end, value))) {return nullptr;}
+        index.texcoord_index = resolveIndex(value, texcoordCount);
+    }
+    if (p == end || *p != '/') {return p;}
+    p++;
+    if (!(p = parseInt(p, end, value))) {return nullptr;}
+    index.normal_index = resolveIndex(value, normalCount);
+    return p;
+}
+
+std::string parseName(const char* p, const char* end) {
+    p = skipSpace(p, end);
+    while (end > p && (isSpace(end[-1]) || end[-1] == '\r')) {end--;}
+    return std::string(p, end);
+}
+
+void countChunk(ObjChunk& chunk) {
+    for (const char* line = chunk.begin; line < chunk.end;) {
+        const char* end = lineEnd(line, chunk.end);
+        const char* rest;
+        switch (classifyLine(line, end, rest)) {
+        case ObjLine::VERTEX: chunk.vertexCount++; break;
+        case ObjLine::TEXCOORD: chunk.texcoordCount++; break;
+        case ObjLine::NORMAL: chunk.normalCount++; break;
+        default: break;
+        }
+        line = end + 1;
+    }
+}
+
+// Attributes are written straight into their final place in attrib, faces and events stay in the chunk
+void parseChunk(ObjChunk& chunk, tinyobj::attrib_t& attrib) {
+    size_t vertexCount = chunk.vertexBase;
+    size_t texcoordCount = chunk.texcoordBase;
+    size_t normalCount = chunk.normalBase;
+    std::vector<tinyobj::index_t> polygon;
+
+    for (const char* line = chunk.begin; line < chunk.end;) {
+        const char* end = lineEnd(line, chunk.end);
+        const char* p;
+        const ObjLine type = classifyLine(line, end, p);
+        switch (type) {
+        case ObjLine::VERTEX: {
+            // Trailing vertex colours are ignored
+            float* v = &attrib.vertices[3 * vertexCount++];
+            for (int i = 0; i < 3; i++) {
+                const char* next = parseFloat(p, end, v[i]);
+                if (next == p) {throw std::runtime_error("failed to parse obj vertex");}
+                p = next;
+            }
+            break;
+        }
+        case ObjLine::TEXCOORD: {
+            float* vt = &attrib.texcoords[2 * texcoordCount++];
+            const char* next = parseFloat(p, end, vt[0]);
+            if (next == p) {throw std::runtime_error("failed to parse obj texcoord");}
+            if (parseFloat(next, end, vt[1]) == next) {vt[1] = 0.f;}
+            break;
+        }
+        case ObjLine::NORMAL: {
+            float* vn = &attrib.normals[3 * normalCount++];
+            for (int i = 0; i < 3; i++) {
+                const char* next = parseFloat(p, end, vn[i]);
+                if (next == p) {throw std::runtime_error("failed to parse obj normal");}
+                p = next;
+            }
+            break;
+        }
+        case ObjLine::FACE: {
+            polygon.clear();
+            for (p = skipSpace(p, end); p < end && *p != '\r'; p = skipSpace(p, end)) {
+                tinyobj::index_t index;
+                if (!(p = parseFaceVertex(p, end, vertexCount, texcoordCount, normalCount, index))) {
+                    throw std::runtime_error("failed to parse obj face");
+                }
+                polygon.push_back(index);
+            }
+            // Polygons are fanned from their first vertex
+            for (size_t i = 2; i < polygon.size(); i++) {
+                chunk.indices.push_back(polygon[0]);
+                chunk.indices.push_back(polygon[i - 1]);
+                chunk.indices.push_back(polygon[i]);
+            }
+            break;
+        }
+        case ObjLine::OBJECT:
+        case ObjLine::GROUP:
+        case ObjLine::USE_MATERIAL:
+        case ObjLine::MATERIAL_LIBRARY:
+            chunk.events.push_back({type, parseName(p, end), chunk.indices.size() / 3});
+            break;
+        case ObjLine::OTHER:
+            break;
+        }
+        line = end + 1;
+    }
+}
+
+void loadMaterialLibrary(
+    const std::string& mtlDirPath,
+    const std::string& fileNames,
+    ObjData& obj,
+    std::map<std::string, int>& materialMap) {
+    // mtllib may list several files, like tinyobj the first one that opens is used
+    std::istringstream names(fileNames);
+    std::string name;
+    while (names >> name) {
+        std::string path = mtlDirPath;
+        if (!path.empty() && path.back() != '/' && path.back() != '\\') {path += '/';}
+        std::ifstream mtlFile(path + name);
+        if (!mtlFile) {continue;}
+        std::string warn, err;
+        tinyobj::LoadMtl(&materialMap, &obj.materials, &mtlFile, &warn, &err);
+        if (!err.empty()) {throw std::runtime_error("failed to load material library " + name + ": " + err);}
+        obj.materialLibraries.push_back(path + name);
+        return;
+    }
+    std::cerr << "Failed to open material library: " << fileNames << "\n";
+}
+
+} // namespace
+
+ObjData loadObj(const std::string& filePath, const std::string& mtlDirPath) {
+    const auto start = std::chrono::high_resolution_clock::now();
+
+    FestiMappedFile file(filePath);
+    if (!file.valid()) {
+        throw std::runtime_error("failed to open obj file: " + filePath);
+    }
+    const char* data = reinterpret_cast<const char*>(file.data());
+    const char* dataEnd = data + file.size();
+
+    // Split into one chunk per worker, each ending just after a newline
+    auto& pool = FestiThreadPool::shared();
+    const size_t chunkCount = std::max<size_t>(1, std::min<size_t>(pool.size(), file.size() / FS_OBJ_MIN_CHUNK_SIZE));
+    std::vector<ObjChunk> chunks;
+    chunks.reserve(chunkCount);
+    for (const char* chunkStart = data; chunkStart < dataEnd;) {
+        const char* chunkEnd = dataEnd;
+        if (chunks.size() + 1 < chunkCount) {
+            chunkEnd = std::min(dataEnd, chunkStart + file.size() / chunkCount);
+            chunkEnd = lineEnd(chunkEnd, dataEnd);
+            chunkEnd = std::min(dataEnd, chunkEnd + 1);
+        }
+        chunks.emplace_back();
+        chunks.back().begin = chunkStart;
+        chunks.back().end = chunkEnd;
+        chunkStart = chunkEnd;
+    }
+
+    // parallelFor rather than waiting on futures, so loads running on the pool themselves can't deadlock it
+    auto forEachChunk = [&](auto&& task) {
+        pool.parallelFor(chunks.size(), 1, [&](size_t first, size_t last) {
+            for (size_t i = first; i < last; i++) {task(chunks[i]);}
+        });
+    };
+
+    // First pass counts attributes so every chunk knows where its own land and what relative indices refer to
+    forEachChunk([](ObjChunk& chunk) { countChunk(chunk); });
+    size_t vertexCount = 0, texcoordCount = 0, normalCount = 0;
+    for (auto& chunk : chunks) {
+        chunk.vertexBase = vertexCount;
+        chunk.texcoordBase = texcoordCount;
+        chunk.normalBase = normalCount;
+        vertexCount += chunk.vertexCount;
+        texcoordCount += chunk.texcoordCount;
+        normalCount += chunk.normalCount;
+    }
+
+    ObjData obj;
+    obj.attrib.vertices.resize(3 * vertexCount);
+    obj.attrib.texcoords.resize(2 * texcoordCount);
+    obj.attrib.normals.resize(3 * normalCount);
+    forEachChunk([&obj](ObjChunk& chunk) { parseChunk(chunk, obj.attrib); });
+
+    // Replay shape and material changes in file order, splitting shapes on o and g like tinyobj
+    std::map<std::string, int> materialMap;
+    int materialID = -1;
+    tinyobj::shape_t shape;
+    for (auto& chunk : chunks) {
+        size_t face = 0;
+        auto appendFaces = [&](size_t faceEnd) {
+            auto& mesh = shape.mesh;
+            mesh.indices.insert(mesh.indices.end(), chunk.indices.begin() + 3 * face, chunk.indices.begin() + 3 * faceEnd);
+            mesh.num_face_vertices.insert(mesh.num_face_vertices.end(), faceEnd - face, (unsigned char)3);
+            mesh.material_ids.insert(mesh.material_ids.end(), faceEnd - face, materialID);
+            mesh.smoothing_group_ids.insert(mesh.smoothing_group_ids.end(), faceEnd - face, 0u);
+            face = faceEnd;
+        };
+
+        for (auto& event : chunk.events) {
+            appendFaces(event.faceOffset);
+            switch (event.type) {
+            case ObjLine::OBJECT:
+            case ObjLine::GROUP:
+                if (!shape.mesh.indices.empty()) {
+                    obj.shapes.push_back(std::move(shape));
+                    shape = tinyobj::shape_t{};
+                }
+                shape.name = event.name;
+                break;
+            case ObjLine::USE_MATERIAL: {
+                auto it = materialMap.find(event.name);
+                materialID = it != materialMap.end() ? it->second : -1;
+                break;
+            }
+            case ObjLine::MATERIAL_LIBRARY:
+                loadMaterialLibrary(mtlDirPath, event.name, obj, materialMap);
+                break;
+            default:
+                break;
+            }
+        }
+        appendFaces(chunk.indices.size() / 3);
+    }
+    if (!shape.mesh.indices.empty()) {obj.shapes.push_back(std::move(shape));}
+
+    const std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+    obj.parseMegabytesPerSecond = (float)(file.size() / (1024. * 1024.) / std::max(elapsed.count(), 1e-9));
+    return obj;
+}
+
+} // namespace festi
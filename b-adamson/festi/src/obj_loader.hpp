@@ -0,0 +1,28 @@
+#pragma once
+
+// lib
+#include <tiny_obj_loader.h>
+
+// std
+#include <string>
+#include <vector>
+
+namespace festi {
+
+// Files smaller than this are parsed in one chunk on the calling thread
+constexpr size_t FS_OBJ_MIN_CHUNK_SIZE = 1 << 20;
+
+// Geometry and materials laid out as tinyobj::LoadObj leaves them with triangulation on
+struct ObjData {
+    tinyobj::attrib_t attrib;
+    std::vector<tinyobj::shape_t> shapes;
+    std::vector<tinyobj::material_t> materials;
+    std::vector<std::string> materialLibraries; // paths of the MTL files that were read
+    float parseMegabytesPerSecond = 0.f; // OBJ throughput, MTL files included in the time
+};
+
+// Maps the OBJ, splits it on line boundaries and parses the chunks on the shared thread pool.
+// Libraries named by mtllib are read from mtlDirPath with tinyobj's MTL parser
+ObjData loadObj(const std::string& filePath, const std::string& mtlDirPath);
+
+} // namespace festi
@@ -25,7 +25,7 @@ FestiRenderer::~FestiRenderer() {
 	for (size_t i = 0; i < shadowImages.size(); i++) {
         vkDestroyImageView(festiDevice.device(), shadowImageViews[i], nullptr);
         vkDestroyImage(festiDevice.device(), shadowImages[i], nullptr);
-        vkFreeMemory(festiDevice.device(), shadowImageMemorys[i], nullptr);
+        festiDevice.freeMemory(shadowImageMemorys[i]);
     }
 	for (auto framebuffer : shadowFramebuffers) {
         vkDestroyFramebuffer(festiDevice.device(), framebuffer, nullptr);
@@ -309,7 +309,8 @@ void FestiRenderer::createShadowResources() {
             imageInfo,
             VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
             shadowImages[i],
-            shadowImageMemorys[i]);
+            shadowImageMemorys[i],
+            FS_MemoryCategory::SHADOW_MAP);
 
 		VkCommandBuffer cmdBuffer = festiDevice.beginSingleTimeCommands();
 
@@ -65,7 +65,7 @@ private:
     VkRenderPass shadowRenderPass;
     std::vector<VkFramebuffer> shadowFramebuffers;
     std::vector<VkImage> shadowImages;
-    std::vector<VkDeviceMemory> shadowImageMemorys;
+    std::vector<FestiAllocation> shadowImageMemorys;
     std::vector<VkImageView> shadowImageViews;
 	VkSampler shadowSampler;
 
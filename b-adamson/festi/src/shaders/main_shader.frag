@@ -1,4 +1,5 @@
 #version 450
+#extension GL_EXT_nonuniform_qualifier : require
 
 // IN
 layout (location = 0) in vec3 fragPosWorld;
@@ -12,6 +13,7 @@ layout (location = 5) in vec4 fragPosLight;
 layout (location = 0) out vec4 outColour;
 
 const uint FS_UNSPECIFIED = 4294967295;
+const uint FS_PER_FACE_MATERIAL = 4294967294;
 
 struct PointLight {
     vec4 position;
@@ -50,21 +52,46 @@ layout(std430, set = 1, binding = 0) readonly buffer MaterialsSSBO {
 	ObjFaceData objFaceData[65536];
 	Material materials[200];
 } Mssbo;
-layout(set = 1, binding = 1) uniform sampler2D textures[500];
+layout(set = 1, binding = 1) uniform sampler2DArray textureArrays[64]; // small textures packed by size and format
+layout(set = 1, binding = 2) uniform sampler2D textures[]; // bindless, sized when the set is allocated
 
 layout(set = 2, binding = 0) uniform sampler2DShadow shadowMap;
 
 layout(push_constant) uniform Push {
 	uint objectID;
 	uint offset; // to index into face material ids
+	uint materialID; // FS_PER_FACE_MATERIAL if faces carry their own data
 } push;
 
+// Indices with high bits set address layer (high - 1) of textureArrays[low]
+vec4 sampleTexture(uint index, vec2 uv) {
+	const uint layer = index >> 16;
+	const uint slot = index & 0xFFFFu;
+	if (layer != 0u) {
+		return texture(textureArrays[nonuniformEXT(slot)], vec3(uv, float(layer - 1u)));
+	}
+	return texture(textures[nonuniformEXT(slot)], uv);
+}
+
 void main() {
-	const ObjFaceData faceData = Mssbo.objFaceData[gl_PrimitiveID + push.offset];
-	const uint materialIndex = faceData.faceID;
-	const uint diffuseIndex = Mssbo.materials[materialIndex].diffuseTextureIndex;
-	const uint normalIndex = Mssbo.materials[materialIndex].normalTextureIndex;
-	const uint specularIndex = Mssbo.materials[materialIndex].specularTextureIndex;
+	// Faces are drawn in per material ranges unless the model overrides individual faces
+	ObjFaceData faceData;
+	if (push.materialID == FS_PER_FACE_MATERIAL) {
+		faceData = Mssbo.objFaceData[gl_PrimitiveID + push.offset];
+	} else {
+		faceData = ObjFaceData(push.materialID, 1.0, 1.0, vec2(0.0));
+	}
+	// Faces without a material get the defaults of the C++ Material: untextured magenta
+	Material material;
+	if (faceData.faceID == FS_UNSPECIFIED) {
+		material = Material(vec4(255.0, 0.0, 255.0, 1.0), vec4(255.0, 0.0, 255.0, 1.0), 32.0,
+			FS_UNSPECIFIED, FS_UNSPECIFIED, FS_UNSPECIFIED);
+	} else {
+		material = Mssbo.materials[faceData.faceID];
+	}
+	const uint diffuseIndex = material.diffuseTextureIndex;
+	const uint normalIndex = material.normalTextureIndex;
+	const uint specularIndex = material.specularTextureIndex;
 
 	const vec2 offsetTexCoord = fragTexCoord + faceData.uvOffset;
 
@@ -76,8 +103,9 @@ void main() {
 	vec3 surfaceNormal;
 	if (normalIndex != FS_UNSPECIFIED) {
 		mat3 TBN = mat3(fragTangentWorld, fragBitangentWorld, fragNormalWorld);
-		vec3 normalMap = texture(textures[normalIndex], offsetTexCoord).rgb;
-		normalMap = normalMap * 2.0 - 1.0;
+		// Only XY are stored (BC5), Z is rebuilt from the unit length
+		vec2 normalXY = sampleTexture(normalIndex, offsetTexCoord).rg * 2.0 - 1.0;
+		vec3 normalMap = vec3(normalXY, sqrt(max(1.0 - dot(normalXY, normalXY), 0.0)));
 		surfaceNormal = normalize(TBN * normalMap);
 	} else {
 		surfaceNormal = fragNormalWorld;
@@ -86,17 +114,17 @@ void main() {
 	// Check for specular map
 	vec3 specularMap;
 	if (specularIndex != FS_UNSPECIFIED) {
-		specularMap = texture(textures[specularIndex], offsetTexCoord).rgb;
+		specularMap = sampleTexture(specularIndex, offsetTexCoord).rgb;
 	} else {
-		specularMap = Mssbo.materials[materialIndex].specularColor.rgb;
+		specularMap = material.specularColor.rgb;
 	}
 
 	// Check for diffuse map
 	vec4 diffuseMap;
 	if (diffuseIndex != FS_UNSPECIFIED) {
-		diffuseMap = texture(textures[diffuseIndex], offsetTexCoord);
+		diffuseMap = sampleTexture(diffuseIndex, offsetTexCoord);
 	} else {
-		diffuseMap = Mssbo.materials[materialIndex].diffuseColor;
+		diffuseMap = material.diffuseColor;
 	}
 
 	// Apply shadows
@@ -135,7 +163,7 @@ void main() {
 		vec3 halfAngle = normalize(directionToLight + viewDirection);
 		float blinnTerm = dot(surfaceNormal, halfAngle);
 		blinnTerm = clamp(blinnTerm, 0, 1);
-		blinnTerm = pow(blinnTerm, Mssbo.materials[materialIndex].shininess);
+		blinnTerm = pow(blinnTerm, material.shininess);
 		specularLight += intensity * blinnTerm * specularMap;
 	}
 
@@ -1,10 +1,9 @@
 #version 450
 
 layout(location = 0) in vec3 vertPosition;
-layout(location = 1) in vec3 vertNormal;
-layout(location = 2) in vec3 vertTangent;
-layout(location = 3) in vec3 vertBitangent;
-layout(location = 4) in vec2 vertTexCoord;
+layout(location = 1) in vec2 vertNormal; // octahedral
+layout(location = 2) in vec2 vertTangent; // octahedral, y remapped to [0, 1] and signed by the bitangent handedness
+layout(location = 3) in vec2 vertTexCoord;
 
 layout (location = 5)  in vec4 instanceModelMatColumn1;
 layout (location = 6)  in vec4 instanceModelMatColumn2;
@@ -38,6 +37,13 @@ layout(set = 0, binding = 0) uniform GlobalUBO {
 	uint pointLightCount;
 } ubo;
 
+vec3 octDecode(vec2 e) {
+	vec3 v = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+	const float t = max(-v.z, 0.0);
+	v.xy += vec2(v.x >= 0.0 ? -t : t, v.y >= 0.0 ? -t : t);
+	return normalize(v);
+}
+
 void main() {
 	mat3 normalMatrix = mat3(
 		instanceNormalMatColumn1,
@@ -55,9 +61,14 @@ void main() {
 	vec4 vertPositionWorld = modelMatrix * vec4(vertPosition, 1.0);
 	gl_Position = ubo.projection * ubo.view * vertPositionWorld;
 
-	fragNormalWorld = normalize(normalMatrix * vertNormal);
-	fragTangentWorld = normalize(normalMatrix * vertTangent);
-	fragBitangentWorld = normalize(normalMatrix * vertBitangent);
+	const vec3 normal = octDecode(vertNormal);
+	const float bitangentSign = vertTangent.y < 0.0 ? -1.0 : 1.0;
+	const vec3 tangent = octDecode(vec2(vertTangent.x, abs(vertTangent.y) * 2.0 - 1.0));
+	const vec3 bitangent = cross(normal, tangent) * bitangentSign;
+
+	fragNormalWorld = normalize(normalMatrix * normal);
+	fragTangentWorld = normalize(normalMatrix * tangent);
+	fragBitangentWorld = normalize(normalMatrix * bitangent);
 	fragPosWorld = vertPositionWorld.xyz;
 	fragTexCoord = vertTexCoord;
 	fragPosLight = ubo.lightProjection * ubo.lightView * vertPositionWorld;
@@ -46,7 +46,7 @@ FestiSwapChain::~FestiSwapChain() {
 	for (size_t i = 0; i < depthImages.size(); i++) {
 		vkDestroyImageView(device.device(), depthImageViews[i], nullptr);
 		vkDestroyImage(device.device(), depthImages[i], nullptr);
-		vkFreeMemory(device.device(), depthImageMemorys[i], nullptr);
+		device.freeMemory(depthImageMemorys[i]);
 	}
 
 	for (auto framebuffer : swapChainFramebuffers) {
@@ -314,7 +314,8 @@ void FestiSwapChain::createDepthResources() {
 			imageInfo,
 			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
 			depthImages[i],
-			depthImageMemorys[i]);
+			depthImageMemorys[i],
+			FS_MemoryCategory::DEPTH);
 
 		VkImageViewCreateInfo viewInfo{};
 		device.defaultImageViewCreateInfo(viewInfo);
@@ -69,7 +69,7 @@ private:
 	// Main pass resources
 	VkRenderPass renderPass;
 	std::vector<VkImage> depthImages;
-	std::vector<VkDeviceMemory> depthImageMemorys;
+	std::vector<FestiAllocation> depthImageMemorys;
 	std::vector<VkImageView> depthImageViews;
 
 	// Swapchain image resources
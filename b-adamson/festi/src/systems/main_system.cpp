@@ -1,5 +1,6 @@
 #include "main_system.hpp"
 
+#include "geometry_arena.hpp"
 #include "model.hpp"
 
 // libs
@@ -133,11 +134,11 @@ void MainSystem::createPipeline(VkRenderPass renderPass, VkRenderPass shadowRend
 	shadowPipelineConfig.colorBlendInfo.pAttachments = nullptr;
 
 	std::vector<VkVertexInputBindingDescription> bindingDescriptions;
-	bindingDescriptions.push_back({0, sizeof(Vertex), VK_VERTEX_INPUT_RATE_VERTEX});
+	bindingDescriptions.push_back({0, sizeof(glm::vec3), VK_VERTEX_INPUT_RATE_VERTEX});
 	bindingDescriptions.push_back({1, sizeof(Instance), VK_VERTEX_INPUT_RATE_INSTANCE});
 
 	std::vector<VkVertexInputAttributeDescription> attributeDescriptions;
-	attributeDescriptions.push_back({0, 0, VK_FORMAT_R32G32B32_SFLOAT,    offsetof(Vertex, position)});
+	attributeDescriptions.push_back({0, 0, VK_FORMAT_R32G32B32_SFLOAT,    0}); // position stream only
 	attributeDescriptions.push_back({1, 1, VK_FORMAT_R32G32B32A32_SFLOAT, offsetof(Instance, modelMatColumn1)});
 	attributeDescriptions.push_back({2, 1, VK_FORMAT_R32G32B32A32_SFLOAT, offsetof(Instance, modelMatColumn2)});
 	attributeDescriptions.push_back({3, 1, VK_FORMAT_R32G32B32A32_SFLOAT, offsetof(Instance, modelMatColumn3)});
@@ -171,24 +172,46 @@ void MainSystem::renderGameObjects(FrameInfo& frameInfo) {
         0,
         nullptr);
 
-	for (size_t i = 0; i < frameInfo.gameObjects.size(); i++) {
-		auto& obj = frameInfo.gameObjects[i];
-		if (!obj->visibility) continue;
-
-		MainPushConstants push{};
-		push.objectID = obj->getId();
-		push.offset = MaterialsSSBO::offsets[i];
-
-		vkCmdPushConstants(
-			frameInfo.commandBuffer,
-			mainPipelineLayout,
-			VK_SHADER_STAGE_FRAGMENT_BIT,
-			0,
-			sizeof(MainPushConstants),
-			&push);
-
-		obj->bind(frameInfo.commandBuffer);
-		obj->draw(frameInfo.commandBuffer);
+	// Every mesh lives in the geometry arena, so only instance buffers change between objects. 16 and 32 bit
+	// indices are separate buffers, each drawn in its own sweep
+	FestiGeometryArena& geometry = festiDevice.getGeometryArena();
+	if (!geometry.bindVertices(frameInfo.commandBuffer)) {return;}
+	for (VkIndexType indexType : {VK_INDEX_TYPE_UINT16, VK_INDEX_TYPE_UINT32}) {
+		geometry.bindIndices(frameInfo.commandBuffer, indexType);
+		for (size_t i = 0; i < frameInfo.gameObjects.size(); i++) {
+			auto& obj = frameInfo.gameObjects[i];
+			if (!obj->visibility || !obj->isResident() || obj->getIndexType() != indexType) continue;
+			if (!obj->bind(frameInfo.commandBuffer)) continue;
+
+			MainPushConstants push{};
+			push.objectID = obj->getId();
+			push.offset = MaterialsSSBO::offsets[i];
+			push.materialID = FS_PER_FACE_MATERIAL;
+
+			if (obj->usesPerFaceData()) {
+				vkCmdPushConstants(
+					frameInfo.commandBuffer,
+					mainPipelineLayout,
+					VK_SHADER_STAGE_FRAGMENT_BIT,
+					0,
+					sizeof(MainPushConstants),
+					&push);
+				obj->draw(frameInfo.commandBuffer);
+				continue;
+			}
+
+			for (const auto& range : obj->getDrawRanges()) {
+				push.materialID = range.materialID;
+				vkCmdPushConstants(
+					frameInfo.commandBuffer,
+					mainPipelineLayout,
+					VK_SHADER_STAGE_FRAGMENT_BIT,
+					0,
+					sizeof(MainPushConstants),
+					&push);
+				obj->draw(frameInfo.commandBuffer, range);
+			}
+		}
   	}
 }
 
@@ -205,12 +228,17 @@ void MainSystem::createShadowMap(FrameInfo& frameInfo) {
 		sizeof(ShadowPushConstants),
 		&push);
 
-	for (size_t i = 0; i < frameInfo.gameObjects.size(); i++) {
-		auto& obj = frameInfo.gameObjects[i];
-		if (!obj->visibility) continue;
-
-		obj->bind(frameInfo.commandBuffer);
-		obj->draw(frameInfo.commandBuffer);	
+	// Positions only, bound once like the main pass
+	FestiGeometryArena& geometry = festiDevice.getGeometryArena();
+	if (!geometry.bindVertices(frameInfo.commandBuffer, true)) {return;}
+	for (VkIndexType indexType : {VK_INDEX_TYPE_UINT16, VK_INDEX_TYPE_UINT32}) {
+		geometry.bindIndices(frameInfo.commandBuffer, indexType);
+		for (size_t i = 0; i < frameInfo.gameObjects.size(); i++) {
+			auto& obj = frameInfo.gameObjects[i];
+			if (!obj->visibility || !obj->isResident() || obj->getIndexType() != indexType) continue;
+			if (!obj->bind(frameInfo.commandBuffer)) continue;
+			obj->draw(frameInfo.commandBuffer);	
+		}
 	}
 }
 
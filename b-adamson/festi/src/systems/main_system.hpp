@@ -11,9 +11,14 @@
 
 namespace festi {
 
+// Pushed as the material when the face data is looked up per primitive. FS_UNSPECIFIED stays free for
+// ranges of faces that have no material
+constexpr uint32_t FS_PER_FACE_MATERIAL = FS_UNSPECIFIED - 1;
+
 struct MainPushConstants {
 	uint32_t objectID;
 	uint32_t offset;
+	uint32_t materialID; // FS_PER_FACE_MATERIAL when the face data is looked up per primitive
 };
 
 struct ShadowPushConstants {
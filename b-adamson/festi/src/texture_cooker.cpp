@@ -0,0 +1,494 @@
+#include "texture_cooker.hpp"
+
+#include "utils.hpp"
+
+// std
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+
+namespace festi {
+
+namespace {
+
+constexpr uint8_t KTX2_IDENTIFIER[12] = {0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n'};
+// Key/value entry holding the source file's content hash, the value is its 8 bytes
+constexpr char KTX2_SOURCE_HASH_KEY[] = "FestiSourceHash";
+
+// Data format descriptor colour models and transfer functions (Khronos Data Format spec)
+constexpr uint8_t KHR_DF_MODEL_BC4 = 131;
+constexpr uint8_t KHR_DF_MODEL_BC5 = 132;
+constexpr uint8_t KHR_DF_MODEL_BC7 = 134;
+constexpr uint8_t KHR_DF_PRIMARIES_BT709 = 1;
+constexpr uint8_t KHR_DF_TRANSFER_LINEAR = 1;
+constexpr uint8_t KHR_DF_TRANSFER_SRGB = 2;
+
+constexpr uint32_t FS_DECODED_CACHE_MAGIC = 0x58545346; // "FSTX"
+constexpr uint32_t FS_DECODED_CACHE_VERSION = 1;
+
+struct DecodedCacheHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t width;
+	uint32_t height;
+	uint32_t mipLevels;
+	uint32_t format;
+	uint64_t dataSize;
+};
+
+using Block = std::array<std::array<uint8_t, 4>, 16>;
+
+// Writes bits LSB first, as BC7 blocks are laid out
+struct BitWriter {
+	uint8_t* data;
+	uint32_t position = 0;
+
+	void write(uint32_t value, uint32_t bits) {
+		for (uint32_t i = 0; i < bits; i++, position++) {
+			if ((value >> i) & 1) {data[position / 8] |= uint8_t(1 << (position % 8));}
+		}
+	}
+};
+
+Block fetchBlock(const uint8_t* rgba, uint32_t width, uint32_t height, uint32_t bx, uint32_t by) {
+	// Edge blocks of levels that aren't a multiple of 4 repeat the last row/column
+	Block block;
+	for (uint32_t y = 0; y < 4; y++) {
+		for (uint32_t x = 0; x < 4; x++) {
+			const uint32_t px = std::min(bx * 4 + x, width - 1);
+			const uint32_t py = std::min(by * 4 + y, height - 1);
+			std::memcpy(block[y * 4 + x].data(), rgba + ((size_t)py * width + px) * 4, 4);
+		}
+	}
+	return block;
+}
+
+void encodeBC4(const std::array<uint8_t, 16>& values, uint8_t* out) {
+	const uint8_t maxValue = *std::max_element(values.begin(), values.end());
+	const uint8_t minValue = *std::min_element(values.begin(), values.end());
+	std::memset(out, 0, 8);
+	out[0] = maxValue;
+	out[1] = minValue;
+	if (maxValue == minValue) {return;}
+
+	// red0 > red1 selects the 8 value palette
+	std::array<int, 8> palette;
+	palette[0] = maxValue;
+	palette[1] = minValue;
+	for (int i = 2; i < 8; i++) {palette[i] = ((8 - i) * maxValue + (i - 1) * minValue) / 7;}
+
+	BitWriter writer{out + 2};
+	for (uint8_t value : values) {
+		uint32_t best = 0;
+		int bestError = 256;
+		for (uint32_t i = 0; i < 8; i++) {
+			int error = std::abs(palette[i] - value);
+			if (error < bestError) {bestError = error; best = i;}
+		}
+		writer.write(best, 3);
+	}
+}
+
+// Mode 6: one subset, RGBA 7777 endpoints with a p-bit each, 4 bit indices
+void encodeBC7(const Block& block, uint8_t* out) {
+	static constexpr int weights[16] = {0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64};
+
+	// Fit endpoints along the principal axis of the block's colours
+	std::array<float, 4> mean{};
+	for (const auto& texel : block) {
+		for (int c = 0; c < 4; c++) {mean[c] += texel[c] / 16.f;}
+	}
+	float covariance[4][4] = {};
+	std::array<float, 4> minTexel{255.f, 255.f, 255.f, 255.f}, maxTexel{};
+	for (const auto& texel : block) {
+		for (int i = 0; i < 4; i++) {
+			minTexel[i] = std::min(minTexel[i], (float)texel[i]);
+			maxTexel[i] = std::max(maxTexel[i], (float)texel[i]);
+			for (int j = 0; j < 4; j++) {covariance[i][j] += (texel[i] - mean[i]) * (texel[j] - mean[j]);}
+		}
+	}
+	std::array<float, 4> axis;
+	for (int c = 0; c < 4; c++) {axis[c] = maxTexel[c] - minTexel[c];}
+	for (int iteration = 0; iteration < 8; iteration++) {
+		std::array<float, 4> next{};
+		for (int i = 0; i < 4; i++) {
+			for (int j = 0; j < 4; j++) {next[i] += covariance[i][j] * axis[j];}
+		}
+		float length = std::sqrt(next[0] * next[0] + next[1] * next[1] + next[2] * next[2] + next[3] * next[3]);
+		if (length < 1e-6f) {break;}
+		for (int c = 0; c < 4; c++) {axis[c] = next[c] / length;}
+	}
+	float axisLength = std::sqrt(axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2] + axis[3] * axis[3]);
+	if (axisLength > 1e-6f) {
+		for (int c = 0; c < 4; c++) {axis[c] /= axisLength;}
+	}
+
+	float minProjection = 0.f, maxProjection = 0.f;
+	for (const auto& texel : block) {
+		float projection = 0.f;
+		for (int c = 0; c < 4; c++) {projection += (texel[c] - mean[c]) * axis[c];}
+		minProjection = std::min(minProjection, projection);
+		maxProjection = std::max(maxProjection, projection);
+	}
+
+	// Quantise each endpoint to 7 bits plus the p-bit that fits it best
+	std::array<std::array<int, 4>, 2> quantised;
+	std::array<int, 2> pBits;
+	std::array<std::array<int, 4>, 2> endpoints;
+	for (int e = 0; e < 2; e++) {
+		const float t = e == 0 ? minProjection : maxProjection;
+		float bestError = 1e30f;
+		for (int p = 0; p < 2; p++) {
+			std::array<int, 4> q;
+			float error = 0.f;
+			for (int c = 0; c < 4; c++) {
+				float target = std::clamp(mean[c] + axis[c] * t, 0.f, 255.f);
+				q[c] = std::clamp((int)std::lround((target - p) / 2.f), 0, 127);
+				float delta = (q[c] * 2 + p) - target;
+				error += delta * delta;
+			}
+			if (error < bestError) {bestError = error; quantised[e] = q; pBits[e] = p;}
+		}
+		for (int c = 0; c < 4; c++) {endpoints[e][c] = quantised[e][c] * 2 + pBits[e];}
+	}
+
+	std::array<std::array<int, 4>, 16> palette;
+	for (int i = 0; i < 16; i++) {
+		for (int c = 0; c < 4; c++) {
+			palette[i][c] = ((64 - weights[i]) * endpoints[0][c] + weights[i] * endpoints[1][c] + 32) >> 6;
+		}
+	}
+
+	std::array<uint32_t, 16> indices;
+	for (int t = 0; t < 16; t++) {
+		int bestError = INT32_MAX;
+		for (uint32_t i = 0; i < 16; i++) {
+			int error = 0;
+			for (int c = 0; c < 4; c++) {
+				int delta = palette[i][c] - block[t][c];
+				error += delta * delta;
+			}
+			if (error < bestError) {bestError = error; indices[t] = i;}
+		}
+	}
+
+	// The anchor index is stored without its top bit, so it has to be < 8
+	if (indices[0] & 8) {
+		std::swap(quantised[0], quantised[1]);
+		std::swap(pBits[0], pBits[1]);
+		for (auto& index : indices) {index = 15 - index;}
+	}
+
+	std::memset(out, 0, 16);
+	BitWriter writer{out};
+	writer.write(1 << 6, 7);
+	for (int c = 0; c < 4; c++) {
+		writer.write(quantised[0][c], 7);
+		writer.write(quantised[1][c], 7);
+	}
+	writer.write(pBits[0], 1);
+	writer.write(pBits[1], 1);
+	writer.write(indices[0], 3);
+	for (int t = 1; t < 16; t++) {writer.write(indices[t], 4);}
+}
+
+void compressLevel(const uint8_t* rgba, uint32_t width, uint32_t height, FS_ImageMapFlags flag, std::vector<uint8_t>& out) {
+	const uint32_t blocksX = (width + 3) / 4;
+	const uint32_t blocksY = (height + 3) / 4;
+	for (uint32_t by = 0; by < blocksY; by++) {
+		for (uint32_t bx = 0; bx < blocksX; bx++) {
+			const Block block = fetchBlock(rgba, width, height, bx, by);
+			const size_t offset = out.size();
+
+			switch (flag) {
+			case FS_ImageMapFlags::DIFFUSE:
+				out.resize(offset + 16);
+				encodeBC7(block, &out[offset]);
+				break;
+			case FS_ImageMapFlags::NORMAL: {
+				// Only X and Y are stored, Z is rebuilt in the fragment shader
+				std::array<uint8_t, 16> red, green;
+				for (int t = 0; t < 16; t++) {red[t] = block[t][0]; green[t] = block[t][1];}
+				out.resize(offset + 16);
+				encodeBC4(red, &out[offset]);
+				encodeBC4(green, &out[offset + 8]);
+				break;
+			}
+			case FS_ImageMapFlags::SPECULAR: {
+				std::array<uint8_t, 16> luminance;
+				for (int t = 0; t < 16; t++) {
+					luminance[t] = (uint8_t)std::lround(0.2126f * block[t][0] + 0.7152f * block[t][1] + 0.0722f * block[t][2]);
+				}
+				out.resize(offset + 8);
+				encodeBC4(luminance, &out[offset]);
+				break;
+			}
+			}
+		}
+	}
+}
+
+std::vector<uint8_t> buildDataFormatDescriptor(VkFormat format) {
+	uint8_t model = KHR_DF_MODEL_BC7;
+	uint8_t transfer = KHR_DF_TRANSFER_LINEAR;
+	uint32_t samples = 1;
+	uint32_t blockBytes = 16;
+	switch (format) {
+	case VK_FORMAT_BC7_SRGB_BLOCK: transfer = KHR_DF_TRANSFER_SRGB; break;
+	case VK_FORMAT_BC5_UNORM_BLOCK: model = KHR_DF_MODEL_BC5; samples = 2; break;
+	case VK_FORMAT_BC4_UNORM_BLOCK: model = KHR_DF_MODEL_BC4; blockBytes = 8; break;
+	default: break;
+	}
+
+	const uint32_t blockSize = 24 + 16 * samples;
+	std::vector<uint32_t> words(1 + blockSize / 4, 0);
+	words[0] = 4 + blockSize;                      // dfdTotalSize
+	words[1] = 0;                                  // vendorId KHRONOS, descriptorType basic
+	words[2] = 2 | (blockSize << 16);              // versionNumber 1.3, descriptorBlockSize
+	words[3] = model | (KHR_DF_PRIMARIES_BT709 << 8) | (transfer << 16);
+	words[4] = 3 | (3 << 8);                       // 4x4x1x1 texel block
+	words[5] = blockBytes;                         // bytesPlane0
+	for (uint32_t s = 0; s < samples; s++) {
+		uint32_t* sample = &words[7 + 4 * s];
+		const uint32_t bits = blockBytes * 8 / samples;
+		sample[0] = (s * bits) | ((bits - 1) << 16) | (s << 24); // bitOffset, bitLength, channel R/G
+		sample[1] = 0;
+		sample[2] = 0;
+		sample[3] = UINT32_MAX;
+	}
+
+	std::vector<uint8_t> bytes(words.size() * 4);
+	std::memcpy(bytes.data(), words.data(), bytes.size());
+	return bytes;
+}
+
+template <typename T>
+void writeValue(std::vector<uint8_t>& out, size_t offset, T value) {
+	std::memcpy(&out[offset], &value, sizeof(T));
+}
+
+template <typename T>
+T readValue(const uint8_t* in, size_t offset) {
+	T value;
+	std::memcpy(&value, in + offset, sizeof(T));
+	return value;
+}
+
+// Maps the file and checks its level index, levelOffsets locating each level (finest first) in the mapping
+bool mapKTX2(const std::string& filePath, DecodedImage& image, std::vector<VkDeviceSize>& levelOffsets) {
+	auto mappedFile = std::make_shared<FestiMappedFile>(filePath);
+	const uint8_t* in = mappedFile->data();
+	const size_t size = mappedFile->size();
+	if (!mappedFile->valid() || size < 80 || std::memcmp(in, KTX2_IDENTIFIER, sizeof(KTX2_IDENTIFIER)) != 0) {return false;}
+
+	image.format = static_cast<VkFormat>(readValue<uint32_t>(in, 12));
+	image.width = readValue<uint32_t>(in, 20);
+	image.height = readValue<uint32_t>(in, 24);
+	image.mipLevels = std::max(readValue<uint32_t>(in, 40), 1u);
+	if (readValue<uint32_t>(in, 44) != 0 || size < 80 + 24 * (size_t)image.mipLevels) {return false;}
+
+	levelOffsets.clear();
+	for (uint32_t level = 0; level < image.mipLevels; level++) {
+		const size_t entry = 80 + 24 * (size_t)level;
+		const uint64_t offset = readValue<uint64_t>(in, entry);
+		const uint64_t length = readValue<uint64_t>(in, entry + 8);
+		if (offset + length > size || 
+			length != getMipLevelSize(image.format, image.width >> level, image.height >> level)) {return false;}
+		levelOffsets.push_back(offset);
+	}
+	image.data.clear();
+	image.mappedFile = std::move(mappedFile);
+	image.mappedOffset = 0;
+	return true;
+}
+
+// The hash writeKTX2 stored in the key/value data, false for files without one
+bool readKTX2SourceHash(const uint8_t* in, size_t size, uint64_t& sourceHash) {
+	const size_t kvdOffset = readValue<uint32_t>(in, 56);
+	const size_t kvdEnd = kvdOffset + readValue<uint32_t>(in, 60);
+	if (kvdEnd > size) {return false;}
+
+	for (size_t entry = kvdOffset; entry + 4 <= kvdEnd;) {
+		const size_t length = readValue<uint32_t>(in, entry);
+		if (entry + 4 + length > kvdEnd) {return false;}
+		if (length == sizeof(KTX2_SOURCE_HASH_KEY) + sizeof(uint64_t) && 
+			std::memcmp(in + entry + 4, KTX2_SOURCE_HASH_KEY, sizeof(KTX2_SOURCE_HASH_KEY)) == 0) {
+			sourceHash = readValue<uint64_t>(in, entry + 4 + sizeof(KTX2_SOURCE_HASH_KEY));
+			return true;
+		}
+		entry += 4 + (length + 3) / 4 * 4;
+	}
+	return false;
+}
+
+} // namespace
+
+VkFormat getCookedFormat(FS_ImageMapFlags flag) {
+	switch (flag) {
+	case FS_ImageMapFlags::DIFFUSE: return VK_FORMAT_BC7_SRGB_BLOCK;
+	case FS_ImageMapFlags::NORMAL: return VK_FORMAT_BC5_UNORM_BLOCK;
+	case FS_ImageMapFlags::SPECULAR: return VK_FORMAT_BC4_UNORM_BLOCK;
+	}
+	return VK_FORMAT_UNDEFINED;
+}
+
+std::string getTextureCachePath(const std::string& imgDirPath, const std::string& name, FS_ImageMapFlags flag) {
+	const char* suffix = flag == FS_ImageMapFlags::DIFFUSE ? ".bc7" : flag == FS_ImageMapFlags::NORMAL ? ".bc5" : ".bc4";
+	return FS_TEXTURE_CACHE_DIR + "/" + imgDirPath + "/" + name + suffix + ".ktx2";
+}
+
+DecodedImage cookTexture(const DecodedImage& image, FS_ImageMapFlags flag) {
+	assert(image.format == VK_FORMAT_R8G8B8A8_SRGB || image.format == VK_FORMAT_R8G8B8A8_UNORM);
+
+	DecodedImage cooked;
+	cooked.width = image.width;
+	cooked.height = image.height;
+	cooked.mipLevels = image.mipLevels;
+	cooked.format = getCookedFormat(flag);
+
+	size_t offset = 0;
+	for (uint32_t level = 0; level < image.mipLevels; level++) {
+		const uint32_t width = std::max(image.width >> level, 1u);
+		const uint32_t height = std::max(image.height >> level, 1u);
+		compressLevel(&image.data[offset], width, height, flag, cooked.data);
+		offset += (size_t)width * height * 4;
+	}
+	return cooked;
+}
+
+std::string getDecodedCachePath(uint64_t sourceHash, VkFormat format) {
+	std::ostringstream path;
+	path << FS_TEXTURE_CACHE_DIR << "/decoded/" << std::hex << std::setw(16) << std::setfill('0') << sourceHash
+		<< std::dec << "_" << (uint32_t)format << ".rgba";
+	return path.str();
+}
+
+bool writeDecodedCache(const std::string& filePath, const DecodedImage& image) {
+	DecodedCacheHeader header{FS_DECODED_CACHE_MAGIC, FS_DECODED_CACHE_VERSION, image.width, image.height, 
+		image.mipLevels, (uint32_t)image.format, image.byteSize()};
+	return writeCacheFile(filePath, &header, sizeof(header), image.bytes(), image.byteSize());
+}
+
+bool readDecodedCache(const std::string& filePath, DecodedImage& image) {
+	auto mappedFile = std::make_shared<FestiMappedFile>(filePath);
+	if (!mappedFile->valid() || mappedFile->size() < sizeof(DecodedCacheHeader)) {return false;}
+
+	DecodedCacheHeader header;
+	std::memcpy(&header, mappedFile->data(), sizeof(header));
+	if (header.magic != FS_DECODED_CACHE_MAGIC || header.version != FS_DECODED_CACHE_VERSION || 
+		header.width == 0 || header.height == 0 || 
+		header.mipLevels == 0 || header.mipLevels > getMipLevels(header.width, header.height)) {return false;}
+
+	// A truncated or mislabelled file is re-decoded rather than read past its levels
+	uint64_t expectedSize = 0;
+	for (uint32_t level = 0; level < header.mipLevels; level++) {
+		expectedSize += getMipLevelSize(static_cast<VkFormat>(header.format), header.width >> level, header.height >> level);
+	}
+	if (header.dataSize != expectedSize || header.dataSize != mappedFile->size() - sizeof(header)) {return false;}
+
+	image.width = header.width;
+	image.height = header.height;
+	image.mipLevels = header.mipLevels;
+	image.format = static_cast<VkFormat>(header.format);
+	image.data.clear();
+	image.mappedFile = std::move(mappedFile);
+	image.mappedOffset = sizeof(header);
+	return true;
+}
+
+bool writeKTX2(const std::string& filePath, const DecodedImage& image, uint64_t sourceHash) {
+	const uint32_t levelCount = image.mipLevels;
+	const std::vector<uint8_t> dfd = buildDataFormatDescriptor(image.format);
+	const size_t levelIndexOffset = 80;
+	const size_t dfdOffset = levelIndexOffset + 24 * (size_t)levelCount;
+	const size_t kvdOffset = dfdOffset + dfd.size();
+	const size_t kvdLength = 4 + sizeof(KTX2_SOURCE_HASH_KEY) + sizeof(uint64_t);
+	const size_t blockBytes = getMipLevelSize(image.format, 1, 1);
+
+	// Levels are stored smallest first, each aligned to the block size
+	std::vector<size_t> levelSizes(levelCount), sourceOffsets(levelCount), fileOffsets(levelCount);
+	size_t sourceOffset = 0;
+	for (uint32_t level = 0; level < levelCount; level++) {
+		levelSizes[level] = getMipLevelSize(image.format, image.width >> level, image.height >> level);
+		sourceOffsets[level] = sourceOffset;
+		sourceOffset += levelSizes[level];
+	}
+	size_t fileSize = kvdOffset + (kvdLength + 3) / 4 * 4;
+	for (uint32_t level = levelCount; level-- > 0;) {
+		fileSize = (fileSize + blockBytes - 1) / blockBytes * blockBytes;
+		fileOffsets[level] = fileSize;
+		fileSize += levelSizes[level];
+	}
+
+	std::vector<uint8_t> out(fileSize, 0);
+	std::memcpy(out.data(), KTX2_IDENTIFIER, sizeof(KTX2_IDENTIFIER));
+	writeValue<uint32_t>(out, 12, image.format);
+	writeValue<uint32_t>(out, 16, 1);            // typeSize
+	writeValue<uint32_t>(out, 20, image.width);
+	writeValue<uint32_t>(out, 24, image.height);
+	writeValue<uint32_t>(out, 28, 0);            // pixelDepth
+	writeValue<uint32_t>(out, 32, 0);            // layerCount
+	writeValue<uint32_t>(out, 36, 1);            // faceCount
+	writeValue<uint32_t>(out, 40, levelCount);
+	writeValue<uint32_t>(out, 44, 0);            // supercompressionScheme
+	writeValue<uint32_t>(out, 48, (uint32_t)dfdOffset);
+	writeValue<uint32_t>(out, 52, (uint32_t)dfd.size());
+	std::memcpy(&out[dfdOffset], dfd.data(), dfd.size());
+	writeValue<uint32_t>(out, 56, (uint32_t)kvdOffset);
+	writeValue<uint32_t>(out, 60, (uint32_t)kvdLength);
+	writeValue<uint32_t>(out, kvdOffset, (uint32_t)(kvdLength - 4));
+	std::memcpy(&out[kvdOffset + 4], KTX2_SOURCE_HASH_KEY, sizeof(KTX2_SOURCE_HASH_KEY));
+	writeValue<uint64_t>(out, kvdOffset + 4 + sizeof(KTX2_SOURCE_HASH_KEY), sourceHash);
+
+	for (uint32_t level = 0; level < levelCount; level++) {
+		const size_t entry = levelIndexOffset + 24 * (size_t)level;
+		writeValue<uint64_t>(out, entry, fileOffsets[level]);
+		writeValue<uint64_t>(out, entry + 8, levelSizes[level]);
+		writeValue<uint64_t>(out, entry + 16, levelSizes[level]);
+		std::memcpy(&out[fileOffsets[level]], &image.data[sourceOffsets[level]], levelSizes[level]);
+	}
+
+	return writeCacheFile(filePath, out.data(), out.size(), nullptr, 0);
+}
+
+bool readKTX2(const std::string& filePath, DecodedImage& image, uint64_t sourceHash) {
+	DecodedImage mapped;
+	std::vector<VkDeviceSize> levelOffsets;
+	uint64_t cookedHash;
+	if (!mapKTX2(filePath, mapped, levelOffsets) || 
+		!readKTX2SourceHash(mapped.bytes(), mapped.byteSize(), cookedHash) || cookedHash != sourceHash) {return false;}
+
+	image.format = mapped.format;
+	image.width = mapped.width;
+	image.height = mapped.height;
+	image.mipLevels = mapped.mipLevels;
+	image.data.clear();
+	for (uint32_t level = 0; level < image.mipLevels; level++) {
+		const uint8_t* levelData = mapped.bytes() + levelOffsets[level];
+		image.data.insert(image.data.end(), levelData, 
+			levelData + getMipLevelSize(image.format, image.width >> level, image.height >> level));
+	}
+	return true;
+}
+
+bool mapCachedLevels(const std::string& filePath, DecodedImage& image, std::vector<VkDeviceSize>& levelOffsets) {
+	if (std::filesystem::path(filePath).extension() == ".ktx2") {return mapKTX2(filePath, image, levelOffsets);}
+	if (!readDecodedCache(filePath, image)) {return false;}
+
+	// Decoded caches hold their levels packed after the header
+	levelOffsets.clear();
+	VkDeviceSize offset = 0;
+	for (uint32_t level = 0; level < image.mipLevels; level++) {
+		levelOffsets.push_back(offset);
+		offset += getMipLevelSize(image.format, image.width >> level, image.height >> level);
+	}
+	return true;
+}
+
+} // namespace festi
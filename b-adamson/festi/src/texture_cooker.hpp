@@ -0,0 +1,35 @@
+#pragma once
+
+#include "materials.hpp"
+
+// std
+#include <string>
+#include <vector>
+
+namespace festi {
+
+// Cooked textures live under this directory, mirroring the material directory they came from
+const std::string FS_TEXTURE_CACHE_DIR = "cache";
+
+// Compressed format each texture kind is cooked to: BC7 diffuse, BC5 (RG) normals, BC4 specular
+VkFormat getCookedFormat(FS_ImageMapFlags flag);
+std::string getTextureCachePath(const std::string& imgDirPath, const std::string& name, FS_ImageMapFlags flag);
+
+// Block compresses every level of an RGBA8 image with a full mip chain
+DecodedImage cookTexture(const DecodedImage& image, FS_ImageMapFlags flag);
+
+// Uncompressed RGBA8 levels keyed by the source file's content hash, mapped back in on later runs
+std::string getDecodedCachePath(uint64_t sourceHash, VkFormat format);
+bool writeDecodedCache(const std::string& filePath, const DecodedImage& image);
+bool readDecodedCache(const std::string& filePath, DecodedImage& image);
+
+// Minimal KTX2 container: one 2D layer, one face, no supercompression. The source file's content hash is
+// kept in its key/value data, reading fails unless it matches
+bool writeKTX2(const std::string& filePath, const DecodedImage& image, uint64_t sourceHash);
+bool readKTX2(const std::string& filePath, DecodedImage& image, uint64_t sourceHash);
+
+// Maps a file written by writeKTX2 or writeDecodedCache without copying its pixels, levelOffsets locating
+// each level within image.bytes(). Streamed textures read their levels from here as they need them
+bool mapCachedLevels(const std::string& filePath, DecodedImage& image, std::vector<VkDeviceSize>& levelOffsets);
+
+} // namespace festi
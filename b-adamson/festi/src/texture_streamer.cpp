@@ -0,0 +1,244 @@
+#include "texture_streamer.hpp"
+
+#include "texture_cooker.hpp"
+#include "upload_batch.hpp"
+#include "utils.hpp"
+
+// std
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <stdexcept>
+
+namespace festi {
+
+FestiTextureStreamer::FestiTextureStreamer(FestiDevice& device, VkDeviceSize budget) 
+	: festiDevice{device}, budget{budget} {}
+
+FestiTextureStreamer::~FestiTextureStreamer() {
+	destroyRetired(true);
+	for (auto& it : textures) {
+		vkDestroyImageView(festiDevice.device(), it.second.view, nullptr);
+		vkDestroyImage(festiDevice.device(), it.second.image, nullptr);
+		festiDevice.freeMemory(it.second.memory);
+	}
+}
+
+void FestiTextureStreamer::addTexture(uint32_t slot, DecodedImage&& image, FestiUploadBatch& uploads) {
+	assert(image.mipLevels == getMipLevels(image.width, image.height) && "Streamed textures need every mip level");
+
+	StreamedTexture texture{};
+	if (!image.mappedFile && !image.cacheFile.empty()) {
+		// Levels are read back out of the cache file as they're streamed rather than held decoded
+		DecodedImage mapped;
+		std::vector<VkDeviceSize> levelOffsets;
+		if (mapCachedLevels(image.cacheFile, mapped, levelOffsets) && mapped.format == image.format && 
+			mapped.width == image.width && mapped.height == image.height && mapped.mipLevels == image.mipLevels) {
+			texture.source = std::move(mapped);
+			texture.levelOffsets = std::move(levelOffsets);
+		}
+	}
+	if (texture.levelOffsets.empty()) {
+		texture.source = std::move(image);
+		VkDeviceSize offset = 0;
+		for (uint32_t level = 0; level < texture.source.mipLevels; level++) {
+			texture.levelOffsets.push_back(offset);
+			offset += getLevelSize(texture, level);
+		}
+	}
+
+	texture.tailBase = 0;
+	while (texture.tailBase + 1 < texture.source.mipLevels && 
+		std::max(texture.source.width, texture.source.height) >> texture.tailBase > FS_STREAMING_TAIL_SIZE) {
+		texture.tailBase++;
+	}
+	texture.requestedBase = texture.tailBase;
+
+	auto& stored = textures[slot] = std::move(texture);
+	makeResident(slot, stored, stored.tailBase, uploads);
+}
+
+uint32_t FestiTextureStreamer::getFullResolution(uint32_t slot) const {
+	const auto& source = textures.at(slot).source;
+	return std::max(source.width, source.height);
+}
+
+void FestiTextureStreamer::requestMipLevel(uint32_t slot, float mipLevel) {
+	auto it = textures.find(slot);
+	if (it == textures.end()) {return;}
+
+	auto& texture = it->second;
+	const uint32_t level = std::min((uint32_t)std::max(mipLevel, 0.f), texture.tailBase);
+	if (texture.lastUsedFrame != currentFrame) {
+		// First request this frame
+		texture.lastUsedFrame = currentFrame;
+		texture.requestedBase = level;
+	} else {
+		texture.requestedBase = std::min(texture.requestedBase, level);
+	}
+}
+
+void FestiTextureStreamer::update() {
+	destroyRetired(false);
+
+	// Textures nobody asked for this frame only need their tail
+	std::vector<uint32_t> promotions;
+	for (auto& it : textures) {
+		auto& texture = it.second;
+		if (texture.lastUsedFrame < currentFrame) {texture.requestedBase = texture.tailBase;}
+		if (texture.requestedBase < texture.residentBase) {promotions.push_back(it.first);}
+	}
+
+	// Most under-resolved first
+	std::sort(promotions.begin(), promotions.end(), [this](uint32_t a, uint32_t b) {
+		const auto& ta = textures[a];
+		const auto& tb = textures[b];
+		return ta.residentBase - ta.requestedBase > tb.residentBase - tb.requestedBase;
+	});
+
+	FestiUploadBatch uploads{festiDevice};
+	VkDeviceSize uploadedBytes = 0;
+	for (uint32_t slot : promotions) {
+		auto& texture = textures[slot];
+		const uint32_t baseLevel = texture.residentBase - 1;
+		// Leaving the tail allocates the full chain, which takes the tail again along with the new level
+		const bool allocate = baseLevel < texture.imageBase;
+		const VkDeviceSize uploadSize = allocate ? estimateSize(texture, baseLevel) : getLevelSize(texture, baseLevel);
+		if (uploadedBytes > 0 && uploadedBytes + uploadSize > FS_STREAMING_BYTES_PER_FRAME) {break;}
+
+		const VkDeviceSize growth = allocate ? 
+			std::max(estimateSize(texture, 0), texture.residentBytes) - texture.residentBytes : 0;
+		while (residentBytes + growth > budget && evictOne(slot, uploads)) {}
+		if (residentBytes + growth > budget) {continue;}
+
+		makeResident(slot, texture, baseLevel, uploads);
+		uploadedBytes += uploadSize;
+	}
+	uploads.submitAsync();
+	currentFrame++;
+}
+
+bool FestiTextureStreamer::evictOne(uint32_t keepSlot, FestiUploadBatch& uploads) {
+	// Least recently used texture holding its full chain while only its tail is asked for. Only dropping
+	// back to the tail frees memory, lowering the view within the chain wouldn't
+	StreamedTexture* victim = nullptr;
+	uint32_t victimSlot = 0;
+	for (auto& it : textures) {
+		auto& texture = it.second;
+		if (it.first == keepSlot || texture.imageBase == texture.tailBase || texture.requestedBase < texture.tailBase) {
+			continue;
+		}
+		if (!victim || texture.lastUsedFrame < victim->lastUsedFrame) {
+			victim = &texture;
+			victimSlot = it.first;
+		}
+	}
+	if (!victim) {return false;}
+
+	makeResident(victimSlot, *victim, victim->tailBase, uploads);
+	return true;
+}
+
+VkDeviceSize FestiTextureStreamer::getLevelSize(const StreamedTexture& texture, uint32_t level) const {
+	return getMipLevelSize(texture.source.format, texture.source.width >> level, texture.source.height >> level);
+}
+
+VkDeviceSize FestiTextureStreamer::estimateSize(const StreamedTexture& texture, uint32_t baseLevel) const {
+	VkDeviceSize size = 0;
+	for (uint32_t level = baseLevel; level < texture.source.mipLevels; level++) {size += getLevelSize(texture, level);}
+	return size;
+}
+
+void FestiTextureStreamer::createImage(StreamedTexture& texture, uint32_t imageBase) {
+	const auto& source = texture.source;
+	VkImageCreateInfo imageCreateInfo{};
+	festiDevice.defaultImageCreateInfo(imageCreateInfo);
+	imageCreateInfo.format = source.format;
+	imageCreateInfo.extent.width = std::max(source.width >> imageBase, 1u);
+	imageCreateInfo.extent.height = std::max(source.height >> imageBase, 1u);
+	imageCreateInfo.mipLevels = source.mipLevels - imageBase;
+	festiDevice.createImageWithInfo(
+		imageCreateInfo, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, texture.image, texture.memory, FS_MemoryCategory::TEXTURE);
+
+	VkMemoryRequirements memRequirements;
+	vkGetImageMemoryRequirements(festiDevice.device(), texture.image, &memRequirements);
+	texture.imageBase = imageBase;
+	texture.residentBytes = memRequirements.size;
+	residentBytes += memRequirements.size;
+}
+
+VkImageView FestiTextureStreamer::createView(const StreamedTexture& texture, uint32_t baseLevel) {
+	VkImageViewCreateInfo viewCreateInfo{};
+	festiDevice.defaultImageViewCreateInfo(viewCreateInfo);
+	viewCreateInfo.image = texture.image;
+	viewCreateInfo.format = texture.source.format;
+	viewCreateInfo.subresourceRange.baseMipLevel = baseLevel - texture.imageBase;
+	viewCreateInfo.subresourceRange.levelCount = texture.source.mipLevels - baseLevel;
+	viewCreateInfo.components = getTextureComponentMapping(texture.source.format);
+	VkImageView view;
+	if (vkCreateImageView(festiDevice.device(), &viewCreateInfo, nullptr, &view) != VK_SUCCESS) {
+		throw std::runtime_error("failed to create streamed texture image view!");
+	}
+	return view;
+}
+
+void FestiTextureStreamer::makeResident(
+	uint32_t slot, StreamedTexture& texture, uint32_t baseLevel, FestiUploadBatch& uploads) {
+	// Within the full chain only the view changes and the levels it newly exposes are uploaded. Moving
+	// between the tail and the full chain replaces the image and fills every level the view will show
+	const uint32_t imageBase = baseLevel < texture.tailBase ? 0 : texture.tailBase;
+	uint32_t uploadEnd = texture.residentBase;
+	// Frames already recorded may still sample the old image or view, so they outlive them
+	const uint64_t retireFrame = currentFrame + FS_MAX_FRAMES_IN_FLIGHT;
+	if (texture.image == VK_NULL_HANDLE || imageBase != texture.imageBase) {
+		if (texture.image != VK_NULL_HANDLE) {
+			retiredImages.push_back({texture.image, texture.memory, texture.view, retireFrame});
+			residentBytes -= texture.residentBytes;
+		}
+		createImage(texture, imageBase);
+		uploadEnd = texture.source.mipLevels;
+	} else {
+		retiredImages.push_back({VK_NULL_HANDLE, {}, texture.view, retireFrame});
+	}
+
+	const auto& source = texture.source;
+	for (uint32_t level = baseLevel; level < uploadEnd; level++) {
+		uploads.addImageLevel(
+			texture.image,
+			source.format,
+			source.bytes() + texture.levelOffsets[level],
+			getLevelSize(texture, level),
+			std::max(source.width >> imageBase, 1u),
+			std::max(source.height >> imageBase, 1u),
+			level - imageBase);
+	}
+
+	texture.view = createView(texture, baseLevel);
+	texture.residentBase = baseLevel;
+	for (auto& frameSlots : changedSlots) {frameSlots.push_back(slot);}
+}
+
+std::vector<uint32_t> FestiTextureStreamer::takeChangedSlots(uint32_t frameIndex) {
+	std::vector<uint32_t> frameSlots;
+	frameSlots.swap(changedSlots[frameIndex]);
+	std::sort(frameSlots.begin(), frameSlots.end());
+	frameSlots.erase(std::unique(frameSlots.begin(), frameSlots.end()), frameSlots.end());
+	return frameSlots;
+}
+
+void FestiTextureStreamer::clearChangedSlots() {
+	for (auto& frameSlots : changedSlots) {frameSlots.clear();}
+}
+
+void FestiTextureStreamer::destroyRetired(bool all) {
+	auto expired = [this, all](const RetiredImage& retired) {return all || retired.retireFrame <= currentFrame;};
+	for (auto& retired : retiredImages) {
+		if (!expired(retired)) {continue;}
+		vkDestroyImageView(festiDevice.device(), retired.view, nullptr);
+		vkDestroyImage(festiDevice.device(), retired.image, nullptr);
+		festiDevice.freeMemory(retired.memory);
+	}
+	retiredImages.erase(std::remove_if(retiredImages.begin(), retiredImages.end(), expired), retiredImages.end());
+}
+
+} // namespace festi
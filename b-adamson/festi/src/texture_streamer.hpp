@@ -0,0 +1,90 @@
+#pragma once
+
+#include "materials.hpp"
+
+// std
+#include <unordered_map>
+#include <vector>
+
+namespace festi {
+
+constexpr VkDeviceSize FS_TEXTURE_BUDGET = 512ull * 1024 * 1024;
+constexpr VkDeviceSize FS_STREAMING_BYTES_PER_FRAME = 16ull * 1024 * 1024;
+constexpr uint32_t FS_STREAMING_TAIL_SIZE = 64; // mip levels this size and smaller are always resident
+
+// Keeps every texture's mip levels in its mapped cache file (or in memory if it couldn't be cached) and only
+// its demanded levels on the GPU. Textures start with an image holding just their smallest mips. The first
+// promotion past them allocates the full chain, after that each promotion uploads only its new level and the
+// view's base level keeps sampling to what's resident. Least recently used textures drop back to a tail image
+// when the VRAM budget is exceeded. Replaced images and views live until no frame in flight can still use them
+class FestiTextureStreamer {
+public:
+	FestiTextureStreamer(FestiDevice& device, VkDeviceSize budget = FS_TEXTURE_BUDGET);
+	~FestiTextureStreamer();
+
+	FestiTextureStreamer(const FestiTextureStreamer&) = delete;
+	FestiTextureStreamer& operator=(const FestiTextureStreamer&) = delete;
+
+	// image must hold every mip level. Its smallest levels are queued on uploads, the rest are mapped from
+	// image.cacheFile when there is one so the decoded copy can be released
+	void addTexture(uint32_t slot, DecodedImage&& image, FestiUploadBatch& uploads);
+
+	bool isStreamed(uint32_t slot) const {return textures.count(slot) != 0;}
+	VkImageView getImageView(uint32_t slot) const {return textures.at(slot).view;}
+	uint32_t getFullResolution(uint32_t slot) const;
+
+	// Finest mip level the texture is needed at this frame, the sharpest request wins
+	void requestMipLevel(uint32_t slot, float mipLevel);
+	// Applies this frame's requests within the budget and uploads the levels that changed. Called once
+	// per frame after the frame's fence has been waited on
+	void update();
+
+	// Slots whose image view changed since the given frame's descriptor set was last written
+	std::vector<uint32_t> takeChangedSlots(uint32_t frameIndex);
+	void clearChangedSlots();
+
+	void setBudget(VkDeviceSize bytes) {budget = bytes;}
+	VkDeviceSize getResidentBytes() const {return residentBytes;}
+
+private:
+	struct StreamedTexture {
+		DecodedImage source;
+		std::vector<VkDeviceSize> levelOffsets; // into source.bytes()
+		uint32_t tailBase;      // first level that is always resident
+		uint32_t residentBase;  // finest level the view exposes
+		uint32_t requestedBase; // finest level asked for this frame
+		uint64_t lastUsedFrame = 0;
+		uint32_t imageBase = 0; // level the image starts at, tailBase until the full chain is allocated
+		VkImage image = VK_NULL_HANDLE;
+		FestiAllocation memory{};
+		VkImageView view = VK_NULL_HANDLE;
+		VkDeviceSize residentBytes = 0;
+	};
+
+	// image is null when only the view was replaced
+	struct RetiredImage {
+		VkImage image;
+		FestiAllocation memory;
+		VkImageView view;
+		uint64_t retireFrame;
+	};
+
+	void makeResident(uint32_t slot, StreamedTexture& texture, uint32_t baseLevel, FestiUploadBatch& uploads);
+	void createImage(StreamedTexture& texture, uint32_t imageBase);
+	VkImageView createView(const StreamedTexture& texture, uint32_t baseLevel);
+	bool evictOne(uint32_t keepSlot, FestiUploadBatch& uploads);
+	VkDeviceSize getLevelSize(const StreamedTexture& texture, uint32_t level) const;
+	VkDeviceSize estimateSize(const StreamedTexture& texture, uint32_t baseLevel) const;
+	void destroyRetired(bool all);
+
+	FestiDevice& festiDevice;
+	std::unordered_map<uint32_t, StreamedTexture> textures;
+	std::vector<RetiredImage> retiredImages;
+	std::vector<uint32_t> changedSlots[FS_MAX_FRAMES_IN_FLIGHT];
+
+	VkDeviceSize budget;
+	VkDeviceSize residentBytes = 0;
+	uint64_t currentFrame = 1; // counts update calls, requests are stamped with it
+};
+
+} // namespace festi
@@ -0,0 +1,86 @@
+#include "thread_pool.hpp"
+
+namespace festi {
+
+FestiThreadPool::FestiThreadPool(uint32_t threadCount) {
+	workers.reserve(threadCount);
+	for (uint32_t i = 0; i < threadCount; i++) {
+		workers.emplace_back([this]() { workerLoop(); });
+	}
+}
+
+FestiThreadPool::~FestiThreadPool() {
+	{
+		std::lock_guard<std::mutex> lock(queueMutex);
+		stopping = true;
+	}
+	condition.notify_all();
+	for (auto& worker : workers) {worker.join();}
+}
+
+void FestiThreadPool::workerLoop() {
+	while (true) {
+		std::function<void()> task;
+		{
+			std::unique_lock<std::mutex> lock(queueMutex);
+			condition.wait(lock, [this]() { return stopping || !tasks.empty(); });
+			if (stopping && tasks.empty()) {return;}
+			task = std::move(tasks.front());
+			tasks.pop();
+		}
+		task();
+	}
+}
+
+void FestiThreadPool::parallelFor(size_t count, size_t minBatch, const std::function<void(size_t, size_t)>& task) {
+	if (count == 0) {return;}
+	// A few batches per worker evens out uneven batches
+	const size_t batchSize = std::max<size_t>({minBatch, 1, count / (4 * workers.size())});
+	const size_t batchCount = (count + batchSize - 1) / batchSize;
+	if (batchCount == 1) {
+		task(0, count);
+		return;
+	}
+
+	struct Batches {
+		std::atomic<size_t> next{0};
+		std::atomic<size_t> done{0};
+		std::mutex mutex;
+		std::condition_variable finished;
+		std::exception_ptr error;
+	};
+	auto batches = std::make_shared<Batches>();
+	// Helpers that start after every batch is claimed return without touching task, which may be gone by then
+	const auto* taskPointer = &task;
+	auto run = [batches, taskPointer, batchSize, batchCount, count]() {
+		for (size_t batch; (batch = batches->next.fetch_add(1)) < batchCount;) {
+			try {
+				(*taskPointer)(batch * batchSize, std::min(count, (batch + 1) * batchSize));
+			} catch (...) {
+				std::lock_guard<std::mutex> lock(batches->mutex);
+				if (!batches->error) {batches->error = std::current_exception();}
+			}
+			if (batches->done.fetch_add(1) + 1 == batchCount) {
+				std::lock_guard<std::mutex> lock(batches->mutex);
+				batches->finished.notify_all();
+			}
+		}
+	};
+	{
+		std::lock_guard<std::mutex> lock(queueMutex);
+		for (size_t i = 0; i < std::min<size_t>(workers.size(), batchCount - 1); i++) {tasks.emplace(run);}
+	}
+	condition.notify_all();
+	run();
+
+	std::unique_lock<std::mutex> lock(batches->mutex);
+	batches->finished.wait(lock, [&]() { return batches->done.load() == batchCount; });
+	if (batches->error) {std::rethrow_exception(batches->error);}
+}
+
+FestiThreadPool& FestiThreadPool::shared() {
+	static FestiThreadPool pool;
+	return pool;
+}
+
+} // namespace festi
@@ -0,0 +1,63 @@
+#pragma once
+
+// std
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace festi {
+
+class FestiThreadPool {
+public:
+    explicit FestiThreadPool(uint32_t threadCount = std::max(1u, std::thread::hardware_concurrency()));
+    ~FestiThreadPool();
+
+    FestiThreadPool(const FestiThreadPool&) = delete;
+    FestiThreadPool &operator=(const FestiThreadPool&) = delete;
+    FestiThreadPool(FestiThreadPool&&) = delete;
+    FestiThreadPool &operator=(FestiThreadPool&&) = delete;
+
+    // Queues a task, exceptions thrown by the task are rethrown from the future's get()
+    template <typename F>
+    std::future<std::invoke_result_t<F>> submit(F&& task) {
+        using R = std::invoke_result_t<F>;
+        auto packagedTask = std::make_shared<std::packaged_task<R()>>(std::forward<F>(task));
+        std::future<R> future = packagedTask->get_future();
+        {
+            std::lock_guard<std::mutex> lock(queueMutex);
+            tasks.emplace([packagedTask]() { (*packagedTask)(); });
+        }
+        condition.notify_one();
+        return future;
+    }
+
+    // Runs task(begin, end) over [0, count) in batches of at least minBatch. The calling thread works through
+    // batches too and only waits on batches already running, so this is safe to call from inside a pool task.
+    // The first exception thrown by a batch is rethrown once every batch has finished
+    void parallelFor(size_t count, size_t minBatch, const std::function<void(size_t, size_t)>& task);
+
+    uint32_t size() const {return static_cast<uint32_t>(workers.size());}
+
+    // Pool shared by loaders that run before and alongside the main loop
+    static FestiThreadPool& shared();
+
+private:
+    void workerLoop();
+
+    std::vector<std::thread> workers;
+    std::queue<std::function<void()>> tasks;
+    std::mutex queueMutex;
+    std::condition_variable condition;
+    bool stopping = false;
+};
+
+} // namespace festi
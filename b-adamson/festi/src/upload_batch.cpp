@@ -0,0 +1,175 @@
+#include "upload_batch.hpp"
+
+#include "utils.hpp"
+
+// std
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+
+namespace festi {
+
+FestiUploadBatch::FestiUploadBatch(FestiDevice& device) : festiDevice{device} {}
+
+VkDeviceSize FestiUploadBatch::reserveStaging(VkDeviceSize size) {
+	stagingSize = (stagingSize + FS_STAGING_ALIGNMENT - 1) & ~(FS_STAGING_ALIGNMENT - 1);
+	const VkDeviceSize offset = stagingSize;
+	stagingSize += size;
+	return offset;
+}
+
+void FestiUploadBatch::addImage(
+	VkImage image,
+	VkFormat format,
+	const void* data,
+	VkDeviceSize size,
+	uint32_t width,
+	uint32_t height,
+	uint32_t uploadedLevels,
+	uint32_t mipLevels,
+	uint32_t layerCount) {
+	const VkDeviceSize stagingOffset = reserveStaging(size);
+	imageUploads.push_back({image, format, data, size, stagingOffset, width, height, 0, uploadedLevels, mipLevels, layerCount});
+}
+
+void FestiUploadBatch::addImageLevel(
+	VkImage image,
+	VkFormat format,
+	const void* data,
+	VkDeviceSize size,
+	uint32_t width,
+	uint32_t height,
+	uint32_t level) {
+	const VkDeviceSize stagingOffset = reserveStaging(size);
+	imageUploads.push_back({image, format, data, size, stagingOffset, width, height, level, 1, level + 1, 1});
+}
+
+void FestiUploadBatch::addBuffer(VkBuffer buffer, const void* data, VkDeviceSize size, VkDeviceSize offset) {
+	const VkDeviceSize stagingOffset = reserveStaging(size);
+	bufferUploads.push_back({buffer, data, size, offset, stagingOffset});
+}
+
+void FestiUploadBatch::recordUploads() {
+	FestiUploadManager& uploadManager = festiDevice.getUploadManager();
+	const FestiStagingRegion staging = uploadManager.reserve(stagingSize);
+	for (const auto& upload : imageUploads) {
+		std::memcpy(staging.mapped + upload.stagingOffset, upload.data, upload.size);
+	}
+	for (const auto& upload : bufferUploads) {
+		std::memcpy(staging.mapped + upload.stagingOffset, upload.data, upload.size);
+	}
+
+	for (const auto& upload : imageUploads) {
+		recordImageUpload(uploadManager, staging, upload);
+	}
+	for (const auto& upload : bufferUploads) {
+		VkBufferCopy region{staging.offset + upload.stagingOffset, upload.offset, upload.size};
+		vkCmdCopyBuffer(uploadManager.transferCommands(), staging.buffer, upload.buffer, 1, &region);
+		uploadManager.releaseToGraphics(upload.buffer, upload.offset, upload.size);
+	}
+	pending = uploadManager.currentSubmission();
+
+	imageUploads.clear();
+	bufferUploads.clear();
+	stagingSize = 0;
+}
+
+void FestiUploadBatch::submit() {
+	if (empty()) {return;}
+	auto start = std::chrono::high_resolution_clock::now();
+	const size_t imageCount = imageUploads.size();
+	const size_t bufferCount = bufferUploads.size();
+	const VkDeviceSize uploadedSize = stagingSize;
+
+	recordUploads();
+	pending.wait();
+
+	std::chrono::duration<float, std::milli> elapsed = std::chrono::high_resolution_clock::now() - start;
+	std::cout << "Uploaded " << imageCount << " images, " << bufferCount << " buffers, " 
+		<< uploadedSize / (1024.f * 1024.f) << " MB in " << elapsed.count() << " ms\n";
+}
+
+void FestiUploadBatch::submitAsync() {
+	if (empty()) {return;}
+	recordUploads();
+}
+
+void FestiUploadBatch::recordImageUpload(
+	FestiUploadManager& uploadManager, const FestiStagingRegion& staging, const ImageUpload& upload) {
+	VkCommandBuffer commandBuffer = uploadManager.transferCommands();
+	VkImageMemoryBarrier barrier{};
+	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	barrier.srcAccessMask = 0;
+	barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.image = upload.image;
+	barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	barrier.subresourceRange.baseMipLevel = upload.firstLevel;
+	barrier.subresourceRange.levelCount = upload.mipLevels - upload.firstLevel;
+	barrier.subresourceRange.baseArrayLayer = 0;
+	barrier.subresourceRange.layerCount = upload.layerCount;
+
+	vkCmdPipelineBarrier(
+		commandBuffer,
+		VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+		0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+	std::vector<VkBufferImageCopy> regions(upload.uploadedLevels);
+	VkDeviceSize bufferOffset = staging.offset + upload.stagingOffset;
+	for (uint32_t i = 0; i < upload.uploadedLevels; i++) {
+		const uint32_t level = upload.firstLevel + i;
+		const uint32_t levelWidth = std::max(upload.width >> level, 1u);
+		const uint32_t levelHeight = std::max(upload.height >> level, 1u);
+
+		VkBufferImageCopy& region = regions[i];
+		region.bufferOffset = bufferOffset;
+		region.bufferRowLength = 0;
+		region.bufferImageHeight = 0;
+		region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		region.imageSubresource.mipLevel = level;
+		region.imageSubresource.baseArrayLayer = 0;
+		region.imageSubresource.layerCount = upload.layerCount;
+		region.imageOffset = {0, 0, 0};
+		region.imageExtent = {levelWidth, levelHeight, 1};
+
+		bufferOffset += getMipLevelSize(upload.format, levelWidth, levelHeight) * upload.layerCount;
+	}
+
+	vkCmdCopyBufferToImage(
+		commandBuffer,
+		staging.buffer,
+		upload.image,
+		VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+		(uint32_t)regions.size(),
+		regions.data());
+
+	// Blits need a graphics queue, so the copied levels change hands before the rest of the chain is filled
+	uploadManager.releaseToGraphics(upload.image, barrier.subresourceRange, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+	if (upload.firstLevel + upload.uploadedLevels == upload.mipLevels) {
+		// Fully uploaded chains (cooked BC textures) and streamed levels issue no blits, only the final transition
+		barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+		barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+		vkCmdPipelineBarrier(
+			uploadManager.graphicsCommands(),
+			VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+			0, 0, nullptr, 0, nullptr, 1, &barrier);
+		return;
+	}
+	festiDevice.recordMipmapBlits(
+		uploadManager.graphicsCommands(), 
+		upload.image, 
+		upload.width, 
+		upload.height, 
+		upload.uploadedLevels - 1, 
+		upload.mipLevels, 
+		upload.layerCount);
+}
+
+} // namespace festi
@@ -0,0 +1,91 @@
+#pragma once
+
+#include "device.hpp"
+#include "upload_manager.hpp"
+
+// std
+#include <memory>
+#include <vector>
+
+namespace festi {
+
+// Collects image and buffer uploads and stages them together through the device's upload manager, recording
+// every copy, mip blit and layout transition into its current submission
+class FestiUploadBatch {
+public:
+	FestiUploadBatch(FestiDevice& device);
+
+	FestiUploadBatch(const FestiUploadBatch&) = delete;
+	FestiUploadBatch& operator=(const FestiUploadBatch&) = delete;
+
+	// data must stay alive until submit. It holds uploadedLevels tightly packed mip levels of format, each
+	// level holding every array layer in turn. Levels past that up to mipLevels are blitted from the last uploaded one
+	void addImage(
+		VkImage image,
+		VkFormat format,
+		const void* data,
+		VkDeviceSize size,
+		uint32_t width,
+		uint32_t height,
+		uint32_t uploadedLevels,
+		uint32_t mipLevels,
+		uint32_t layerCount = 1);
+	// data must stay alive until submit. Fills one mip level of an image whose level 0 is width by height,
+	// leaving its other levels, which may already be sampled, untouched
+	void addImageLevel(
+		VkImage image,
+		VkFormat format,
+		const void* data,
+		VkDeviceSize size,
+		uint32_t width,
+		uint32_t height,
+		uint32_t level);
+
+	// data must stay alive until submit. It's copied to offset in buffer, which needs TRANSFER_DST usage,
+	// and made visible to vertex input and shader reads
+	void addBuffer(VkBuffer buffer, const void* data, VkDeviceSize size, VkDeviceSize offset = 0);
+
+	void submit();
+	// Stages and records without waiting, data may be released straight away. The copies go to the GPU with
+	// the upload manager's next flush, ahead of anything later submitted to the queue, and are done once
+	// isComplete returns true
+	void submitAsync();
+	bool isComplete() {return pending.isReady();}
+	bool empty() const {return imageUploads.empty() && bufferUploads.empty();}
+
+private:
+	struct ImageUpload {
+		VkImage image;
+		VkFormat format;
+		const void* data;
+		VkDeviceSize size;
+		VkDeviceSize stagingOffset;
+		uint32_t width;
+		uint32_t height;
+		uint32_t firstLevel; // levels before it aren't touched
+		uint32_t uploadedLevels;
+		uint32_t mipLevels;
+		uint32_t layerCount;
+	};
+
+	struct BufferUpload {
+		VkBuffer buffer;
+		const void* data;
+		VkDeviceSize size;
+		VkDeviceSize offset;
+		VkDeviceSize stagingOffset;
+	};
+
+	VkDeviceSize reserveStaging(VkDeviceSize size);
+	void recordUploads();
+	void recordImageUpload(
+		FestiUploadManager& uploadManager, const FestiStagingRegion& staging, const ImageUpload& upload);
+
+	FestiDevice& festiDevice;
+	std::vector<ImageUpload> imageUploads;
+	std::vector<BufferUpload> bufferUploads;
+	VkDeviceSize stagingSize = 0;
+	FestiUploadHandle pending;
+};
+
+} // namespace festi
@@ -0,0 +1,204 @@
+#include "upload_manager.hpp"
+
+#include "buffer.hpp"
+
+// std
+#include <cassert>
+#include <stdexcept>
+
+namespace festi {
+
+bool FestiUploadHandle::isReady() const {
+	return manager == nullptr || manager->isComplete(submission);
+}
+
+void FestiUploadHandle::wait() const {
+	if (manager != nullptr) {manager->wait(submission);}
+}
+
+FestiUploadManager::FestiUploadManager(FestiDevice& device) : festiDevice{device} {
+	ring = std::make_unique<FestiBuffer>(
+		festiDevice,
+		FS_STAGING_RING_SIZE,
+		1,
+		VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+		FS_MemoryCategory::STAGING);
+}
+
+FestiUploadManager::~FestiUploadManager() {
+	flush();
+	while (!inFlight.empty()) {retireOldest();}
+}
+
+FestiStagingRegion FestiUploadManager::reserve(VkDeviceSize size) {
+	// Anything that might not fit the ring even when it's empty gets a buffer of its own
+	if (size > FS_STAGING_RING_SIZE / 2) {
+		auto overflowBuffer = std::make_unique<FestiBuffer>(
+			festiDevice,
+			size,
+			1,
+			VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+			FS_MemoryCategory::STAGING);
+		FestiStagingRegion region{
+			overflowBuffer->getBuffer(), 0, static_cast<char*>(overflowBuffer->getMappedMemory())};
+		currentOverflowBuffers.push_back(std::move(overflowBuffer));
+		return region;
+	}
+
+	// The space still in use belongs to older submissions first, then to the one being recorded
+	VkDeviceSize offset;
+	while (!reserveRing(size, offset)) {
+		if (inFlight.empty()) {flush();}
+		if (inFlight.empty()) {throw std::runtime_error("failed to reserve staging space, nothing left to retire");}
+		retireOldest();
+	}
+	return {ring->getBuffer(), offset, static_cast<char*>(ring->getMappedMemory()) + offset};
+}
+
+bool FestiUploadManager::reserveRing(VkDeviceSize size, VkDeviceSize& offset) {
+	if (head == tail) {head = tail = 0;}
+	VkDeviceSize start = (head + FS_STAGING_ALIGNMENT - 1) & ~(FS_STAGING_ALIGNMENT - 1);
+	if (head >= tail) {
+		// Free space runs from head to the end, then wraps round to tail
+		if (start + size > FS_STAGING_RING_SIZE) {
+			if (size >= tail) {return false;}
+			start = 0;
+		}
+	} else if (start + size >= tail) {
+		return false;
+	}
+	offset = start;
+	head = start + size;
+	return true;
+}
+
+VkCommandBuffer FestiUploadManager::transferCommands() {
+	if (!festiDevice.hasTransferQueue()) {return graphicsCommands();}
+	if (currentTransferCommands == VK_NULL_HANDLE) {currentTransferCommands = festiDevice.beginTransferCommands();}
+	return currentTransferCommands;
+}
+
+VkCommandBuffer FestiUploadManager::graphicsCommands() {
+	if (currentCommands == VK_NULL_HANDLE) {currentCommands = festiDevice.beginSingleTimeCommands();}
+	return currentCommands;
+}
+
+void FestiUploadManager::releaseToGraphics(VkImage image, const VkImageSubresourceRange& range, VkImageLayout layout) {
+	if (!festiDevice.hasTransferQueue()) {return;}
+	VkImageMemoryBarrier barrier{};
+	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	barrier.oldLayout = layout;
+	barrier.newLayout = layout;
+	barrier.srcQueueFamilyIndex = festiDevice.transferQueueFamily();
+	barrier.dstQueueFamilyIndex = festiDevice.graphicsQueueFamily();
+	barrier.image = image;
+	barrier.subresourceRange = range;
+
+	// Release on the transfer queue, then the matching acquire on the graphics queue
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	vkCmdPipelineBarrier(
+		transferCommands(),
+		VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+		0, 0, nullptr, 0, nullptr, 1, &barrier);
+	barrier.srcAccessMask = 0;
+	barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+	vkCmdPipelineBarrier(
+		graphicsCommands(),
+		VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+		0, 0, nullptr, 0, nullptr, 1, &barrier);
+}
+
+void FestiUploadManager::releaseToGraphics(VkBuffer buffer, VkDeviceSize offset, VkDeviceSize size) {
+	if (!festiDevice.hasTransferQueue()) {return;}
+	VkBufferMemoryBarrier barrier{};
+	barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+	barrier.srcQueueFamilyIndex = festiDevice.transferQueueFamily();
+	barrier.dstQueueFamilyIndex = festiDevice.graphicsQueueFamily();
+	barrier.buffer = buffer;
+	barrier.offset = offset;
+	barrier.size = size;
+
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	vkCmdPipelineBarrier(
+		transferCommands(),
+		VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+		0, 0, nullptr, 1, &barrier, 0, nullptr);
+	barrier.srcAccessMask = 0;
+	barrier.dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT | VK_ACCESS_SHADER_READ_BIT;
+	vkCmdPipelineBarrier(
+		graphicsCommands(),
+		VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+		VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+		0, 0, nullptr, 1, &barrier, 0, nullptr);
+}
+
+void FestiUploadManager::flush() {
+	if (currentCommands == VK_NULL_HANDLE && currentTransferCommands == VK_NULL_HANDLE) {return;}
+
+	// Later submissions on the queue read the uploads as vertices, indices, storage or sampled images
+	VkMemoryBarrier barrier{};
+	barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT | VK_ACCESS_SHADER_READ_BIT;
+	vkCmdPipelineBarrier(
+		graphicsCommands(),
+		VK_PIPELINE_STAGE_TRANSFER_BIT,
+		VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+		0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+	// The graphics side waits for the copies, so its fence covers both
+	VkSemaphore transferSemaphore = VK_NULL_HANDLE;
+	if (currentTransferCommands != VK_NULL_HANDLE) {
+		transferSemaphore = festiDevice.submitTransferCommands(currentTransferCommands);
+	}
+	VkFence fence = festiDevice.submitSingleTimeCommands(currentCommands, transferSemaphore);
+	inFlight.push_back({
+		currentID,
+		currentCommands,
+		fence,
+		currentTransferCommands,
+		transferSemaphore,
+		head,
+		std::move(currentOverflowBuffers)});
+	currentID++;
+	currentCommands = VK_NULL_HANDLE;
+	currentTransferCommands = VK_NULL_HANDLE;
+	currentOverflowBuffers.clear();
+}
+
+bool FestiUploadManager::isComplete(uint64_t submission) {
+	if (submission == currentID) {return currentCommands == VK_NULL_HANDLE && currentTransferCommands == VK_NULL_HANDLE;}
+	retireCompleted();
+	return submission <= retiredID;
+}
+
+void FestiUploadManager::wait(uint64_t submission) {
+	if (submission == currentID) {
+		if (isComplete(submission)) {return;}
+		flush();
+	}
+	while (retiredID < submission) {retireOldest();}
+}
+
+void FestiUploadManager::retireCompleted() {
+	while (!inFlight.empty() && vkGetFenceStatus(festiDevice.device(), inFlight.front().fence) == VK_SUCCESS) {
+		retireOldest();
+	}
+}
+
+void FestiUploadManager::retireOldest() {
+	assert(!inFlight.empty() && "No upload submission to retire");
+	Submission& oldest = inFlight.front();
+	vkWaitForFences(festiDevice.device(), 1, &oldest.fence, VK_TRUE, UINT64_MAX);
+	festiDevice.releaseSingleTimeCommands(oldest.commandBuffer, oldest.fence);
+	if (oldest.transferCommandBuffer != VK_NULL_HANDLE) {
+		festiDevice.releaseTransferCommands(oldest.transferCommandBuffer, oldest.transferSemaphore);
+	}
+	tail = oldest.ringEnd;
+	retiredID = oldest.id;
+	inFlight.pop_front();
+}
+
+} // namespace festi
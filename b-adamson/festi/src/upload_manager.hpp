@@ -0,0 +1,101 @@
+#pragma once
+
+#include "device.hpp"
+
+// std
+#include <deque>
+#include <memory>
+#include <vector>
+
+namespace festi {
+
+class FestiBuffer;
+class FestiUploadManager;
+
+constexpr VkDeviceSize FS_STAGING_RING_SIZE = 64ull << 20;
+// Keeps every region at a multiple of the RGBA8 texel and BC block sizes and the usual copy offset alignment
+constexpr VkDeviceSize FS_STAGING_ALIGNMENT = 16;
+
+struct FestiStagingRegion {
+	VkBuffer buffer;
+	VkDeviceSize offset;
+	char* mapped; // already at offset
+};
+
+// Refers to one submission of the upload manager, a future without a value. Default constructed handles are ready
+class FestiUploadHandle {
+public:
+	FestiUploadHandle() = default;
+
+	bool isReady() const;
+	// Submits the uploads first if they're still being recorded
+	void wait() const;
+
+private:
+	friend class FestiUploadManager;
+	FestiUploadHandle(FestiUploadManager* manager, uint64_t submission) : manager{manager}, submission{submission} {}
+
+	FestiUploadManager* manager = nullptr;
+	uint64_t submission = 0;
+};
+
+// Stages uploads through one persistently mapped ring and records their copies into shared command buffers.
+// Copies run on the device's transfer queue when it has one, then hand their resources to the graphics queue,
+// which does the blits and final layouts. flush submits everything recorded since the last flush, fenced on
+// the graphics side, and the ring space it used is reused once that fence signals
+class FestiUploadManager {
+public:
+	FestiUploadManager(FestiDevice& device);
+	~FestiUploadManager();
+
+	FestiUploadManager(const FestiUploadManager&) = delete;
+	FestiUploadManager& operator=(const FestiUploadManager&) = delete;
+
+	// Space for size bytes, valid until the current submission completes. When the ring is full this submits
+	// and waits on older submissions, regions larger than half the ring get their own staging buffer
+	FestiStagingRegion reserve(VkDeviceSize size);
+	// Begun on first use, call after reserve since reserving may submit the previous ones. Both are the same
+	// graphics command buffer without a transfer queue, graphicsCommands run after transferCommands otherwise
+	VkCommandBuffer transferCommands();
+	VkCommandBuffer graphicsCommands();
+	// Moves ownership of a resource written by transferCommands to the graphics queue, nothing without a transfer
+	// queue. The image keeps layout, the buffer range is made readable by vertex input and shaders
+	void releaseToGraphics(VkImage image, const VkImageSubresourceRange& range, VkImageLayout layout);
+	void releaseToGraphics(VkBuffer buffer, VkDeviceSize offset = 0, VkDeviceSize size = VK_WHOLE_SIZE);
+	FestiUploadHandle currentSubmission() {return {this, currentID};}
+	void flush();
+
+	bool isComplete(uint64_t submission);
+	void wait(uint64_t submission);
+
+private:
+	struct Submission {
+		uint64_t id;
+		VkCommandBuffer commandBuffer;
+		VkFence fence;
+		VkCommandBuffer transferCommandBuffer;
+		VkSemaphore transferSemaphore;
+		VkDeviceSize ringEnd;
+		std::vector<std::unique_ptr<FestiBuffer>> overflowBuffers;
+	};
+
+	bool reserveRing(VkDeviceSize size, VkDeviceSize& offset);
+	void retireCompleted();
+	void retireOldest();
+
+	FestiDevice& festiDevice;
+	std::unique_ptr<FestiBuffer> ring;
+	VkDeviceSize head = 0; // end of the newest region, equal to tail only when the ring is empty
+	VkDeviceSize tail = 0; // start of the oldest region still in use
+
+	// Being recorded
+	uint64_t currentID = 1;
+	VkCommandBuffer currentCommands = VK_NULL_HANDLE;
+	VkCommandBuffer currentTransferCommands = VK_NULL_HANDLE;
+	std::vector<std::unique_ptr<FestiBuffer>> currentOverflowBuffers;
+
+	std::deque<Submission> inFlight; // in submission order
+	uint64_t retiredID = 0;
+};
+
+} // namespace festi
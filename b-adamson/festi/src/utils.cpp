@@ -9,9 +9,31 @@
 #include <string>
 #include <stdexcept>
 #include <fstream>
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <filesystem>
+#include <thread>
 
 namespace festi {
 
+// Write to a temporary file first so a half written cache entry is never picked up
+bool writeCacheFile(const std::string& filePath, const void* header, size_t headerSize, const void* data, size_t dataSize) {
+	std::error_code error;
+	std::filesystem::create_directories(std::filesystem::path(filePath).parent_path(), error);
+	// Per thread name, identical content can be cached from several threads at once
+	const std::string tempPath = filePath + "." + std::to_string(std::hash<std::thread::id>{}(std::this_thread::get_id())) + ".tmp";
+	{
+		std::ofstream file{tempPath, std::ios::binary | std::ios::trunc};
+		if (!file.is_open()) {return false;}
+		file.write(static_cast<const char*>(header), headerSize);
+		file.write(static_cast<const char*>(data), dataSize);
+		if (!file.good()) {return false;}
+	}
+	std::filesystem::rename(tempPath, filePath, error);
+	return !error;
+}
+
 std::vector<char> readFile(const std::string& filepath) {
 	std::ifstream file{filepath, std::ios::ate | std::ios::binary};
 
@@ -41,6 +63,113 @@ bool loadImageFromFile(const std::string& filePath, uint32_t& width, uint32_t& h
     return true;
 }
 
+bool getImageExtent(const std::string& filePath, uint32_t& width, uint32_t& height) {
+    int w, h, c;
+    if (!stbi_info(filePath.c_str(), &w, &h, &c)) {return false;}
+    width = static_cast<uint32_t>(w);
+    height = static_cast<uint32_t>(h);
+    return true;
+}
+
+bool loadImageFromMemory(const uint8_t* fileData, size_t fileSize, uint32_t& width, uint32_t& height, std::vector<uint8_t>& imageData) {
+    int w, h, c;
+    stbi_uc* data = stbi_load_from_memory(fileData, static_cast<int>(fileSize), &w, &h, &c, STBI_rgb_alpha);
+    if (!data) {return false;}
+    width = static_cast<uint32_t>(w);
+    height = static_cast<uint32_t>(h);
+    imageData.assign(data, data + (w * h * 4));
+    stbi_image_free(data);
+
+    return true;
+}
+
+uint32_t getMipLevels(uint32_t width, uint32_t height) {
+	return static_cast<uint32_t>(std::floor(std::log2(std::max(width, height)))) + 1;
+}
+
+VkDeviceSize getMipLevelSize(VkFormat format, uint32_t width, uint32_t height) {
+	width = std::max(width, 1u);
+	height = std::max(height, 1u);
+	const VkDeviceSize blocks = (VkDeviceSize)((width + 3) / 4) * ((height + 3) / 4);
+	switch (format) {
+	case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+	case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+	case VK_FORMAT_BC1_RGBA_UNORM_BLOCK:
+	case VK_FORMAT_BC1_RGBA_SRGB_BLOCK:
+	case VK_FORMAT_BC4_UNORM_BLOCK:
+	case VK_FORMAT_BC4_SNORM_BLOCK:
+		return blocks * 8;
+	case VK_FORMAT_BC5_UNORM_BLOCK:
+	case VK_FORMAT_BC5_SNORM_BLOCK:
+	case VK_FORMAT_BC7_UNORM_BLOCK:
+	case VK_FORMAT_BC7_SRGB_BLOCK:
+		return blocks * 16;
+	default:
+		return (VkDeviceSize)width * height * 4;
+	}
+}
+
+VkComponentMapping getTextureComponentMapping(VkFormat format) {
+	if (format == VK_FORMAT_BC4_UNORM_BLOCK) {
+		return {VK_COMPONENT_SWIZZLE_R, VK_COMPONENT_SWIZZLE_R, VK_COMPONENT_SWIZZLE_R, VK_COMPONENT_SWIZZLE_ONE};
+	}
+	return {};
+}
+
+void generateMipChain(std::vector<uint8_t>& imageData, uint32_t width, uint32_t height, uint32_t mipLevels, bool srgb) {
+	static const std::array<float, 256> srgbToLinear = [] {
+		std::array<float, 256> table{};
+		for (size_t i = 0; i < table.size(); i++) {
+			float c = i / 255.f;
+			table[i] = c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+		}
+		return table;
+	}();
+	auto linearToSrgb = [](float c) {
+		c = c <= 0.0031308f ? c * 12.92f : 1.055f * std::pow(c, 1.f / 2.4f) - 0.055f;
+		return static_cast<uint8_t>(std::clamp(c * 255.f + 0.5f, 0.f, 255.f));
+	};
+
+	size_t srcOffset = 0;
+	uint32_t srcWidth = width;
+	uint32_t srcHeight = height;
+	for (uint32_t level = 1; level < mipLevels; level++) {
+		const uint32_t dstWidth = std::max(srcWidth / 2, 1u);
+		const uint32_t dstHeight = std::max(srcHeight / 2, 1u);
+		const size_t dstOffset = imageData.size();
+		imageData.resize(dstOffset + (size_t)dstWidth * dstHeight * 4);
+
+		for (uint32_t y = 0; y < dstHeight; y++) {
+			for (uint32_t x = 0; x < dstWidth; x++) {
+				// 2x2 box, clamped so odd and 1 pixel wide levels reuse the edge texel
+				const uint32_t x0 = std::min(2 * x, srcWidth - 1), x1 = std::min(2 * x + 1, srcWidth - 1);
+				const uint32_t y0 = std::min(2 * y, srcHeight - 1), y1 = std::min(2 * y + 1, srcHeight - 1);
+				const uint8_t* texels[4] = {
+					&imageData[srcOffset + ((size_t)y0 * srcWidth + x0) * 4],
+					&imageData[srcOffset + ((size_t)y0 * srcWidth + x1) * 4],
+					&imageData[srcOffset + ((size_t)y1 * srcWidth + x0) * 4],
+					&imageData[srcOffset + ((size_t)y1 * srcWidth + x1) * 4]};
+				uint8_t* dst = &imageData[dstOffset + ((size_t)y * dstWidth + x) * 4];
+
+				for (int c = 0; c < 4; c++) {
+					if (srgb && c < 3) {
+						float sum = 0.f;
+						for (auto texel : texels) {sum += srgbToLinear[texel[c]];}
+						dst[c] = linearToSrgb(sum * 0.25f);
+					} else {
+						uint32_t sum = texels[0][c] + texels[1][c] + texels[2][c] + texels[3][c];
+						dst[c] = static_cast<uint8_t>((sum + 2) / 4);
+					}
+				}
+			}
+		}
+
+		srcOffset = dstOffset;
+		srcWidth = dstWidth;
+		srcHeight = dstHeight;
+	}
+}
+
 bool runOnceIfKeyPressed(FestiWindow& window, int key, std::function<void()> onPress) {
 	static std::unordered_map<int, bool> keyWasPressedMap;
 	bool& keyWasPressed = keyWasPressedMap[key];
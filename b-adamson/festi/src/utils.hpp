@@ -19,9 +19,34 @@ inline void hashCombine(std::size_t& seed, const T& v, const Rest&... rest) {
     hashCombine(seed, rest...);
 };
 
+// 64 bit FNV-1a, used to key on-disk caches by the content of their source file
+inline uint64_t hashBytes(const void* data, size_t size) {
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
 std::vector<char> readFile(const std::string& filepath);
+// Writes header then data to a temporary file and renames it into place, so readers never see a partial file
+bool writeCacheFile(const std::string& filePath, const void* header, size_t headerSize, const void* data, size_t dataSize);
 
 bool loadImageFromFile(const std::string& filePath, uint32_t& width, uint32_t& height, std::vector<uint8_t>& imageData);
+// Reads only the header, for sizing decisions made before a texture is decoded
+bool getImageExtent(const std::string& filePath, uint32_t& width, uint32_t& height);
+bool loadImageFromMemory(const uint8_t* fileData, size_t fileSize, uint32_t& width, uint32_t& height, std::vector<uint8_t>& imageData);
+
+// Number of levels in a full mip chain for the given extent
+uint32_t getMipLevels(uint32_t width, uint32_t height);
+// Appends box filtered mip levels 1..mipLevels-1 to RGBA8 imageData. sRGB data is averaged in linear space
+void generateMipChain(std::vector<uint8_t>& imageData, uint32_t width, uint32_t height, uint32_t mipLevels, bool srgb);
+// Bytes in one mip level, block compressed formats round up to whole 4x4 blocks
+VkDeviceSize getMipLevelSize(VkFormat format, uint32_t width, uint32_t height);
+// Swizzle for a texture view of format. Single channel BC4 specular reads back as grey like the RGBA8 original
+VkComponentMapping getTextureComponentMapping(VkFormat format);
 
 bool runOnceIfKeyPressed(FestiWindow& window, int key, std::function<void()> onPress);
 
@@ -0,0 +1,14 @@
+#include "vertex_dedup.hpp"
+
+namespace festi {
+
+FestiVertexDedup::FestiVertexDedup(size_t maxVertices) {
+    // At most half full, so probe sequences stay short
+    size_t capacity = 16;
+    while (capacity < 2 * maxVertices) {capacity <<= 1;}
+    slots.assign(capacity, Slot{0, EMPTY});
+    keys.reserve(maxVertices);
+    mask = capacity - 1;
+}
+
+} // namespace festi
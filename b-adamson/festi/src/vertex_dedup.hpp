@@ -0,0 +1,84 @@
+#pragma once
+
+#include "model.hpp"
+
+// std
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+namespace festi {
+
+// Open addressing table mapping vertex attributes to the index of their first occurrence. Sized up front
+// from the index count so it never rehashes, and each lookup is a single linear probe sequence.
+// Only position, normal and uv take part, tangents are built after dedup
+class FestiVertexDedup {
+public:
+    explicit FestiVertexDedup(size_t maxVertices);
+
+    // Index of an equal vertex inserted earlier, otherwise inserts this one as the next index (the number
+    // of vertices inserted so far)
+    uint32_t findOrInsert(const Vertex& vertex, bool& inserted) {
+        const Key key = makeKey(vertex);
+        const uint64_t hash = hashKey(key);
+        const uint32_t tag = (uint32_t)(hash >> 32);
+        for (size_t slot = (size_t)hash & mask;; slot = (slot + 1) & mask) {
+            Slot& entry = slots[slot];
+            if (entry.index == EMPTY) {
+                entry = {tag, (uint32_t)keys.size()};
+                keys.push_back(key);
+                inserted = true;
+                return entry.index;
+            }
+            if (entry.tag == tag && std::memcmp(&keys[entry.index], &key, sizeof(Key)) == 0) {
+                inserted = false;
+                return entry.index;
+            }
+        }
+    }
+
+private:
+    static constexpr uint32_t EMPTY = UINT32_MAX;
+
+    struct Key {
+        float values[8]; // position, normal, uv
+    };
+    struct Slot {
+        uint32_t tag;
+        uint32_t index;
+    };
+
+    static Key makeKey(const Vertex& vertex) {
+        // + 0.f folds -0 into 0, matching Vertex::operator==
+        return {{vertex.position.x + 0.f, vertex.position.y + 0.f, vertex.position.z + 0.f,
+            vertex.normal.x + 0.f, vertex.normal.y + 0.f, vertex.normal.z + 0.f,
+            vertex.uv.x + 0.f, vertex.uv.y + 0.f}};
+    }
+
+    // Four independent 64 bit lanes over the raw key bytes, so the multiplies vectorise, folded by rotation
+    // and finished with murmur3's 64 bit finaliser
+    static uint64_t hashKey(const Key& key) {
+        static constexpr uint64_t seeds[4] = {
+            0x9e3779b97f4a7c15ull, 0xbf58476d1ce4e5b9ull, 0x94d049bb133111ebull, 0xc2b2ae3d27d4eb4full};
+        uint64_t lanes[4];
+        std::memcpy(lanes, key.values, sizeof(lanes));
+        for (int i = 0; i < 4; i++) {
+            lanes[i] = (lanes[i] ^ seeds[i]) * 0x87c37b91114253d5ull;
+            lanes[i] ^= lanes[i] >> 32;
+        }
+        uint64_t hash = lanes[0] ^ rotate(lanes[1], 16) ^ rotate(lanes[2], 32) ^ rotate(lanes[3], 48);
+        hash ^= hash >> 33;
+        hash *= 0xff51afd7ed558ccdull;
+        hash ^= hash >> 33;
+        hash *= 0xc4ceb9fe1a85ec53ull;
+        return hash ^ (hash >> 33);
+    }
+
+    static uint64_t rotate(uint64_t value, int bits) {return (value << bits) | (value >> (64 - bits));}
+
+    std::vector<Slot> slots;
+    std::vector<Key> keys;
+    size_t mask;
+};
+
+} // namespace festi